@@ -5,6 +5,11 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/delay.h>
+#include<linux/slab.h>
+
+#define KBUF_SIZE 10  // 每个文件私有写缓冲区的大小，与原来的 kbuf[10] 一致
+
+static struct kmem_cache *kbuf_cache;  // 私有写缓冲区的专用缓存
 
 /**
  * @brief 设备打开函数
@@ -14,6 +19,13 @@
  */
 static int open_test(struct inode *inode,struct file *file)
 {
+	char *kbuf;
+
+	// 为当前文件分配私有写缓冲区
+	kbuf=kmem_cache_zalloc(kbuf_cache,GFP_KERNEL);
+	if(kbuf==NULL)
+		return -ENOMEM;
+	file->private_data=kbuf;
 	printk("\nThis is open_test\n");
 	return 0;
 }
@@ -42,8 +54,6 @@ static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *
 	return 0;
 }
 
-static char kbuf[10]={0};  // 内核空间写缓冲区
-
 /**
  * @brief 设备写入函数
  * @param file 设备文件结构
@@ -54,7 +64,10 @@ static char kbuf[10]={0};  // 内核空间写缓冲区
  */
 static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,loff_t *off)
 {
+	char *kbuf=file->private_data;  // 当前文件私有的写缓冲区
 	int ret;
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
 	ret=copy_from_user(kbuf,ubuf,len);  // 将数据从用户空间复制到内核空间
 
 	if(ret!=0)
@@ -62,6 +75,7 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
 		printk("copy_from_user is error\n");
 		return -1;
 	}
+	kbuf[len]='\0';
 
 	// 根据写入的字符串执行不同的延时操作
 	if(strcmp(kbuf,"topeet")==0)
@@ -85,6 +99,7 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
+	kmem_cache_free(kbuf_cache,file->private_data);  // 释放当前文件的私有写缓冲区
 	printk("\nThis is release_test \n");
 	return 0;
 }
@@ -119,6 +134,11 @@ static int __init atomic_init(void)
 {
 	int ret;
 	
+	// 创建私有写缓冲区的专用缓存，按缓存行对齐，避免不同文件的缓冲区伪共享
+	kbuf_cache=kmem_cache_create(KBUILD_MODNAME "_kbuf",KBUF_SIZE,0,SLAB_HWCACHE_ALIGN,NULL);
+	if(kbuf_cache==NULL)
+		return -ENOMEM;
+
 	// 动态分配设备号
 	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"chrdev_name");
 	if(ret<0){
@@ -156,6 +176,7 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	kmem_cache_destroy(kbuf_cache);
 	printk("module exit\n");
 }
 
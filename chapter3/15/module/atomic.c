@@ -5,12 +5,323 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/delay.h>
+#include<linux/slab.h>
+#include<linux/moduleparam.h>
 #include<linux/atomic.h>
 #include<linux/errno.h>
+#include<linux/seqlock.h>
+#include<linux/percpu.h>
+#include<linux/device.h>
+#include<linux/kthread.h>
+#include<linux/completion.h>
+#include<linux/cpu.h>
+#include<linux/ktime.h>
+#include<linux/mutex.h>
+#include<linux/math64.h>
+
+#define KBUF_SIZE 10  // 写缓冲区和 state.data 的大小
+
+// 多路打开模式：为true时不再独占设备，多个写者可以并行，每个文件使用自己的缓冲区
+static bool multi_open;
+module_param(multi_open,bool,0444);
+MODULE_PARM_DESC(multi_open,"allow concurrent opens, each file writes into its own buffer");
+
+static struct kmem_cache *kbuf_cache;  // 私有写缓冲区的专用缓存
 
 // 定义并初始化原子变量，用于设备互斥访问控制
 static atomic64_t v=ATOMIC_INIT(1);
 
+// 顺序锁快照模式：忙标志和最近写入的数据作为一个整体由顺序锁保护，
+// 写者只做很短的拷贝，读者不阻塞，读到一半被修改就重试
+static bool seq_mode;
+module_param(seq_mode,bool,0444);
+MODULE_PARM_DESC(seq_mode,"protect busy flag and last payload with a seqlock");
+
+// 设备状态：忙标志和最近一次写入的数据
+struct dev_state{
+	int busy;              // 1表示设备被占用
+	size_t len;            // 数据长度
+	char data[KBUF_SIZE];  // 最近一次写入的数据
+};
+
+static DEFINE_SEQLOCK(state_lock);  // 保护设备状态的顺序锁
+static struct dev_state state={
+	.busy=0,
+	.len=6,
+	.data="topeet",
+};
+
+/**
+ * @brief 读取设备状态的一致快照，读者不加锁，与写者冲突时重试
+ * @param kbuf 内核空间缓冲区，至少 KBUF_SIZE 字节
+ * @param len 最多读取的长度
+ * @return 实际读取的长度
+ */
+static size_t state_read(char *kbuf,size_t len)
+{
+	struct dev_state snap;
+	unsigned int seq;
+
+	do{
+		seq=read_seqbegin(&state_lock);
+		snap=state;
+	}while(read_seqretry(&state_lock,seq));
+
+	pr_debug("busy is %d\n",snap.busy);
+	len=min(len,snap.len);
+	memcpy(kbuf,snap.data,len);
+	return len;
+}
+
+/**
+ * @brief 更新设备状态中最近一次写入的数据
+ * @param kbuf 新的数据
+ * @param len 数据长度，不超过 KBUF_SIZE
+ */
+static void state_update(const char *kbuf,size_t len)
+{
+	write_seqlock(&state_lock);
+	memcpy(state.data,kbuf,len);
+	state.len=len;
+	write_sequnlock(&state_lock);
+}
+
+/**
+ * @brief 在顺序锁保护下占用设备
+ * @return 成功返回0，设备忙返回-EBUSY
+ */
+static int state_acquire(void)
+{
+	int ret=0;
+
+	write_seqlock(&state_lock);
+	if(state.busy)
+		ret=-EBUSY;
+	else
+		state.busy=1;
+	write_sequnlock(&state_lock);
+	return ret;
+}
+
+/**
+ * @brief 在顺序锁保护下释放设备
+ */
+static void state_release(void)
+{
+	write_seqlock(&state_lock);
+	state.busy=0;
+	write_sequnlock(&state_lock);
+}
+
+// 统计模式：0不统计，1使用全局原子变量，2使用每CPU计数器
+// 运行时可以通过 /sys/module/atomic/parameters/stat_mode 切换，用来对比两种方式的开销
+enum{
+	STAT_OFF,
+	STAT_GLOBAL,
+	STAT_PERCPU,
+};
+static int stat_mode=STAT_PERCPU;
+module_param(stat_mode,int,0644);
+MODULE_PARM_DESC(stat_mode,"0: no statistics, 1: global atomic64 counters, 2: per-CPU counters");
+
+// 统计项
+enum{
+	STAT_OPENS,
+	STAT_READS,
+	STAT_WRITES,
+	STAT_BYTES,  // read/write 传输的字节数
+	STAT_NR,
+};
+
+// 全局计数器：所有CPU修改同一个缓存行，缓存行在各个核之间来回迁移
+static atomic64_t glob_stat[STAT_NR];
+
+// 每CPU计数器：每个CPU只修改自己的副本，读取时再把所有CPU的值加起来
+struct dev_stat{
+	u64 cnt[STAT_NR];
+};
+static DEFINE_PER_CPU(struct dev_stat,pcpu_stat);
+
+/**
+ * @brief 按照当前的统计模式累加计数
+ * @param idx 统计项
+ * @param n 增加的值
+ */
+static inline void stat_add(int idx,u64 n)
+{
+	switch(READ_ONCE(stat_mode)){
+		case STAT_GLOBAL:
+			atomic64_add(n,&glob_stat[idx]);
+			break;
+		case STAT_PERCPU:
+			this_cpu_add(pcpu_stat.cnt[idx],n);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief 读取统计值，把所有CPU的计数加起来（切换过模式时两种计数器都要算上）
+ * @param idx 统计项
+ * @return 统计值
+ */
+static u64 stat_fold(int idx)
+{
+	u64 sum=atomic64_read(&glob_stat[idx]);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum+=per_cpu(pcpu_stat.cnt[idx],cpu);
+	return sum;
+}
+
+// 在设备的 sysfs 目录 /sys/class/class_test/device_test/ 下为每个统计项创建一个只读文件
+#define STAT_ATTR(name,idx) \
+static ssize_t name##_show(struct device *dev,struct device_attribute *attr,char *buf) \
+{ \
+	return sprintf(buf,"%llu\n",stat_fold(idx)); \
+} \
+static DEVICE_ATTR_RO(name)
+
+STAT_ATTR(opens,STAT_OPENS);
+STAT_ATTR(reads,STAT_READS);
+STAT_ATTR(writes,STAT_WRITES);
+STAT_ATTR(bytes,STAT_BYTES);
+
+/*
+ * 计数器微基准测试：在每个在线CPU上绑定一个内核线程，同时对计数器做 iters 次加1，
+ * 分别测量全局原子变量和每CPU计数器的平均耗时，结果通过 stat_bench 文件读取
+ */
+static atomic64_t bench_global;
+static DEFINE_PER_CPU(u64,bench_pcpu);
+static DEFINE_MUTEX(bench_lock);  // 同一时间只运行一个测试
+static char bench_result[512];    // 最近一次测试的结果
+
+struct bench_arg{
+	int mode;              // STAT_GLOBAL 或 STAT_PERCPU
+	u64 iters;             // 每个线程的加1次数
+	atomic_t *ready;       // 还没有就绪的线程数，为0时所有线程同时开始
+	struct task_struct *task;
+	u64 ns;                // 本线程的耗时
+	struct completion done;
+};
+
+static int bench_thread(void *data)
+{
+	struct bench_arg *arg=data;
+	u64 i,t0;
+
+	// 等所有CPU上的线程都就绪之后再开始，保证测的是同时竞争的情况，
+	// 等待时让出CPU，不影响同一个CPU上还在创建线程的调用者
+	atomic_dec(arg->ready);
+	while(atomic_read(arg->ready)>0)
+		cond_resched();
+
+	t0=ktime_get_ns();
+	for(i=0;i<arg->iters;i++){
+		if(arg->mode==STAT_GLOBAL)
+			atomic64_inc(&bench_global);
+		else
+			this_cpu_inc(bench_pcpu);
+	}
+	arg->ns=ktime_get_ns()-t0;
+	complete(&arg->done);
+	return 0;
+}
+
+/**
+ * @brief 在所有在线CPU上运行一轮测试
+ * @param mode STAT_GLOBAL 或 STAT_PERCPU
+ * @param iters 每个CPU的加1次数
+ * @param ncpu 返回参与测试的CPU数
+ * @return 每次加1的平均耗时(ns)，失败返回0
+ */
+static u64 bench_run(int mode,u64 iters,int *ncpu)
+{
+	struct bench_arg *args;
+	atomic_t ready;
+	u64 total=0;
+	int cpu,n=0,i;
+
+	args=kcalloc(nr_cpu_ids,sizeof(*args),GFP_KERNEL);
+	if(args==NULL)
+		return 0;
+
+	// 先在每个CPU上创建线程，全部创建成功后再一起唤醒
+	cpus_read_lock();
+	for_each_online_cpu(cpu){
+		args[n].mode=mode;
+		args[n].iters=iters;
+		args[n].ready=&ready;
+		init_completion(&args[n].done);
+		args[n].task=kthread_create(bench_thread,&args[n],"stat_bench/%d",cpu);
+		if(IS_ERR(args[n].task))
+			continue;
+		kthread_bind(args[n].task,cpu);
+		n++;
+	}
+	atomic_set(&ready,n);
+	for(i=0;i<n;i++)
+		wake_up_process(args[i].task);
+	for(i=0;i<n;i++){
+		wait_for_completion(&args[i].done);
+		total+=args[i].ns;
+	}
+	cpus_read_unlock();
+
+	kfree(args);
+	*ncpu=n;
+	return n ? div64_u64(total,(u64)n*iters) : 0;
+}
+
+static ssize_t stat_bench_show(struct device *dev,struct device_attribute *attr,char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&bench_lock);
+	ret=sprintf(buf,"%s",bench_result[0] ? bench_result : "write an iteration count to run the benchmark\n");
+	mutex_unlock(&bench_lock);
+	return ret;
+}
+
+/* 写入每个CPU的加1次数开始测试，例如 echo 1000000 > stat_bench */
+static ssize_t stat_bench_store(struct device *dev,struct device_attribute *attr,const char *buf,size_t count)
+{
+	u64 iters,ns_global,ns_percpu;
+	int ncpu=0;
+	int ret;
+
+	ret=kstrtoull(buf,0,&iters);
+	if(ret<0)
+		return ret;
+	if(iters==0)
+		return -EINVAL;
+
+	mutex_lock(&bench_lock);
+	ns_global=bench_run(STAT_GLOBAL,iters,&ncpu);
+	ns_percpu=bench_run(STAT_PERCPU,iters,&ncpu);
+	snprintf(bench_result,sizeof(bench_result),
+		"cpus:       %d\n"
+		"iters:      %llu\n"
+		"atomic64:   %llu ns/op\n"
+		"percpu:     %llu ns/op\n",
+		ncpu,iters,ns_global,ns_percpu);
+	mutex_unlock(&bench_lock);
+	return count;
+}
+static DEVICE_ATTR_RW(stat_bench);
+
+static struct attribute *dev_attrs[]={
+	&dev_attr_opens.attr,
+	&dev_attr_reads.attr,
+	&dev_attr_writes.attr,
+	&dev_attr_bytes.attr,
+	&dev_attr_stat_bench.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(dev);
+
 /**
  * @brief 设备打开函数
  * @param inode 设备文件的inode结构
@@ -19,12 +330,30 @@ static atomic64_t v=ATOMIC_INIT(1);
  */
 static int open_test(struct inode *inode,struct file *file)
 {
-	// 检查设备是否可用
-	if(atomic64_read(&v) != 1){
-		return -EBUSY;  // 设备忙，返回错误
-	}
+	char *kbuf;
 
-	atomic64_set(&v,0);  // 设置设备为占用状态
+	// 为当前文件分配私有写缓冲区
+	kbuf=kmem_cache_zalloc(kbuf_cache,GFP_KERNEL);
+	if(kbuf==NULL)
+		return -ENOMEM;
+
+	// 多路打开模式下不独占设备
+	if(!multi_open && seq_mode){
+		if(state_acquire()<0){
+			kmem_cache_free(kbuf_cache,kbuf);
+			return -EBUSY;  // 设备忙，返回错误
+		}
+	}else if(!multi_open){
+		// 检查设备是否可用
+		if(atomic64_read(&v) != 1){
+			kmem_cache_free(kbuf_cache,kbuf);
+			return -EBUSY;  // 设备忙，返回错误
+		}
+
+		atomic64_set(&v,0);  // 设置设备为占用状态
+	}
+	file->private_data=kbuf;
+	stat_add(STAT_OPENS,1);
 	return 0;
 }
 
@@ -39,21 +368,25 @@ static int open_test(struct inode *inode,struct file *file)
 static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *off)
 {
 	int ret;
-	char kbuf[10]="topeet";  // 内核空间缓冲区
-	printk("\nthis is read_test\n");
-	ret=copy_to_user(ubuf,kbuf,strlen(kbuf));  // 将数据从内核空间复制到用户空间
+	char kbuf[KBUF_SIZE]="topeet";  // 内核空间缓冲区
+	pr_debug("\nthis is read_test\n");
+	if(seq_mode)
+		len=state_read(kbuf,len);  // 顺序锁模式下返回最近一次写入的数据
+	else
+		len=min(len,strlen(kbuf));  // 默认只返回固定的字符串，不读共享数据，读路径的对照是 16/spinlock 的加锁读(locked_read=1)
+	ret=copy_to_user(ubuf,kbuf,len);  // 将数据从内核空间复制到用户空间
 	if(ret!=0)
 	{
 		printk("copy_to_user error\n");
 		return -1;
 	}
+	stat_add(STAT_READS,1);
+	stat_add(STAT_BYTES,len);
 
-	printk("copy to user is ok\n");
+	pr_debug("copy to user is ok\n");
 	return 0;
 }
 
-static char kbuf[10]={0};  // 内核空间写缓冲区
-
 /**
  * @brief 设备写入函数
  * @param file 设备文件结构
@@ -64,7 +397,10 @@ static char kbuf[10]={0};  // 内核空间写缓冲区
  */
 static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,loff_t *off)
 {
+	char *kbuf=file->private_data;  // 当前文件私有的写缓冲区
 	int ret;
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
 	ret=copy_from_user(kbuf,ubuf,len);  // 将数据从用户空间复制到内核空间
 
 	if(ret!=0)
@@ -72,6 +408,11 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
 		printk("copy_from_user is error\n");
 		return -1;
 	}
+	kbuf[len]='\0';
+	stat_add(STAT_WRITES,1);
+	stat_add(STAT_BYTES,len);
+	if(seq_mode)
+		state_update(kbuf,len);  // 记录最近一次写入的数据
 
 	// 根据写入的字符串执行不同的延时操作
 	if(strcmp(kbuf,"topeet")==0)
@@ -95,7 +436,11 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
-	atomic64_set(&v,1);  // 释放设备，设置为可用状态
+	if(!multi_open && seq_mode)
+		state_release();
+	else if(!multi_open)
+		atomic64_set(&v,1);  // 释放设备，设置为可用状态
+	kmem_cache_free(kbuf_cache,file->private_data);  // 释放当前文件的私有写缓冲区
 	return 0;
 }
 
@@ -129,6 +474,10 @@ static int __init atomic_init(void)
 {
 	int ret;
 	
+	kbuf_cache=kmem_cache_create(KBUILD_MODNAME "_kbuf",KBUF_SIZE,0,SLAB_HWCACHE_ALIGN,NULL);
+	if(kbuf_cache==NULL)
+		return -ENOMEM;
+
 	// 动态分配设备号
 	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"chrdev_name");
 	if(ret<0){
@@ -150,8 +499,8 @@ static int __init atomic_init(void)
 	// 创建设备类
 	dev1.class_test=class_create(THIS_MODULE,"class_test");
 	
-	// 创建设备节点
-	device_create(dev1.class_test,0,dev1.dev_num,0,"device_test");
+	// 创建设备节点，同时创建统计用的 sysfs 文件
+	device_create_with_groups(dev1.class_test,0,dev1.dev_num,0,dev_groups,"device_test");
 
 	return 0;
 }
@@ -166,6 +515,7 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	kmem_cache_destroy(kbuf_cache);
 	printk("module exit\n");
 }
 
@@ -5,12 +5,208 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/delay.h>
+#include<linux/slab.h>
+#include<linux/moduleparam.h>
 #include<linux/atomic.h>
 #include<linux/errno.h>
+#include<linux/rcupdate.h>
+#include<linux/seqlock.h>
+#include "lock_stat.h"
+
+#define KBUF_SIZE 10  // 写缓冲区和发布给读者的数据的大小
+
+// 多路打开模式：为true时不再独占设备，多个写者可以并行，每个文件使用自己的缓冲区
+static bool multi_open;
+module_param(multi_open,bool,0444);
+MODULE_PARM_DESC(multi_open,"allow concurrent opens, each file writes into its own buffer");
+
+static struct kmem_cache *kbuf_cache;  // 私有写缓冲区的专用缓存
 
 // 定义自旋锁和标志位，用于设备互斥访问控制
 static spinlock_t spinlock_test;
 static int flag=1;
+static struct lock_stat spinlock_stat;  // 自旋锁的等锁/持锁时间统计
+
+// 顺序锁快照模式：忙标志和最近写入的数据作为一个整体由顺序锁保护，
+// 写者只做很短的拷贝，读者不阻塞，读到一半被修改就重试
+static bool seq_mode;
+module_param(seq_mode,bool,0444);
+MODULE_PARM_DESC(seq_mode,"protect busy flag and last payload with a seqlock, cannot be combined with rcu_mode");
+
+// 设备状态：忙标志和最近一次写入的数据
+struct dev_state{
+	int busy;              // 1表示设备被占用
+	size_t len;            // 数据长度
+	char data[KBUF_SIZE];  // 最近一次写入的数据
+};
+
+static DEFINE_SEQLOCK(state_lock);  // 保护设备状态的顺序锁
+static struct dev_state state={
+	.busy=0,
+	.len=6,
+	.data="topeet",
+};
+
+/**
+ * @brief 读取设备状态的一致快照，读者不加锁，与写者冲突时重试
+ * @param kbuf 内核空间缓冲区，至少 KBUF_SIZE 字节
+ * @param len 最多读取的长度
+ * @return 实际读取的长度
+ */
+static size_t state_read(char *kbuf,size_t len)
+{
+	struct dev_state snap;
+	unsigned int seq;
+
+	do{
+		seq=read_seqbegin(&state_lock);
+		snap=state;
+	}while(read_seqretry(&state_lock,seq));
+
+	pr_debug("busy is %d\n",snap.busy);
+	len=min(len,snap.len);
+	memcpy(kbuf,snap.data,len);
+	return len;
+}
+
+/**
+ * @brief 更新设备状态中最近一次写入的数据
+ * @param kbuf 新的数据
+ * @param len 数据长度，不超过 KBUF_SIZE
+ */
+static void state_update(const char *kbuf,size_t len)
+{
+	write_seqlock(&state_lock);
+	memcpy(state.data,kbuf,len);
+	state.len=len;
+	write_sequnlock(&state_lock);
+}
+
+/**
+ * @brief 在顺序锁保护下占用设备
+ * @return 成功返回0，设备忙返回-EBUSY
+ */
+static int state_acquire(void)
+{
+	int ret=0;
+
+	write_seqlock(&state_lock);
+	if(state.busy)
+		ret=-EBUSY;
+	else
+		state.busy=1;
+	write_sequnlock(&state_lock);
+	return ret;
+}
+
+/**
+ * @brief 在顺序锁保护下释放设备
+ */
+static void state_release(void)
+{
+	write_seqlock(&state_lock);
+	state.busy=0;
+	write_sequnlock(&state_lock);
+}
+
+// 发布给读者的数据：最近一次写入的内容，初始为"topeet"
+struct pub_buf{
+	struct rcu_head rcu;   // 用于 kfree_rcu 延迟释放
+	size_t len;            // 数据长度
+	char data[KBUF_SIZE];  // 数据内容
+};
+
+// 加锁读模式：读者在 pub_lock 下读取最近一次写入的数据，作为 RCU 读路径的对照
+static bool locked_read;
+module_param(locked_read,bool,0444);
+MODULE_PARM_DESC(locked_read,"readers copy the published buffer under pub_lock, baseline for rcu_mode");
+
+// RCU读模式：读者不加锁，写者复制出新的数据后替换指针，旧数据在宽限期之后释放
+static bool rcu_mode;
+module_param(rcu_mode,bool,0444);
+MODULE_PARM_DESC(rcu_mode,"lock-free RCU read path for the published buffer");
+
+static struct pub_buf __rcu *pub;  // 当前发布的数据
+static DEFINE_SPINLOCK(pub_lock);  // 保护发布数据的写者锁，只在拷贝/替换指针时短暂持有
+
+/**
+ * @brief 是否把最近一次写入的数据发布给读者
+ * @return 任一读路径测试模式打开时返回true，默认的读取只返回固定的"topeet"
+ */
+static bool pub_enabled(void)
+{
+	return locked_read || rcu_mode || seq_mode;
+}
+
+/**
+ * @brief 读取当前发布的数据
+ * @param kbuf 内核空间缓冲区，至少 KBUF_SIZE 字节
+ * @param len 最多读取的长度
+ * @return 实际读取的长度
+ */
+static size_t pub_read(char *kbuf,size_t len)
+{
+	struct pub_buf *p;
+
+	if(seq_mode)
+		return state_read(kbuf,len);
+
+	if(rcu_mode){
+		// 读者只进入RCU读临界区，不加锁，也不写任何共享数据
+		rcu_read_lock();
+		p=rcu_dereference(pub);
+		len=min(len,p->len);
+		memcpy(kbuf,p->data,len);
+		rcu_read_unlock();
+	}else{
+		spin_lock(&pub_lock);
+		p=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+		len=min(len,p->len);
+		memcpy(kbuf,p->data,len);
+		spin_unlock(&pub_lock);
+	}
+	return len;
+}
+
+/**
+ * @brief 用新写入的内容更新发布的数据
+ * @param kbuf 新的数据
+ * @param len 数据长度，不超过 KBUF_SIZE
+ * @return 成功返回0，失败返回-ENOMEM
+ */
+static int pub_update(const char *kbuf,size_t len)
+{
+	struct pub_buf *newp,*old;
+
+	if(seq_mode){
+		state_update(kbuf,len);
+		return 0;
+	}
+
+	if(!rcu_mode){
+		// 加锁模式下直接在原地修改，读者和写者互斥
+		spin_lock(&pub_lock);
+		old=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+		memcpy(old->data,kbuf,len);
+		old->len=len;
+		spin_unlock(&pub_lock);
+		return 0;
+	}
+
+	// RCU模式：先复制出新的数据，再替换指针，正在读旧数据的读者不受影响
+	newp=kmalloc(sizeof(*newp),GFP_KERNEL);
+	if(newp==NULL)
+		return -ENOMEM;
+	memcpy(newp->data,kbuf,len);
+	newp->len=len;
+
+	spin_lock(&pub_lock);
+	old=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+	rcu_assign_pointer(pub,newp);
+	spin_unlock(&pub_lock);
+	kfree_rcu(old,rcu);  // 等所有读者离开之后再释放旧数据
+	return 0;
+}
 
 /**
  * @brief 设备打开函数
@@ -20,15 +216,38 @@ static int flag=1;
  */
 static int open_test(struct inode *inode,struct file *file)
 {
-	// 获取自旋锁
-	spin_lock(&spinlock_test);
-	if(flag != 1){
-		spin_unlock(&spinlock_test);
-		return -EBUSY;  // 设备忙，返回错误
-	}
+	char *kbuf;
+	u64 t0,t1;
 
-	flag=0;  // 设置设备为占用状态
-	spin_unlock(&spinlock_test);  // 释放自旋锁
+	// 为当前文件分配私有写缓冲区
+	kbuf=kmem_cache_zalloc(kbuf_cache,GFP_KERNEL);
+	if(kbuf==NULL)
+		return -ENOMEM;
+
+	// 多路打开模式下不独占设备，也就不需要加锁
+	if(!multi_open && seq_mode){
+		// 顺序锁模式：忙标志由顺序锁保护
+		if(state_acquire()<0){
+			kmem_cache_free(kbuf_cache,kbuf);
+			return -EBUSY;  // 设备忙，返回错误
+		}
+	}else if(!multi_open){
+		// 获取自旋锁
+		t0=lock_stat_wait_begin(&spinlock_stat);
+		spin_lock(&spinlock_test);
+		t1=lock_stat_acquired(&spinlock_stat,t0);
+		if(flag != 1){
+			lock_stat_released(&spinlock_stat,t1);
+			spin_unlock(&spinlock_test);
+			kmem_cache_free(kbuf_cache,kbuf);
+			return -EBUSY;  // 设备忙，返回错误
+		}
+
+		flag=0;  // 设置设备为占用状态
+		lock_stat_released(&spinlock_stat,t1);
+		spin_unlock(&spinlock_test);  // 释放自旋锁
+	}
+	file->private_data=kbuf;
 	return 0;
 }
 
@@ -43,21 +262,24 @@ static int open_test(struct inode *inode,struct file *file)
 static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *off)
 {
 	int ret;
-	char kbuf[10]="topeet";  // 内核空间缓冲区
-	printk("\nthis is read_test\n");
-	ret=copy_to_user(ubuf,kbuf,strlen(kbuf));  // 将数据从内核空间复制到用户空间
+	char kbuf[KBUF_SIZE]="topeet";  // 内核空间缓冲区
+	bool pub=pub_enabled();
+	if(!pub)
+		printk("\nthis is read_test\n");
+	// 默认返回固定的字符串，读路径测试模式下返回最近一次写入的数据
+	len=pub ? pub_read(kbuf,len) : strlen(kbuf);
+	ret=copy_to_user(ubuf,kbuf,len);  // 将数据从内核空间复制到用户空间
 	if(ret!=0)
 	{
 		printk("copy_to_user error\n");
 		return -1;
 	}
 
-	printk("copy to user is ok\n");
+	if(!pub)
+		printk("copy to user is ok\n");
 	return 0;
 }
 
-static char kbuf[10]={0};  // 内核空间写缓冲区
-
 /**
  * @brief 设备写入函数
  * @param file 设备文件结构
@@ -68,7 +290,10 @@ static char kbuf[10]={0};  // 内核空间写缓冲区
  */
 static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,loff_t *off)
 {
+	char *kbuf=file->private_data;  // 当前文件私有的写缓冲区
 	int ret;
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
 	ret=copy_from_user(kbuf,ubuf,len);  // 将数据从用户空间复制到内核空间
 
 	if(ret!=0)
@@ -76,6 +301,9 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
 		printk("copy_from_user is error\n");
 		return -1;
 	}
+	kbuf[len]='\0';
+	if(pub_enabled())
+		pub_update(kbuf,len);  // 发布给读者
 
 	// 根据写入的字符串执行不同的延时操作
 	if(strcmp(kbuf,"topeet")==0)
@@ -99,9 +327,19 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
-	spin_lock(&spinlock_test);  // 获取自旋锁
-	flag =1;  // 释放设备，设置为可用状态
-	spin_unlock(&spinlock_test);  // 释放自旋锁
+	u64 t0,t1;
+
+	if(!multi_open && seq_mode){
+		state_release();
+	}else if(!multi_open){
+		t0=lock_stat_wait_begin(&spinlock_stat);
+		spin_lock(&spinlock_test);  // 获取自旋锁
+		t1=lock_stat_acquired(&spinlock_stat,t0);
+		flag =1;  // 释放设备，设置为可用状态
+		lock_stat_released(&spinlock_stat,t1);
+		spin_unlock(&spinlock_test);  // 释放自旋锁
+	}
+	kmem_cache_free(kbuf_cache,file->private_data);  // 释放当前文件的私有写缓冲区
 	return 0;
 }
 
@@ -133,6 +371,35 @@ struct file_operations fops_test={
  */
 static int __init atomic_init(void)
 {
+	struct pub_buf *first;
+
+	// 两种读路径只能选一种，同时指定时拒绝加载，避免测出来的结果和参数对不上
+	if(seq_mode && rcu_mode){
+		printk("seq_mode and rcu_mode cannot be used together\n");
+		return -EINVAL;
+	}
+
+	kbuf_cache=kmem_cache_create(KBUILD_MODNAME "_kbuf",KBUF_SIZE,0,SLAB_HWCACHE_ALIGN,NULL);
+	if(kbuf_cache==NULL)
+		return -ENOMEM;
+
+	// 创建锁统计的 debugfs 文件：/sys/kernel/debug/spinlock_test/
+	if(lock_stat_init(&spinlock_stat,"spinlock_test")<0){
+		kmem_cache_destroy(kbuf_cache);
+		return -ENOMEM;
+	}
+
+	// 初始化发布给读者的数据
+	first=kmalloc(sizeof(*first),GFP_KERNEL);
+	if(first==NULL){
+		lock_stat_exit(&spinlock_stat);
+		kmem_cache_destroy(kbuf_cache);
+		return -ENOMEM;
+	}
+	strcpy(first->data,"topeet");
+	first->len=strlen(first->data);
+	RCU_INIT_POINTER(pub,first);
+
 	// 初始化自旋锁
 	spin_lock_init(&spinlock_test);
 	
@@ -172,6 +439,9 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	lock_stat_exit(&spinlock_stat);
+	kfree(rcu_dereference_protected(pub,1));
+	kmem_cache_destroy(kbuf_cache);
 	printk("module exit\n");
 }
 
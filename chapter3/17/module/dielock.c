@@ -6,9 +6,11 @@
 #include<linux/uaccess.h>
 #include<linux/delay.h>
 #include<linux/spinlock.h>
+#include "lock_track.h"
 
 // 定义自旋锁，用于设备互斥访问控制
 static spinlock_t spinlock_test;
+static struct lock_track spinlock_track;  // 跟踪自旋锁的持有者，死锁时可以在 debugfs 中查看
 
 /**
  * @brief 设备打开函数
@@ -19,7 +21,10 @@ static spinlock_t spinlock_test;
 static int open_test(struct inode *inode,struct file *file)
 {
 	// 获取自旋锁，这里没有释放锁，会导致死锁
+	// 第二次打开时会一直自旋，可以在其他CPU上查看 /sys/kernel/debug/dielock_test/locks
+	lock_track_wait(&spinlock_track);
 	spin_lock(&spinlock_test);
+	lock_track_acquired(&spinlock_track);
 	return 0;
 }
 
@@ -89,6 +94,7 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
+	lock_track_released(&spinlock_track);
 	spin_unlock(&spinlock_test);  // 释放自旋锁
 	return 0;
 }
@@ -123,6 +129,10 @@ static int __init atomic_init(void)
 {
 	// 初始化自旋锁
 	spin_lock_init(&spinlock_test);
+
+	// 创建锁跟踪的 debugfs 文件：/sys/kernel/debug/dielock_test/
+	lock_track_init("dielock_test");
+	lock_track_register(&spinlock_track,"spinlock_test");
 	
 	// 动态分配设备号
 	if(alloc_chrdev_region(&dev1.dev_num,0,1,"chrdev_name")<0){
@@ -160,6 +170,7 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	lock_track_exit();
 	printk("module exit\n");
 }
 
@@ -0,0 +1,89 @@
+/*
+ * 这是一个测试程序，用于测试驱动的异步写模式
+ * 一次提交多个写请求，然后用 poll 等待、read 取回完成记录
+ * 使用方法：
+ *   insmod semaphore.ko async_mode=1
+ *   ./async /dev/device_test 100 itop   提交100个请求，大约2秒后全部完成
+ * 同步模式下同样的100次写入需要200秒
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<string.h>
+#include<unistd.h>
+#include<poll.h>
+#include<time.h>
+
+/* 完成记录，需要与内核模块中的定义保持一致 */
+struct async_done{
+	uint32_t seq;
+	int32_t status;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(int argc,char *argv[])
+{
+	struct async_done done[64];
+	struct pollfd pfd;
+	double t_start,t_submit;
+	int fd;
+	int count;     // 提交的请求数
+	int finished=0;
+	int ret;
+	int i;
+
+	if(argc<4){
+		printf("usage: %s <dev> <count> <topeet|itop|data>\n",argv[0]);
+		return -1;
+	}
+	count=atoi(argv[2]);
+
+	fd=open(argv[1],O_RDWR);
+	if(fd<0){
+		perror("file open error");
+		return -1;
+	}
+
+	// 提交请求，每次 write 立即返回，请求序号从1开始依次递增
+	t_start=now_sec();
+	for(i=0;i<count;i++){
+		if(write(fd,argv[3],strlen(argv[3])+1)<0){
+			perror("write error");
+			count=i;
+			break;
+		}
+	}
+	t_submit=now_sec();
+	printf("submitted %d requests in %.6f s\n",count,t_submit-t_start);
+
+	// 等待完成记录
+	pfd.fd=fd;
+	pfd.events=POLLIN;
+	while(finished<count){
+		if(poll(&pfd,1,-1)<0){
+			perror("poll error");
+			break;
+		}
+		ret=read(fd,done,sizeof(done));
+		if(ret<=0)
+			break;
+		for(i=0;i<ret/(int)sizeof(done[0]);i++){
+			printf("seq %u done, status %d, %.3f s\n",done[i].seq,done[i].status,now_sec()-t_start);
+			finished++;
+		}
+	}
+	printf("%d of %d requests completed in %.3f s\n",finished,count,now_sec()-t_start);
+
+	close(fd);
+	return 0;
+}
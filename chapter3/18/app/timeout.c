@@ -0,0 +1,64 @@
+/*
+ * 这是一个测试程序，用于测试驱动的非阻塞获取和限时获取
+ * 使用方法：
+ *   ./timeout /dev/device_test nonblock topeet  以O_NONBLOCK打开，设备忙时立即返回EAGAIN
+ *   ./timeout /dev/device_test 1000 topeet      通过DEV_LOCK最多等待1000ms获取设备
+ * 限时获取需要以 multi_open=1 加载驱动，这时 open 不获取设备，由 DEV_LOCK 获取
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<sys/ioctl.h>
+
+/* 定义ioctl命令，需要与内核模块中的定义保持一致 */
+#define DEV_LOCK _IO('S',0)
+#define DEV_UNLOCK _IO('S',1)
+
+int main(int argc,char *argv[])
+{
+	int fd;       // 文件描述符
+	int timeout;  // 超时时间(ms)
+
+	if(argc<4){
+		printf("usage: %s <dev> nonblock|<timeout_ms> <topeet|itop>\n",argv[0]);
+		return -1;
+	}
+
+	if(strcmp(argv[2],"nonblock")==0){
+		// 非阻塞打开，设备忙时返回EAGAIN
+		fd=open(argv[1],O_RDWR|O_NONBLOCK);
+		if(fd<0){
+			perror("file open error");
+			return -1;
+		}
+	}else{
+		timeout=atoi(argv[2]);
+		fd=open(argv[1],O_RDWR);
+		if(fd<0){
+			perror("file open error");
+			return -1;
+		}
+		// 限时获取设备
+		if(ioctl(fd,DEV_LOCK,timeout)<0){
+			if(errno==ETIMEDOUT)
+				printf("lock timeout after %d ms\n",timeout);
+			else
+				perror("ioctl DEV_LOCK error");
+			close(fd);
+			return -1;
+		}
+	}
+
+	write(fd,argv[3],strlen(argv[3])+1);
+
+	if(strcmp(argv[2],"nonblock")!=0)
+		ioctl(fd,DEV_UNLOCK);  // 提前释放设备
+	close(fd);
+	return 0;
+}
@@ -5,21 +5,430 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/delay.h>
+#include<linux/slab.h>
+#include<linux/moduleparam.h>
 #include<linux/semaphore.h>
+#include<linux/mutex.h>
+#include<linux/jiffies.h>
+#include<linux/workqueue.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include "lock_stat.h"
+
+#define KBUF_SIZE 10  // 写缓冲区和异步请求数据的大小
+
+// 多路打开模式：为true时不再独占设备，多个写者可以并行，每个文件使用自己的缓冲区
+static bool multi_open;
+module_param(multi_open,bool,0444);
+MODULE_PARM_DESC(multi_open,"allow concurrent opens, each file writes into its own buffer");
+
+// 异步写模式：write 把请求放到工作队列后立即返回，延时操作在工作队列中完成，
+// 完成状态通过 read/poll 或 ioctl DEV_ASYNC_DONE 取回
+static bool async_mode;
+module_param(async_mode,bool,0444);
+MODULE_PARM_DESC(async_mode,"queue writes to a workqueue and report completions through read/poll/ioctl");
+
+// 每个文件最多的异步请求数，包括还在执行的和已经完成但还没有被取走的，满了 write 返回-EAGAIN
+static unsigned int max_reqs=256;
+module_param(max_reqs,uint,0644);
+MODULE_PARM_DESC(max_reqs,"max async requests per file, in flight plus uncollected completions; write returns -EAGAIN when full");
+
+// 异步写请求的完成记录，read 一次可以返回多条
+struct async_done{
+	__u32 seq;     // 请求序号，每个文件从1开始按 write 的顺序递增
+	__s32 status;  // 完成状态，成功时为写入的字节数
+};
+
+/* 定义ioctl命令 */
+#define DEV_LOCK _IO('S',0)       // 获取设备，参数直接放在 arg 中，为超时时间(ms)：小于0一直等待，0只尝试一次
+#define DEV_UNLOCK _IO('S',1)     // 提前释放设备，不需要关闭文件
+#define DEV_ASYNC_DONE _IOR('S',2,struct async_done)  // 取回一条完成记录，没有时返回-EAGAIN
+
+// 每个打开文件的私有数据
+struct file_priv{
+	char kbuf[KBUF_SIZE];  // 私有写缓冲区
+	struct mutex held_lock;  // 保护 held，同一个文件可能被多个线程共用
+	int held;              // 当前文件是否持有信号量
+	u64 hold_start;        // 拿到信号量的时间，用于统计持有时间
+
+	// 异步写模式使用
+	spinlock_t req_lock;          // 保护下面的成员
+	u32 next_seq;                 // 下一个请求的序号
+	int inflight;                 // 还没有完成的请求数
+	unsigned int queued;          // 还没有释放的请求数（执行中的加上没有取走的完成记录），不超过 max_reqs
+	struct list_head done_list;   // 已完成、还没有被取走的请求
+	wait_queue_head_t done_wq;    // 有请求完成时唤醒
+};
+
+// 一个异步写请求
+struct async_req{
+	struct work_struct work;
+	struct list_head node;    // 完成后挂到 done_list 上
+	struct file_priv *priv;   // 发起请求的文件
+	u32 seq;
+	int status;
+	size_t len;
+	char data[KBUF_SIZE];
+};
+
+static struct kmem_cache *priv_cache;  // 文件私有数据的专用缓存
+static struct kmem_cache *req_cache;   // 异步写请求的专用缓存
+static struct workqueue_struct *async_wq;  // 执行异步写请求的工作队列
+static atomic_t async_inflight;            // 所有文件还没有完成的请求数，通过 debugfs 查看
+
+// 各种获取方式命中的次数，通过 debugfs 查看
+static atomic_t cnt_block;       // 阻塞获取成功
+static atomic_t cnt_trylock;     // 非阻塞获取成功
+static atomic_t cnt_again;       // 非阻塞获取失败，返回-EAGAIN
+static atomic_t cnt_timed;       // 限时获取成功
+static atomic_t cnt_timedout;    // 限时获取超时，返回-ETIMEDOUT
+static atomic_t cnt_killed;      // 等待时被致命信号打断，返回-EINTR
 
 // 定义信号量，用于设备互斥访问控制
+// 信号量的初始值就是准入名额数，等待者按先来后到的顺序排队，释放时直接交给队首的等待者
 struct semaphore semaphore_test;
+static struct lock_stat semaphore_stat;  // 信号量的等锁/持锁时间统计
+
+// 准入控制的实时统计，通过 debugfs 的 admission 文件查看
+static atomic_t adm_holders;     // 当前持有名额的文件数
+static atomic_t adm_waiting;     // 当前排队等待的进程数
+static atomic64_t adm_admitted;  // 累计准入次数
+static atomic64_t adm_wait_ns;   // 累计等待时间，用于计算平均等待时间
+
+static int slots=1;               // 准入名额数，默认为1，即互斥访问
+static bool sem_ready;            // 信号量是否已经初始化
+static DEFINE_MUTEX(slots_lock);  // 串行化对名额数的修改
+static atomic_t slots_retire;     // 减少名额时还被持有的名额数，持有者释放时收回，不再 up
+
+/**
+ * @brief 修改准入名额数，可以在加载时指定，也可以运行时写 /sys/module/semaphore/parameters/slots
+ * @param val 新的名额数
+ * @param kp 模块参数
+ * @return 成功返回0，失败返回错误码
+ */
+static int slots_set(const char *val,const struct kernel_param *kp)
+{
+	int n,ret;
+
+	ret=kstrtoint(val,0,&n);
+	if(ret<0)
+		return ret;
+	if(n<1)
+		return -EINVAL;
+
+	mutex_lock(&slots_lock);
+	if(!sem_ready){
+		// 模块加载时信号量还没有初始化，只记录名额数
+		slots=n;
+	}else{
+		// 增加名额：先取消还没有收回的名额，不够再 up，等待的进程会马上被放行
+		while(slots<n){
+			if(!atomic_add_unless(&slots_retire,-1,0))
+				up(&semaphore_test);
+			slots++;
+		}
+		// 减少名额：空闲的名额直接拿走，被持有的名额记在 slots_retire 上，
+		// 由持有者在 dev_unlock 时收回，写参数的进程不会阻塞
+		while(slots>n){
+			if(down_trylock(&semaphore_test))
+				atomic_inc(&slots_retire);
+			slots--;
+		}
+	}
+	mutex_unlock(&slots_lock);
+	return ret;
+}
+
+static const struct kernel_param_ops slots_ops={
+	.set=slots_set,
+	.get=param_get_int,
+};
+module_param_cb(slots,&slots_ops,&slots,0644);
+MODULE_PARM_DESC(slots,"number of files allowed to hold the device at the same time");
+
+/**
+ * @brief admission 文件：显示准入控制的实时统计
+ */
+static int admission_show(struct seq_file *m,void *v)
+{
+	u64 admitted=atomic64_read(&adm_admitted);
+
+	seq_printf(m,"slots:       %d\n",READ_ONCE(slots));
+	seq_printf(m,"retiring:    %d\n",atomic_read(&slots_retire));
+	seq_printf(m,"holders:     %d\n",atomic_read(&adm_holders));
+	seq_printf(m,"waiting:     %d\n",atomic_read(&adm_waiting));
+	seq_printf(m,"admitted:    %llu\n",admitted);
+	seq_printf(m,"avg_wait_ns: %llu\n",admitted ? div64_u64(atomic64_read(&adm_wait_ns),admitted) : 0);
+	return 0;
+}
+
+static int admission_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,admission_show,NULL);
+}
+
+static const struct file_operations admission_fops={
+	.owner=THIS_MODULE,
+	.open=admission_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+/**
+ * @brief 获取信号量（申请一个准入名额）
+ * @param priv 文件私有数据
+ * @param timeout_ms 超时时间(ms)：小于0一直等待（可以被致命信号打断），0只尝试一次
+ * @return 成功返回0，失败返回-EAGAIN、-ETIMEDOUT或-EINTR
+ */
+static int dev_lock(struct file_priv *priv,int timeout_ms)
+{
+	u64 t0,start;
+	int ret=0;
+
+	t0=lock_stat_wait_begin(&semaphore_stat);
+	start=ktime_get_ns();
+	if(timeout_ms==0){
+		if(down_trylock(&semaphore_test)){
+			atomic_inc(&cnt_again);
+			ret=-EAGAIN;
+		}else{
+			atomic_inc(&cnt_trylock);
+		}
+	}else if(!down_trylock(&semaphore_test)){
+		// 有空闲名额，不需要排队
+		atomic_inc(timeout_ms<0 ? &cnt_block : &cnt_timed);
+	}else{
+		atomic_inc(&adm_waiting);  // 进入等待队列，只统计真正阻塞的进程
+		if(timeout_ms<0){
+			if(down_killable(&semaphore_test)){
+				atomic_inc(&cnt_killed);
+				ret=-EINTR;
+			}else{
+				atomic_inc(&cnt_block);
+			}
+		}else{
+			if(down_timeout(&semaphore_test,msecs_to_jiffies(timeout_ms))){
+				atomic_inc(&cnt_timedout);
+				ret=-ETIMEDOUT;
+			}else{
+				atomic_inc(&cnt_timed);
+			}
+		}
+		atomic_dec(&adm_waiting);  // 离开等待队列
+	}
+	if(ret<0)
+		return ret;
+
+	atomic_inc(&adm_holders);
+	atomic64_inc(&adm_admitted);
+	atomic64_add(ktime_get_ns()-start,&adm_wait_ns);
+	priv->hold_start=lock_stat_acquired(&semaphore_stat,t0);
+	priv->held=1;
+	return 0;
+}
+
+/**
+ * @brief 释放信号量
+ * @param priv 文件私有数据
+ */
+static void dev_unlock(struct file_priv *priv)
+{
+	lock_stat_released(&semaphore_stat,priv->hold_start);
+	priv->held=0;
+	atomic_dec(&adm_holders);
+	// 名额数减少过时，这个名额直接收回，不再放出去
+	if(atomic_add_unless(&slots_retire,-1,0))
+		return;
+	up(&semaphore_test);  // 释放信号量，等待队列中最早的进程会直接拿到名额
+}
+
+/**
+ * @brief 异步写请求的工作函数，完成原来 write_test 中的延时操作
+ * @param work 请求中的 work_struct
+ */
+static void async_work(struct work_struct *work)
+{
+	struct async_req *req=container_of(work,struct async_req,work);
+	struct file_priv *priv=req->priv;
+
+	// 根据写入的字符串执行不同的延时操作，只阻塞工作线程，不阻塞调用者
+	if(strcmp(req->data,"topeet")==0)
+		msleep(4000);  // 延时4秒
+	else if(strcmp(req->data,"itop")==0)
+		msleep(2000);  // 延时2秒
+	req->status=req->len;
+	pr_debug("async write %u done: %s\n",req->seq,req->data);
+
+	// 在锁内唤醒，release_test 看到 inflight 为0之后才会释放 priv
+	// release_test 在 wait_event 中不可中断地等待，所以用 wake_up 而不是 wake_up_interruptible
+	spin_lock(&priv->req_lock);
+	list_add_tail(&req->node,&priv->done_list);
+	priv->inflight--;
+	wake_up(&priv->done_wq);
+	spin_unlock(&priv->req_lock);
+	atomic_dec(&async_inflight);
+}
+
+/**
+ * @brief 取出一个已完成的请求
+ * @param priv 文件私有数据
+ * @return 已完成的请求，没有时返回NULL
+ */
+static struct async_req *async_pop(struct file_priv *priv)
+{
+	struct async_req *req;
+
+	spin_lock(&priv->req_lock);
+	req=list_first_entry_or_null(&priv->done_list,struct async_req,node);
+	if(req){
+		list_del(&req->node);
+		priv->queued--;  // 调用者马上释放这个请求
+	}
+	spin_unlock(&priv->req_lock);
+	return req;
+}
+
+/* 有完成记录可读，或者没有请求在执行（read 返回0）时 read 不再等待 */
+static bool async_readable(struct file_priv *priv)
+{
+	bool ret;
+
+	spin_lock(&priv->req_lock);
+	ret=!list_empty(&priv->done_list) || priv->inflight==0;
+	spin_unlock(&priv->req_lock);
+	return ret;
+}
+
+/* 当前文件没有请求在执行，release 时等待这个条件 */
+static bool async_idle(struct file_priv *priv)
+{
+	bool ret;
+
+	spin_lock(&priv->req_lock);
+	ret=priv->inflight==0;
+	spin_unlock(&priv->req_lock);
+	return ret;
+}
+
+/* 归还 async_write 占用的名额 */
+static void async_unreserve(struct file_priv *priv)
+{
+	spin_lock(&priv->req_lock);
+	priv->queued--;
+	spin_unlock(&priv->req_lock);
+}
+
+/**
+ * @brief 异步模式的 write：复制数据，分配序号，放入工作队列后立即返回
+ * @return 成功返回写入的字节数，失败返回错误码
+ */
+static ssize_t async_write(struct file_priv *priv,const char __user *ubuf,size_t len)
+{
+	struct async_req *req;
+
+	// 先占一个名额，请求队列满时不再分配
+	spin_lock(&priv->req_lock);
+	if(priv->queued>=READ_ONCE(max_reqs)){
+		spin_unlock(&priv->req_lock);
+		return -EAGAIN;
+	}
+	priv->queued++;
+	spin_unlock(&priv->req_lock);
+
+	req=kmem_cache_alloc(req_cache,GFP_KERNEL);
+	if(req==NULL){
+		async_unreserve(priv);
+		return -ENOMEM;
+	}
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
+	if(copy_from_user(req->data,ubuf,len)){
+		kmem_cache_free(req_cache,req);
+		async_unreserve(priv);
+		return -EFAULT;
+	}
+	req->data[len]='\0';
+	req->len=len;
+	req->priv=priv;
+	INIT_WORK(&req->work,async_work);
+
+	spin_lock(&priv->req_lock);
+	req->seq=++priv->next_seq;
+	priv->inflight++;
+	spin_unlock(&priv->req_lock);
+	atomic_inc(&async_inflight);
+
+	queue_work(async_wq,&req->work);
+	return len;
+}
+
+/**
+ * @brief 异步模式的 read：返回尽可能多的完成记录（struct async_done）
+ * @return 返回复制的字节数，没有请求在执行时返回0
+ */
+static ssize_t async_read(struct file *file,char __user *ubuf,size_t len)
+{
+	struct file_priv *priv=file->private_data;
+	struct async_req *req;
+	struct async_done done;
+	size_t copied=0;
+
+	if(len<sizeof(done))
+		return -EINVAL;
+
+	if(file->f_flags & O_NONBLOCK){
+		if(!async_readable(priv))
+			return -EAGAIN;
+	}else if(wait_event_interruptible(priv->done_wq,async_readable(priv))){
+		return -ERESTARTSYS;
+	}
+
+	while(copied+sizeof(done)<=len){
+		req=async_pop(priv);
+		if(req==NULL)
+			break;
+		done.seq=req->seq;
+		done.status=req->status;
+		kmem_cache_free(req_cache,req);
+		if(copy_to_user(ubuf+copied,&done,sizeof(done)))
+			return copied ? copied : -EFAULT;
+		copied+=sizeof(done);
+	}
+	return copied;
+}
 
 /**
  * @brief 设备打开函数
  * @param inode 设备文件的inode结构
  * @param file 设备文件结构
- * @return 成功返回0
+ * @return 成功返回0，设备忙返回-EAGAIN，等待时被打断返回-EINTR
  */
 static int open_test(struct inode *inode,struct file *file)
 {
+	struct file_priv *priv;
+	int ret;
+
+	// 为当前文件分配私有数据
+	priv=kmem_cache_zalloc(priv_cache,GFP_KERNEL);
+	if(priv==NULL)
+		return -ENOMEM;
+
+	mutex_init(&priv->held_lock);
+	spin_lock_init(&priv->req_lock);
+	INIT_LIST_HEAD(&priv->done_list);
+	init_waitqueue_head(&priv->done_wq);
+
 	printk("\nThis is open_test\n");
-	down(&semaphore_test);  // 获取信号量，如果信号量为0则进程会睡眠
+	if(!multi_open){
+		// 以 O_NONBLOCK 打开时只尝试一次，设备忙返回-EAGAIN；否则一直等待
+		ret=dev_lock(priv,(file->f_flags & O_NONBLOCK) ? 0 : -1);
+		if(ret<0){
+			kmem_cache_free(priv_cache,priv);
+			return ret;
+		}
+	}
+	file->private_data=priv;
 	return 0;
 }
 
@@ -35,6 +444,10 @@ static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *
 {
 	int ret;
 	char kbuf[10]="topeet";  // 内核空间缓冲区
+
+	if(async_mode)
+		return async_read(file,ubuf,len);  // 异步模式下读取完成记录
+
 	printk("\nthis is read_test\n");
 	ret=copy_to_user(ubuf,kbuf,strlen(kbuf));  // 将数据从内核空间复制到用户空间
 	if(ret!=0)
@@ -47,25 +460,32 @@ static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *
 	return 0;
 }
 
-static char kbuf[10]={0};  // 内核空间写缓冲区
-
 /**
  * @brief 设备写入函数
  * @param file 设备文件结构
  * @param ubuf 用户空间缓冲区
  * @param len 要写入的长度
  * @param off 文件偏移量
- * @return 成功返回0，失败返回-1
+ * @return 成功返回0，失败返回-1；异步模式下返回写入的字节数
  */
 static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,loff_t *off)
 {
+	struct file_priv *priv=file->private_data;
+	char *kbuf=priv->kbuf;  // 当前文件私有的写缓冲区
 	int ret;
+
+	if(async_mode)
+		return async_write(priv,ubuf,len);
+
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
 	ret=copy_from_user(kbuf,ubuf,len);  // 将数据从用户空间复制到内核空间
 
 	if(ret!=0)
 	{
 		printk("copy_from_user is error\n");
 	}
+	kbuf[len]='\0';
 
 	// 根据写入的字符串执行不同的延时操作
 	if(strcmp(kbuf,"topeet")==0)
@@ -89,11 +509,97 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
-	up(&semaphore_test);  // 释放信号量
+	struct file_priv *priv=file->private_data;
+	struct async_req *req;
+
+	// 等待还在执行的异步请求完成，丢弃没有取走的完成记录
+	wait_event(priv->done_wq,async_idle(priv));
+	while((req=async_pop(priv))!=NULL)
+		kmem_cache_free(req_cache,req);
+
+	if(priv->held)
+		dev_unlock(priv);
+	kmem_cache_free(priv_cache,priv);  // 释放当前文件的私有数据
 	printk("\nThis is release_test \n");
 	return 0;
 }
 
+/**
+ * @brief 设备轮询函数，异步模式下有完成记录时可读
+ * @param file 设备文件结构
+ * @param wait 轮询表
+ * @return 设备状态掩码
+ */
+static __poll_t poll_test(struct file *file,struct poll_table_struct *wait)
+{
+	struct file_priv *priv=file->private_data;
+	__poll_t mask=0;
+
+	if(!async_mode)
+		return EPOLLOUT|EPOLLWRNORM|EPOLLIN|EPOLLRDNORM;
+
+	poll_wait(file,&priv->done_wq,wait);
+	spin_lock(&priv->req_lock);
+	if(!list_empty(&priv->done_list))
+		mask|=EPOLLIN|EPOLLRDNORM;
+	if(priv->queued<READ_ONCE(max_reqs))
+		mask|=EPOLLOUT|EPOLLWRNORM;  // 请求队列没满时可写
+	spin_unlock(&priv->req_lock);
+	return mask;
+}
+
+/**
+ * @brief ioctl命令处理函数
+ * @param file 设备文件结构
+ * @param cmd ioctl命令
+ * @param arg 命令参数，DEV_LOCK 的参数为超时时间(ms)，DEV_ASYNC_DONE 的参数为完成记录的地址
+ * @return 成功返回0，失败返回错误码
+ */
+static long ioctl_test(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	struct file_priv *priv=file->private_data;
+	struct async_req *req;
+	struct async_done done;
+	int ret;
+
+	switch(cmd){
+		case DEV_LOCK:
+			// 检查和设置 held 都在 held_lock 下完成，否则共用一个文件的两个线程都能拿到名额，关闭时只还一个
+			// 等待名额期间同一个文件上的 DEV_LOCK/DEV_UNLOCK 也会等待
+			if(mutex_lock_killable(&priv->held_lock))
+				return -EINTR;
+			if(priv->held)
+				ret=-EBUSY;  // 当前文件已经持有设备
+			else
+				ret=dev_lock(priv,(int)arg);
+			mutex_unlock(&priv->held_lock);
+			return ret;
+		case DEV_UNLOCK:
+			if(mutex_lock_killable(&priv->held_lock))
+				return -EINTR;
+			if(!priv->held){
+				ret=-EPERM;  // 当前文件没有持有设备
+			}else{
+				dev_unlock(priv);
+				ret=0;
+			}
+			mutex_unlock(&priv->held_lock);
+			return ret;
+		case DEV_ASYNC_DONE:
+			req=async_pop(priv);
+			if(req==NULL)
+				return -EAGAIN;  // 没有已完成的请求
+			done.seq=req->seq;
+			done.status=req->status;
+			kmem_cache_free(req_cache,req);
+			if(copy_to_user((void __user *)arg,&done,sizeof(done)))
+				return -EFAULT;
+			return 0;
+		default:
+			return -ENOTTY;
+	}
+}
+
 /**
  * @brief 字符设备结构体
  */
@@ -114,6 +620,8 @@ struct file_operations fops_test={
 	.read=read_test,
 	.write=write_test,
 	.release=release_test,
+	.poll=poll_test,
+	.unlocked_ioctl=ioctl_test,
 };
 
 /**
@@ -122,8 +630,47 @@ struct file_operations fops_test={
  */
 static int __init atomic_init(void)
 {
-	// 初始化信号量，初始值为1
-	sema_init(&semaphore_test,1);
+	// 文件私有数据里有 req_lock 和等待队列，不同文件之间同样按缓存行隔开
+	priv_cache=kmem_cache_create(KBUILD_MODNAME "_priv",sizeof(struct file_priv),0,SLAB_HWCACHE_ALIGN,NULL);
+	if(priv_cache==NULL)
+		return -ENOMEM;
+	req_cache=KMEM_CACHE(async_req,0);
+	if(req_cache==NULL){
+		kmem_cache_destroy(priv_cache);
+		return -ENOMEM;
+	}
+
+	// 异步请求在不绑定CPU的工作队列中执行，可以同时有几百个请求在等待延时
+	async_wq=alloc_workqueue("semaphore_async",WQ_UNBOUND,0);
+	if(async_wq==NULL){
+		kmem_cache_destroy(req_cache);
+		kmem_cache_destroy(priv_cache);
+		return -ENOMEM;
+	}
+
+	// 创建锁统计的 debugfs 文件：/sys/kernel/debug/semaphore_test/
+	if(lock_stat_init(&semaphore_stat,"semaphore_test")<0){
+		destroy_workqueue(async_wq);
+		kmem_cache_destroy(req_cache);
+		kmem_cache_destroy(priv_cache);
+		return -ENOMEM;
+	}
+
+	// 各种获取方式的计数放在同一个 debugfs 目录下
+	debugfs_create_atomic_t("acquire_block",0444,semaphore_stat.dir,&cnt_block);
+	debugfs_create_atomic_t("acquire_trylock",0444,semaphore_stat.dir,&cnt_trylock);
+	debugfs_create_atomic_t("acquire_again",0444,semaphore_stat.dir,&cnt_again);
+	debugfs_create_atomic_t("acquire_timed",0444,semaphore_stat.dir,&cnt_timed);
+	debugfs_create_atomic_t("acquire_timedout",0444,semaphore_stat.dir,&cnt_timedout);
+	debugfs_create_atomic_t("acquire_killed",0444,semaphore_stat.dir,&cnt_killed);
+	debugfs_create_file("admission",0444,semaphore_stat.dir,NULL,&admission_fops);
+	debugfs_create_atomic_t("async_inflight",0444,semaphore_stat.dir,&async_inflight);
+
+	// 初始化信号量，初始值为准入名额数（默认为1）
+	mutex_lock(&slots_lock);
+	sema_init(&semaphore_test,slots);
+	sem_ready=true;
+	mutex_unlock(&slots_lock);
 	
 	// 动态分配设备号
 	if(alloc_chrdev_region(&dev1.dev_num,0,1,"chrdev_name")<0){
@@ -161,6 +708,10 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	lock_stat_exit(&semaphore_stat);
+	destroy_workqueue(async_wq);
+	kmem_cache_destroy(req_cache);
+	kmem_cache_destroy(priv_cache);
 	printk("module exit\n");
 }
 
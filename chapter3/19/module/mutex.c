@@ -5,22 +5,221 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/delay.h>
+#include<linux/slab.h>
+#include<linux/moduleparam.h>
 #include<linux/errno.h>
+#include<linux/rcupdate.h>
 #include<linux/mutex.h>
+#include<linux/wait.h>
+#include<linux/jiffies.h>
+#include "lock_stat.h"
+
+#define KBUF_SIZE 10  // 写缓冲区和发布给读者的数据的大小
+
+// 多路打开模式：为true时不再独占设备，多个写者可以并行，每个文件使用自己的缓冲区
+static bool multi_open;
+module_param(multi_open,bool,0444);
+MODULE_PARM_DESC(multi_open,"allow concurrent opens, each file writes into its own buffer");
+
+/* 定义ioctl命令 */
+#define DEV_LOCK _IO('M',0)       // 获取设备，参数直接放在 arg 中，为超时时间(ms)：小于0一直等待，0只尝试一次
+#define DEV_UNLOCK _IO('M',1)     // 提前释放设备，不需要关闭文件
+
+// 每个打开文件的私有数据
+struct file_priv{
+	char kbuf[KBUF_SIZE];  // 私有写缓冲区
+	struct mutex held_lock;  // 保护 held，多个线程可能共用同一个文件
+	int held;              // 当前文件是否持有互斥锁
+	u64 hold_start;        // 拿到互斥锁的时间，用于统计持有时间
+};
+
+static struct kmem_cache *priv_cache;  // 文件私有数据的专用缓存
+
+// 各种获取方式命中的次数，通过 debugfs 查看
+static atomic_t cnt_block;       // 阻塞获取成功
+static atomic_t cnt_trylock;     // 非阻塞获取成功
+static atomic_t cnt_again;       // 非阻塞获取失败，返回-EAGAIN
+static atomic_t cnt_timed;       // 限时获取成功
+static atomic_t cnt_timedout;    // 限时获取超时，返回-ETIMEDOUT
+static atomic_t cnt_killed;      // 等待时被致命信号打断，返回-EINTR
 
 // 定义互斥锁，用于设备互斥访问控制
 struct mutex mutex_test;
+static struct lock_stat mutex_stat;  // 互斥锁的等锁/持锁时间统计
+static DECLARE_WAIT_QUEUE_HEAD(lock_wq);  // 限时等待互斥锁的进程，互斥锁释放时唤醒
+
+// 发布给读者的数据：最近一次写入的内容，初始为"topeet"
+struct pub_buf{
+	struct rcu_head rcu;   // 用于 kfree_rcu 延迟释放
+	size_t len;            // 数据长度
+	char data[KBUF_SIZE];  // 数据内容
+};
+
+// 加锁读模式：读者在 pub_lock 下读取最近一次写入的数据，作为 RCU 读路径的对照
+static bool locked_read;
+module_param(locked_read,bool,0444);
+MODULE_PARM_DESC(locked_read,"readers copy the published buffer under pub_lock, baseline for rcu_mode");
+
+// RCU读模式：读者不加锁，写者复制出新的数据后替换指针，旧数据在宽限期之后释放
+static bool rcu_mode;
+module_param(rcu_mode,bool,0444);
+MODULE_PARM_DESC(rcu_mode,"lock-free RCU read path for the published buffer");
+
+static struct pub_buf __rcu *pub;  // 当前发布的数据
+static DEFINE_MUTEX(pub_lock);  // 保护发布数据的写者锁，只在拷贝/替换指针时短暂持有
+
+/**
+ * @brief 是否把最近一次写入的数据发布给读者
+ * @return locked_read 或 rcu_mode 打开时返回true，默认的读取只返回固定的"topeet"
+ */
+static bool pub_enabled(void)
+{
+	return locked_read || rcu_mode;
+}
+
+/**
+ * @brief 读取当前发布的数据
+ * @param kbuf 内核空间缓冲区，至少 KBUF_SIZE 字节
+ * @param len 最多读取的长度
+ * @return 实际读取的长度
+ */
+static size_t pub_read(char *kbuf,size_t len)
+{
+	struct pub_buf *p;
+
+	if(rcu_mode){
+		// 读者只进入RCU读临界区，不加锁，也不写任何共享数据
+		rcu_read_lock();
+		p=rcu_dereference(pub);
+		len=min(len,p->len);
+		memcpy(kbuf,p->data,len);
+		rcu_read_unlock();
+	}else{
+		mutex_lock(&pub_lock);
+		p=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+		len=min(len,p->len);
+		memcpy(kbuf,p->data,len);
+		mutex_unlock(&pub_lock);
+	}
+	return len;
+}
+
+/**
+ * @brief 用新写入的内容更新发布的数据
+ * @param kbuf 新的数据
+ * @param len 数据长度，不超过 KBUF_SIZE
+ * @return 成功返回0，失败返回-ENOMEM
+ */
+static int pub_update(const char *kbuf,size_t len)
+{
+	struct pub_buf *newp,*old;
+
+	if(!rcu_mode){
+		// 加锁模式下直接在原地修改，读者和写者互斥
+		mutex_lock(&pub_lock);
+		old=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+		memcpy(old->data,kbuf,len);
+		old->len=len;
+		mutex_unlock(&pub_lock);
+		return 0;
+	}
+
+	// RCU模式：先复制出新的数据，再替换指针，正在读旧数据的读者不受影响
+	newp=kmalloc(sizeof(*newp),GFP_KERNEL);
+	if(newp==NULL)
+		return -ENOMEM;
+	memcpy(newp->data,kbuf,len);
+	newp->len=len;
+
+	mutex_lock(&pub_lock);
+	old=rcu_dereference_protected(pub,lockdep_is_held(&pub_lock));
+	rcu_assign_pointer(pub,newp);
+	mutex_unlock(&pub_lock);
+	kfree_rcu(old,rcu);  // 等所有读者离开之后再释放旧数据
+	return 0;
+}
+
+/**
+ * @brief 获取互斥锁
+ * @param priv 文件私有数据
+ * @param timeout_ms 超时时间(ms)：小于0一直等待（可以被致命信号打断），0只尝试一次
+ * @return 成功返回0，失败返回-EAGAIN、-ETIMEDOUT或-EINTR
+ */
+static int dev_lock(struct file_priv *priv,int timeout_ms)
+{
+	long ret;
+	u64 t0;
+
+	t0=lock_stat_wait_begin(&mutex_stat);
+	if(timeout_ms==0){
+		if(!mutex_trylock(&mutex_test)){
+			atomic_inc(&cnt_again);
+			return -EAGAIN;
+		}
+		atomic_inc(&cnt_trylock);
+	}else if(timeout_ms<0){
+		if(mutex_lock_killable(&mutex_test)){
+			atomic_inc(&cnt_killed);
+			return -EINTR;
+		}
+		atomic_inc(&cnt_block);
+	}else{
+		// 互斥锁没有带超时的获取接口，在等待队列上限时等待，条件是 trylock 成功
+		ret=wait_event_killable_timeout(lock_wq,mutex_trylock(&mutex_test),msecs_to_jiffies(timeout_ms));
+		if(ret==0){
+			atomic_inc(&cnt_timedout);
+			return -ETIMEDOUT;
+		}
+		if(ret<0){
+			atomic_inc(&cnt_killed);
+			return -EINTR;
+		}
+		atomic_inc(&cnt_timed);
+	}
+	priv->hold_start=lock_stat_acquired(&mutex_stat,t0);
+	priv->held=1;
+	return 0;
+}
+
+/**
+ * @brief 释放互斥锁
+ * @param priv 文件私有数据
+ */
+static void dev_unlock(struct file_priv *priv)
+{
+	lock_stat_released(&mutex_stat,priv->hold_start);
+	priv->held=0;
+	mutex_unlock(&mutex_test);  // 释放互斥锁
+	wake_up(&lock_wq);  // 唤醒限时等待的进程
+}
 
 /**
  * @brief 设备打开函数
  * @param inode 设备文件的inode结构
  * @param file 设备文件结构
- * @return 成功返回0
+ * @return 成功返回0，设备忙返回-EAGAIN，等待时被打断返回-EINTR
  */
 static int open_test(struct inode *inode,struct file *file)
 {
+	struct file_priv *priv;
+	int ret;
+
+	// 为当前文件分配私有数据
+	priv=kmem_cache_zalloc(priv_cache,GFP_KERNEL);
+	if(priv==NULL)
+		return -ENOMEM;
+	mutex_init(&priv->held_lock);
+
 	printk("\nThis is open_test\n");
-	mutex_lock(&mutex_test);  // 获取互斥锁
+	if(!multi_open){
+		// 以 O_NONBLOCK 打开时只尝试一次，设备忙返回-EAGAIN；否则一直等待
+		ret=dev_lock(priv,(file->f_flags & O_NONBLOCK) ? 0 : -1);
+		if(ret<0){
+			kmem_cache_free(priv_cache,priv);
+			return ret;
+		}
+	}
+	file->private_data=priv;
 	return 0;
 }
 
@@ -35,21 +234,24 @@ static int open_test(struct inode *inode,struct file *file)
 static ssize_t read_test(struct file *file,char __user *ubuf,size_t len,loff_t *off)
 {
 	int ret;
-	char kbuf[10]="topeet";  // 内核空间缓冲区
-	printk("\nthis is read_test\n");
-	ret=copy_to_user(ubuf,kbuf,strlen(kbuf));  // 将数据从内核空间复制到用户空间
+	char kbuf[KBUF_SIZE]="topeet";  // 内核空间缓冲区
+	bool pub=pub_enabled();
+	if(!pub)
+		printk("\nthis is read_test\n");
+	// 默认返回固定的字符串，读路径测试模式下返回最近一次写入的数据
+	len=pub ? pub_read(kbuf,len) : strlen(kbuf);
+	ret=copy_to_user(ubuf,kbuf,len);  // 将数据从内核空间复制到用户空间
 	if(ret!=0)
 	{
 		printk("copy_to_user error\n");
 		return -1;
 	}
 
-	printk("copy to user is ok\n");
+	if(!pub)
+		printk("copy to user is ok\n");
 	return 0;
 }
 
-static char kbuf[10]={0};  // 内核空间写缓冲区
-
 /**
  * @brief 设备写入函数
  * @param file 设备文件结构
@@ -60,13 +262,20 @@ static char kbuf[10]={0};  // 内核空间写缓冲区
  */
 static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,loff_t *off)
 {
+	struct file_priv *priv=file->private_data;
+	char *kbuf=priv->kbuf;  // 当前文件私有的写缓冲区
 	int ret;
+	if(len>KBUF_SIZE-1)
+		len=KBUF_SIZE-1;  // 防止写越界，留出字符串结束符的位置
 	ret=copy_from_user(kbuf,ubuf,len);  // 将数据从用户空间复制到内核空间
 
 	if(ret!=0)
 	{
 		printk("copy_from_user is error\n");
 	}
+	kbuf[len]='\0';
+	if(pub_enabled())
+		pub_update(kbuf,len);  // 发布给读者
 
 	// 根据写入的字符串执行不同的延时操作
 	if(strcmp(kbuf,"topeet")==0)
@@ -90,11 +299,55 @@ static ssize_t write_test(struct file *file,const char __user *ubuf,size_t len,l
  */
 static int release_test(struct inode *inode,struct file *file)
 {
-	mutex_unlock(&mutex_test);  // 释放互斥锁
+	struct file_priv *priv=file->private_data;
+
+	if(priv->held)
+		dev_unlock(priv);
+	kmem_cache_free(priv_cache,priv);  // 释放当前文件的私有数据
 	printk("\nThis is release_test \n");
 	return 0;
 }
 
+/**
+ * @brief ioctl命令处理函数
+ * @param file 设备文件结构
+ * @param cmd ioctl命令
+ * @param arg 命令参数，DEV_LOCK 的参数为超时时间(ms)
+ * @return 成功返回0，失败返回错误码
+ */
+static long ioctl_test(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	struct file_priv *priv=file->private_data;
+	int ret;
+
+	switch(cmd){
+		case DEV_LOCK:
+			// held 的检查和设置放在 held_lock 里，防止共用文件的两个线程同时通过检查，
+			// 一个线程的 mutex_lock 会在另一个线程已经持有时永远等下去
+			if(mutex_lock_killable(&priv->held_lock))
+				return -EINTR;
+			if(priv->held)
+				ret=-EBUSY;  // 当前文件已经持有设备
+			else
+				ret=dev_lock(priv,(int)arg);
+			mutex_unlock(&priv->held_lock);
+			return ret;
+		case DEV_UNLOCK:
+			if(mutex_lock_killable(&priv->held_lock))
+				return -EINTR;
+			if(!priv->held){
+				ret=-EPERM;  // 当前文件没有持有设备
+			}else{
+				dev_unlock(priv);
+				ret=0;
+			}
+			mutex_unlock(&priv->held_lock);
+			return ret;
+		default:
+			return -ENOTTY;
+	}
+}
+
 /**
  * @brief 字符设备结构体
  */
@@ -115,6 +368,7 @@ struct file_operations fops_test={
 	.read=read_test,
 	.write=write_test,
 	.release=release_test,
+	.unlocked_ioctl=ioctl_test,
 };
 
 /**
@@ -123,6 +377,37 @@ struct file_operations fops_test={
  */
 static int __init atomic_init(void)
 {
+	struct pub_buf *first;
+
+	priv_cache=kmem_cache_create(KBUILD_MODNAME "_priv",sizeof(struct file_priv),0,SLAB_HWCACHE_ALIGN,NULL);
+	if(priv_cache==NULL)
+		return -ENOMEM;
+
+	// 创建锁统计的 debugfs 文件：/sys/kernel/debug/mutex_test/
+	if(lock_stat_init(&mutex_stat,"mutex_test")<0){
+		kmem_cache_destroy(priv_cache);
+		return -ENOMEM;
+	}
+
+	// 各种获取方式的计数放在同一个 debugfs 目录下
+	debugfs_create_atomic_t("acquire_block",0444,mutex_stat.dir,&cnt_block);
+	debugfs_create_atomic_t("acquire_trylock",0444,mutex_stat.dir,&cnt_trylock);
+	debugfs_create_atomic_t("acquire_again",0444,mutex_stat.dir,&cnt_again);
+	debugfs_create_atomic_t("acquire_timed",0444,mutex_stat.dir,&cnt_timed);
+	debugfs_create_atomic_t("acquire_timedout",0444,mutex_stat.dir,&cnt_timedout);
+	debugfs_create_atomic_t("acquire_killed",0444,mutex_stat.dir,&cnt_killed);
+
+	// 初始化发布给读者的数据
+	first=kmalloc(sizeof(*first),GFP_KERNEL);
+	if(first==NULL){
+		lock_stat_exit(&mutex_stat);
+		kmem_cache_destroy(priv_cache);
+		return -ENOMEM;
+	}
+	strcpy(first->data,"topeet");
+	first->len=strlen(first->data);
+	RCU_INIT_POINTER(pub,first);
+
 	// 初始化互斥锁
 	mutex_init(&mutex_test);
 	
@@ -162,6 +447,9 @@ static void __exit atomic_exit(void)
 	class_destroy(dev1.class_test);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	lock_stat_exit(&mutex_stat);
+	kfree(rcu_dereference_protected(pub,1));
+	kmem_cache_destroy(priv_cache);
 	printk("module exit\n");
 }
 
@@ -0,0 +1,337 @@
+/*
+ * 这是一个多线程基准测试程序，用于测量第三章各个互斥原语的竞争开销
+ * 每个线程循环执行 open -> write -> close，统计每一步的延时分布和整体吞吐量
+ * 适用于 15(atomic)、16(spinlock)、18(semaphore)、19(mutex) 目录的驱动
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sched.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<stddef.h>
+#include<time.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+
+/* CPU绑定方式 */
+enum pin_mode{
+	PIN_NONE,    // 不绑定，由调度器决定
+	PIN_SPREAD,  // 线程轮流绑定到各个CPU上
+	PIN_SINGLE,  // 所有线程绑定到同一个CPU上
+};
+
+/* 测试参数 */
+struct bench_conf{
+	const char *dev;      // 设备节点
+	const char *label;    // 结果标签（一般为驱动名）
+	const char *payload;  // 写入的数据，不能是"topeet"/"itop"，否则驱动会延时
+	int threads;          // 线程数
+	int iters;            // 每个线程的循环次数
+	enum pin_mode pin;    // CPU绑定方式
+	int csv;              // 是否以CSV格式输出
+};
+
+/* 每个线程的统计数据 */
+struct thread_ctx{
+	pthread_t tid;
+	int index;                // 线程编号
+	struct bench_conf *conf;
+	uint64_t *open_ns;        // open延时采样（包含-EBUSY重试的时间）
+	uint64_t *write_ns;       // write延时采样
+	uint64_t *close_ns;       // close延时采样
+	uint64_t busy;            // open返回-EBUSY的次数
+	uint64_t errors;          // 其他错误次数
+	int done;                 // 成功完成的循环次数
+};
+
+static pthread_barrier_t start_barrier;  // 让所有线程同时开始
+
+/* 获取单调时钟，单位纳秒 */
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+/* 按照绑定方式把当前线程绑定到CPU上 */
+static void pin_thread(enum pin_mode pin,int index)
+{
+	cpu_set_t set;
+	long ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(pin==PIN_NONE || ncpu<=0)
+		return;
+
+	CPU_ZERO(&set);
+	if(pin==PIN_SPREAD)
+		CPU_SET(index%ncpu,&set);
+	else
+		CPU_SET(0,&set);
+	pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+}
+
+/* 线程函数：循环执行 open/write/close */
+static void *bench_thread(void *arg)
+{
+	struct thread_ctx *ctx=(struct thread_ctx *)arg;
+	struct bench_conf *conf=ctx->conf;
+	size_t len=strlen(conf->payload)+1;  // 连同结束符一起写入，驱动中用strcmp比较
+	uint64_t t0,t1;
+	int fd;
+	int i;
+
+	pin_thread(conf->pin,ctx->index);
+	pthread_barrier_wait(&start_barrier);
+
+	for(i=0;i<conf->iters;i++){
+		// open：atomic/spinlock驱动在设备忙时返回-EBUSY，需要重试
+		t0=now_ns();
+		while((fd=open(conf->dev,O_RDWR))<0){
+			if(errno!=EBUSY){
+				ctx->errors++;
+				break;
+			}
+			ctx->busy++;
+			sched_yield();
+		}
+		t1=now_ns();
+		if(fd<0)
+			continue;
+		ctx->open_ns[ctx->done]=t1-t0;
+
+		// write
+		t0=now_ns();
+		if(write(fd,conf->payload,len)<0)
+			ctx->errors++;
+		t1=now_ns();
+		ctx->write_ns[ctx->done]=t1-t0;
+
+		// close，对应驱动的release_test
+		t0=now_ns();
+		close(fd);
+		t1=now_ns();
+		ctx->close_ns[ctx->done]=t1-t0;
+
+		ctx->done++;
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a,const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	return x<y ? -1 : x>y;
+}
+
+/* 延时分布 */
+struct lat_stat{
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t max;
+};
+
+/* 把所有线程的某一类采样合并后排序，计算百分位 */
+static void calc_stat(struct thread_ctx *ctx,int threads,size_t field,uint64_t *all,struct lat_stat *st)
+{
+	size_t n=0;
+	int i;
+
+	for(i=0;i<threads;i++){
+		uint64_t *samples=*(uint64_t **)((char *)&ctx[i]+field);
+		memcpy(all+n,samples,ctx[i].done*sizeof(uint64_t));
+		n+=ctx[i].done;
+	}
+	memset(st,0,sizeof(*st));
+	if(n==0)
+		return;
+
+	qsort(all,n,sizeof(uint64_t),cmp_u64);
+	st->p50=all[n*50/100];
+	st->p90=all[n*90/100];
+	st->p99=all[n*99/100];
+	st->max=all[n-1];
+}
+
+static const char *pin_name(enum pin_mode pin)
+{
+	switch(pin){
+		case PIN_SPREAD:
+			return "spread";
+		case PIN_SINGLE:
+			return "single";
+		default:
+			return "none";
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-d dev] [-t threads] [-n iters] [-p none|spread|single] [-w payload] [-l label] [-c]\n",prog);
+	printf("  -d  设备节点，默认 /dev/device_test\n");
+	printf("  -t  线程数，默认 4\n");
+	printf("  -n  每个线程的循环次数，默认 1000\n");
+	printf("  -p  CPU绑定方式，默认 none\n");
+	printf("  -w  写入的数据，默认 bench（不要使用 topeet/itop，驱动会延时）\n");
+	printf("  -l  结果标签，默认为设备节点名\n");
+	printf("  -c  以CSV格式输出一行结果，供 run_bench.sh 收集\n");
+}
+
+int main(int argc,char *argv[])
+{
+	struct bench_conf conf={
+		.dev="/dev/device_test",
+		.label=NULL,
+		.payload="bench",
+		.threads=4,
+		.iters=1000,
+		.pin=PIN_NONE,
+		.csv=0,
+	};
+	struct thread_ctx *ctx;
+	struct lat_stat st_open,st_write,st_close;
+	uint64_t *all;
+	uint64_t t_start,t_end,busy=0,errors=0,total=0;
+	double secs;
+	int opt;
+	int i;
+
+	while((opt=getopt(argc,argv,"d:t:n:p:w:l:ch"))!=-1){
+		switch(opt){
+			case 'd':
+				conf.dev=optarg;
+				break;
+			case 't':
+				conf.threads=atoi(optarg);
+				break;
+			case 'n':
+				conf.iters=atoi(optarg);
+				break;
+			case 'p':
+				if(strcmp(optarg,"spread")==0)
+					conf.pin=PIN_SPREAD;
+				else if(strcmp(optarg,"single")==0)
+					conf.pin=PIN_SINGLE;
+				else
+					conf.pin=PIN_NONE;
+				break;
+			case 'w':
+				conf.payload=optarg;
+				break;
+			case 'l':
+				conf.label=optarg;
+				break;
+			case 'c':
+				conf.csv=1;
+				break;
+			default:
+				usage(argv[0]);
+				return -1;
+		}
+	}
+	if(conf.threads<=0 || conf.iters<=0){
+		usage(argv[0]);
+		return -1;
+	}
+	// 驱动的写缓冲区只有10个字节
+	if(strlen(conf.payload)+1>10){
+		printf("payload is too long\n");
+		return -1;
+	}
+	if(conf.label==NULL)
+		conf.label=conf.dev;
+
+	ctx=calloc(conf.threads,sizeof(*ctx));
+	all=malloc((size_t)conf.threads*conf.iters*sizeof(uint64_t));
+	if(ctx==NULL || all==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+	for(i=0;i<conf.threads;i++){
+		ctx[i].index=i;
+		ctx[i].conf=&conf;
+		ctx[i].open_ns=malloc(conf.iters*sizeof(uint64_t));
+		ctx[i].write_ns=malloc(conf.iters*sizeof(uint64_t));
+		ctx[i].close_ns=malloc(conf.iters*sizeof(uint64_t));
+		if(!ctx[i].open_ns || !ctx[i].write_ns || !ctx[i].close_ns){
+			printf("malloc error\n");
+			return -1;
+		}
+	}
+
+	pthread_barrier_init(&start_barrier,NULL,conf.threads+1);
+	for(i=0;i<conf.threads;i++){
+		if(pthread_create(&ctx[i].tid,NULL,bench_thread,&ctx[i])!=0){
+			printf("pthread_create error\n");
+			return -1;
+		}
+	}
+
+	// 所有线程就绪后开始计时
+	pthread_barrier_wait(&start_barrier);
+	t_start=now_ns();
+	for(i=0;i<conf.threads;i++)
+		pthread_join(ctx[i].tid,NULL);
+	t_end=now_ns();
+
+	for(i=0;i<conf.threads;i++){
+		busy+=ctx[i].busy;
+		errors+=ctx[i].errors;
+		total+=ctx[i].done;
+	}
+	secs=(t_end-t_start)/1e9;
+
+	calc_stat(ctx,conf.threads,offsetof(struct thread_ctx,open_ns),all,&st_open);
+	calc_stat(ctx,conf.threads,offsetof(struct thread_ctx,write_ns),all,&st_write);
+	calc_stat(ctx,conf.threads,offsetof(struct thread_ctx,close_ns),all,&st_close);
+
+	if(conf.csv){
+		// label,threads,pin,cycles,ops_per_sec,busy,errors,open_p50,open_p90,open_p99,open_max,write_...,close_...
+		printf("%s,%d,%s,%llu,%.0f,%llu,%llu,"
+			"%llu,%llu,%llu,%llu,"
+			"%llu,%llu,%llu,%llu,"
+			"%llu,%llu,%llu,%llu\n",
+			conf.label,conf.threads,pin_name(conf.pin),
+			(unsigned long long)total,secs>0 ? total/secs : 0.0,
+			(unsigned long long)busy,(unsigned long long)errors,
+			(unsigned long long)st_open.p50,(unsigned long long)st_open.p90,
+			(unsigned long long)st_open.p99,(unsigned long long)st_open.max,
+			(unsigned long long)st_write.p50,(unsigned long long)st_write.p90,
+			(unsigned long long)st_write.p99,(unsigned long long)st_write.max,
+			(unsigned long long)st_close.p50,(unsigned long long)st_close.p90,
+			(unsigned long long)st_close.p99,(unsigned long long)st_close.max);
+	}else{
+		printf("%s: threads=%d pin=%s cycles=%llu time=%.3fs\n",
+			conf.label,conf.threads,pin_name(conf.pin),(unsigned long long)total,secs);
+		printf("throughput: %.0f open/write/close per second, busy retries=%llu, errors=%llu\n",
+			secs>0 ? total/secs : 0.0,(unsigned long long)busy,(unsigned long long)errors);
+		printf("%-8s %12s %12s %12s %12s\n","op(ns)","p50","p90","p99","max");
+		printf("%-8s %12llu %12llu %12llu %12llu\n","open",
+			(unsigned long long)st_open.p50,(unsigned long long)st_open.p90,
+			(unsigned long long)st_open.p99,(unsigned long long)st_open.max);
+		printf("%-8s %12llu %12llu %12llu %12llu\n","write",
+			(unsigned long long)st_write.p50,(unsigned long long)st_write.p90,
+			(unsigned long long)st_write.p99,(unsigned long long)st_write.max);
+		printf("%-8s %12llu %12llu %12llu %12llu\n","release",
+			(unsigned long long)st_close.p50,(unsigned long long)st_close.p90,
+			(unsigned long long)st_close.p99,(unsigned long long)st_close.max);
+	}
+
+	for(i=0;i<conf.threads;i++){
+		free(ctx[i].open_ns);
+		free(ctx[i].write_ns);
+		free(ctx[i].close_ns);
+	}
+	free(ctx);
+	free(all);
+	pthread_barrier_destroy(&start_barrier);
+	return 0;
+}
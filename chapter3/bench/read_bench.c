@@ -0,0 +1,301 @@
+/*
+ * 这是一个读多写少场景的基准测试程序
+ * 多个读线程不停地 read() 设备，一个写线程按固定间隔 write() 更新数据，
+ * 用来比较 15(atomic)、16(spinlock)、19(mutex) 驱动的加锁读路径(locked_read=1)、
+ * RCU 读路径(rcu_mode=1)和顺序锁快照(seq_mode=1)的差别
+ * 驱动需要以 multi_open=1 加载，否则读线程之间会因为独占设备而互相等待
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sched.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<time.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+
+#define MAX_SAMPLES 200000  // 每个读线程最多保存的延时采样数
+
+/* 测试参数 */
+struct bench_conf{
+	const char *dev;      // 设备节点
+	const char *label;    // 结果标签
+	int readers;          // 读线程数
+	int seconds;          // 测试时长
+	int write_us;         // 写线程两次写入之间的间隔，0表示不写
+	int pin;              // 是否把线程轮流绑定到各个CPU上
+	int csv;              // 是否以CSV格式输出
+};
+
+/* 每个线程的统计数据 */
+struct thread_ctx{
+	pthread_t tid;
+	int index;
+	struct bench_conf *conf;
+	uint64_t *lat_ns;     // read延时采样
+	uint64_t nsamples;    // 采样数
+	uint64_t ops;         // 完成的操作数
+	uint64_t errors;      // 出错次数
+};
+
+static volatile int stop;                // 测试结束标志
+static pthread_barrier_t start_barrier;  // 让所有线程同时开始
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+static void pin_thread(int pin,int index)
+{
+	cpu_set_t set;
+	long ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(!pin || ncpu<=0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(index%ncpu,&set);
+	pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+}
+
+/* 读线程：打开一次设备，然后循环读取 */
+static void *reader_thread(void *arg)
+{
+	struct thread_ctx *ctx=(struct thread_ctx *)arg;
+	char buf[16];
+	uint64_t t0,t1;
+	int fd;
+
+	pin_thread(ctx->conf->pin,ctx->index);
+	fd=open(ctx->conf->dev,O_RDWR);
+	pthread_barrier_wait(&start_barrier);
+	if(fd<0){
+		ctx->errors++;
+		return NULL;
+	}
+
+	while(!stop){
+		t0=now_ns();
+		if(read(fd,buf,sizeof(buf))<0)
+			ctx->errors++;
+		t1=now_ns();
+		if(ctx->nsamples<MAX_SAMPLES)
+			ctx->lat_ns[ctx->nsamples++]=t1-t0;
+		ctx->ops++;
+	}
+	close(fd);
+	return NULL;
+}
+
+/* 写线程：按固定间隔轮流写入两个不同的字符串 */
+static void *writer_thread(void *arg)
+{
+	struct thread_ctx *ctx=(struct thread_ctx *)arg;
+	const char *data[2]={"bench1","bench2"};
+	uint64_t t0,t1;
+	int fd;
+
+	pin_thread(ctx->conf->pin,ctx->index);
+	fd=open(ctx->conf->dev,O_RDWR);
+	pthread_barrier_wait(&start_barrier);
+	if(fd<0){
+		ctx->errors++;
+		return NULL;
+	}
+
+	while(!stop){
+		t0=now_ns();
+		if(write(fd,data[ctx->ops&1],strlen(data[0])+1)<0)
+			ctx->errors++;
+		t1=now_ns();
+		if(ctx->nsamples<MAX_SAMPLES)
+			ctx->lat_ns[ctx->nsamples++]=t1-t0;
+		ctx->ops++;
+		usleep(ctx->conf->write_us);
+	}
+	close(fd);
+	return NULL;
+}
+
+static int cmp_u64(const void *a,const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	return x<y ? -1 : x>y;
+}
+
+/* 延时分布 */
+struct lat_stat{
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t max;
+};
+
+static void calc_stat(struct thread_ctx *ctx,int n,struct lat_stat *st)
+{
+	uint64_t *all;
+	size_t total=0;
+	int i;
+
+	memset(st,0,sizeof(*st));
+	for(i=0;i<n;i++)
+		total+=ctx[i].nsamples;
+	if(total==0)
+		return;
+
+	all=malloc(total*sizeof(uint64_t));
+	if(all==NULL)
+		return;
+	total=0;
+	for(i=0;i<n;i++){
+		memcpy(all+total,ctx[i].lat_ns,ctx[i].nsamples*sizeof(uint64_t));
+		total+=ctx[i].nsamples;
+	}
+	qsort(all,total,sizeof(uint64_t),cmp_u64);
+	st->p50=all[total*50/100];
+	st->p99=all[total*99/100];
+	st->max=all[total-1];
+	free(all);
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-d dev] [-r readers] [-s seconds] [-w write_us] [-p] [-l label] [-c]\n",prog);
+	printf("  -d  设备节点，默认 /dev/device_test\n");
+	printf("  -r  读线程数，默认 4\n");
+	printf("  -s  测试时长（秒），默认 5\n");
+	printf("  -w  写线程两次写入的间隔（微秒），默认 1000，0表示没有写线程\n");
+	printf("  -p  把线程轮流绑定到各个CPU上\n");
+	printf("  -l  结果标签，默认为设备节点名\n");
+	printf("  -c  以CSV格式输出一行结果\n");
+}
+
+int main(int argc,char *argv[])
+{
+	struct bench_conf conf={
+		.dev="/dev/device_test",
+		.label=NULL,
+		.readers=4,
+		.seconds=5,
+		.write_us=1000,
+		.pin=0,
+		.csv=0,
+	};
+	struct thread_ctx *ctx;
+	struct lat_stat rd,wr;
+	uint64_t t_start,t_end,reads=0,errors=0;
+	int nthreads;
+	double secs;
+	int opt;
+	int i;
+
+	while((opt=getopt(argc,argv,"d:r:s:w:pl:ch"))!=-1){
+		switch(opt){
+			case 'd':
+				conf.dev=optarg;
+				break;
+			case 'r':
+				conf.readers=atoi(optarg);
+				break;
+			case 's':
+				conf.seconds=atoi(optarg);
+				break;
+			case 'w':
+				conf.write_us=atoi(optarg);
+				break;
+			case 'p':
+				conf.pin=1;
+				break;
+			case 'l':
+				conf.label=optarg;
+				break;
+			case 'c':
+				conf.csv=1;
+				break;
+			default:
+				usage(argv[0]);
+				return -1;
+		}
+	}
+	if(conf.readers<=0 || conf.seconds<=0 || conf.write_us<0){
+		usage(argv[0]);
+		return -1;
+	}
+	if(conf.label==NULL)
+		conf.label=conf.dev;
+
+	// 最后一个线程是写线程
+	nthreads=conf.readers+(conf.write_us>0 ? 1 : 0);
+	ctx=calloc(nthreads,sizeof(*ctx));
+	if(ctx==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+	for(i=0;i<nthreads;i++){
+		ctx[i].index=i;
+		ctx[i].conf=&conf;
+		ctx[i].lat_ns=malloc(MAX_SAMPLES*sizeof(uint64_t));
+		if(ctx[i].lat_ns==NULL){
+			printf("malloc error\n");
+			return -1;
+		}
+	}
+
+	pthread_barrier_init(&start_barrier,NULL,nthreads+1);
+	for(i=0;i<nthreads;i++){
+		if(pthread_create(&ctx[i].tid,NULL,i<conf.readers ? reader_thread : writer_thread,&ctx[i])!=0){
+			printf("pthread_create error\n");
+			return -1;
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	t_start=now_ns();
+	sleep(conf.seconds);
+	stop=1;
+	for(i=0;i<nthreads;i++)
+		pthread_join(ctx[i].tid,NULL);
+	t_end=now_ns();
+	secs=(t_end-t_start)/1e9;
+
+	for(i=0;i<nthreads;i++){
+		errors+=ctx[i].errors;
+		if(i<conf.readers)
+			reads+=ctx[i].ops;
+	}
+	calc_stat(ctx,conf.readers,&rd);
+	calc_stat(ctx+conf.readers,nthreads-conf.readers,&wr);
+
+	if(conf.csv){
+		// label,readers,write_us,reads_per_sec,writes,errors,read_p50,read_p99,read_max,write_p50,write_p99,write_max
+		printf("%s,%d,%d,%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+			conf.label,conf.readers,conf.write_us,reads/secs,
+			(unsigned long long)(nthreads>conf.readers ? ctx[conf.readers].ops : 0),
+			(unsigned long long)errors,
+			(unsigned long long)rd.p50,(unsigned long long)rd.p99,(unsigned long long)rd.max,
+			(unsigned long long)wr.p50,(unsigned long long)wr.p99,(unsigned long long)wr.max);
+	}else{
+		printf("%s: readers=%d write_us=%d time=%.3fs\n",conf.label,conf.readers,conf.write_us,secs);
+		printf("read throughput: %.0f reads per second, errors=%llu\n",reads/secs,(unsigned long long)errors);
+		printf("%-8s %12s %12s %12s\n","op(ns)","p50","p99","max");
+		printf("%-8s %12llu %12llu %12llu\n","read",
+			(unsigned long long)rd.p50,(unsigned long long)rd.p99,(unsigned long long)rd.max);
+		if(nthreads>conf.readers)
+			printf("%-8s %12llu %12llu %12llu\n","write",
+				(unsigned long long)wr.p50,(unsigned long long)wr.p99,(unsigned long long)wr.max);
+	}
+
+	for(i=0;i<nthreads;i++)
+		free(ctx[i].lat_ns);
+	free(ctx);
+	pthread_barrier_destroy(&start_barrier);
+	return 0;
+}
@@ -0,0 +1,115 @@
+#!/bin/bash
+# 读多写少场景的测试脚本
+# 以不同的读路径加载驱动：加锁读(locked_read=1)、RCU读(rcu_mode=1)、顺序锁快照(seq_mode=1)，
+# 扫描读线程数，一个写线程按固定间隔写入，结果写入CSV文件并打印汇总表
+#
+# 用法：./read_bench.sh [结果文件]
+# 环境变量：READERS="1 2 4 8 16"  SECONDS_PER_RUN=5  WRITE_US=1000
+#   RUNS="驱动:模块参数 ..."，模块参数之间用逗号分隔，例如 RUNS="spinlock:locked_read=1 spinlock:seq_mode=1"
+# 减小 WRITE_US 可以得到读写混合的负载
+# 读路径的对照是 spinlock 的加锁读（locked_read=1，spin_lock 保护数据），
+# 各驱动默认的读取只返回固定字符串，不访问共享数据，不作为对照
+#
+# 第二阶段测试忙标志：读线程需要 multi_open=1，测不到忙标志，所以不带 multi_open 加载驱动，
+# 用 lock_bench 循环 open -> write -> close，比较默认的忙标志和 seq_mode=1 的 open/release 开销，
+# 结果写入 <结果文件去掉.csv>_excl.csv
+# 环境变量：EXCL_RUNS="spinlock: spinlock:seq_mode=1 atomic: atomic:seq_mode=1"  THREADS="1 2 4 8"  ITERS=2000
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+CH3_DIR=$(dirname "$BENCH_DIR")
+BENCH=${BENCH:-$BENCH_DIR/read_bench}
+DEV=${DEV:-/dev/device_test}
+OUT=${1:-read.csv}
+READERS=${READERS:-"1 2 4 8 16"}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-5}
+WRITE_US=${WRITE_US:-1000}
+RUNS=${RUNS:-"spinlock:locked_read=1 spinlock:rcu_mode=1 spinlock:seq_mode=1 mutex:locked_read=1 mutex:rcu_mode=1 atomic:seq_mode=1"}
+LOCK_BENCH=${LOCK_BENCH:-$BENCH_DIR/lock_bench}
+EXCL_OUT=${OUT%.csv}_excl.csv
+EXCL_RUNS=${EXCL_RUNS:-"spinlock: spinlock:seq_mode=1 atomic: atomic:seq_mode=1"}
+THREADS=${THREADS:-"1 2 4 8"}
+ITERS=${ITERS:-2000}
+
+module_path()
+{
+	case $1 in
+		atomic)    echo "$CH3_DIR/15/module/atomic.ko" ;;
+		spinlock)  echo "$CH3_DIR/16/module/spinlock.ko" ;;
+		mutex)     echo "$CH3_DIR/19/module/mutex.ko" ;;
+	esac
+}
+
+# 等待 udev/mdev 创建设备节点
+wait_dev()
+{
+	for i in 1 2 3 4 5; do
+		[ -e "$DEV" ] && break
+		sleep 1
+	done
+}
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, build it first (see build_cmd)"
+	exit 1
+fi
+
+echo "label,readers,write_us,reads_per_sec,writes,errors,read_p50,read_p99,read_max,write_p50,write_p99,write_max" > "$OUT"
+
+for run in $RUNS; do
+	mod=${run%%:*}
+	params=$(echo "${run#*:}" | tr ',' ' ')
+	label=$mod-$(echo "${params:-default}" | tr ' =' '_')
+	ko=$(module_path $mod)
+	if [ -z "$ko" ] || [ ! -f "$ko" ]; then
+		echo "skip $mod: module not found"
+		continue
+	fi
+
+	# 读线程需要同时打开设备，所以以 multi_open=1 加载
+	insmod "$ko" multi_open=1 $params || continue
+	wait_dev
+
+	for r in $READERS; do
+		echo "running $mod $params readers=$r"
+		"$BENCH" -d "$DEV" -r $r -s $SECONDS_PER_RUN -w $WRITE_US -p -l $label -c >> "$OUT"
+	done
+
+	rmmod "$(basename "$ko" .ko)"
+done
+
+echo
+awk -F, 'NR==1{printf "%-24s %8s %14s %10s %10s %10s\n","driver","readers","reads/s","read_p50","read_p99","write_p99";next}
+	{printf "%-24s %8s %14s %10s %10s %10s\n",$1,$2,$4,$7,$8,$11}' "$OUT"
+
+# 第二阶段：独占打开，测试忙标志的 open/release 路径
+if [ ! -x "$LOCK_BENCH" ]; then
+	echo "$LOCK_BENCH not found, skip busy flag runs"
+	exit 0
+fi
+
+echo "label,threads,pin,cycles,ops_per_sec,busy,errors,open_p50,open_p90,open_p99,open_max,write_p50,write_p90,write_p99,write_max,release_p50,release_p90,release_p99,release_max" > "$EXCL_OUT"
+
+for run in $EXCL_RUNS; do
+	mod=${run%%:*}
+	params=$(echo "${run#*:}" | tr ',' ' ')
+	label=$mod-excl-$(echo "${params:-default}" | tr ' =' '_')
+	ko=$(module_path $mod)
+	if [ -z "$ko" ] || [ ! -f "$ko" ]; then
+		echo "skip $mod: module not found"
+		continue
+	fi
+
+	insmod "$ko" $params || continue
+	wait_dev
+
+	for t in $THREADS; do
+		echo "running $mod $params exclusive threads=$t"
+		"$LOCK_BENCH" -d "$DEV" -t $t -n $ITERS -p spread -l $label -c >> "$EXCL_OUT"
+	done
+
+	rmmod "$(basename "$ko" .ko)"
+done
+
+echo
+awk -F, 'NR==1{printf "%-28s %7s %12s %10s %12s %12s\n","driver","threads","ops/s","busy","open_p99","release_p99";next}
+	{printf "%-28s %7s %12s %10s %12s %12s\n",$1,$2,$5,$6,$10,$18}' "$EXCL_OUT"
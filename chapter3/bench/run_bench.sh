@@ -0,0 +1,68 @@
+#!/bin/bash
+# 第三章互斥原语竞争基准测试的结果收集脚本
+# 依次加载 15(atomic)、16(spinlock)、18(semaphore)、19(mutex) 的驱动，
+# 对每个驱动扫描线程数和CPU绑定方式，把 lock_bench 的结果汇总到CSV文件中
+# 17(dielock) 会把系统锁死，不参与测试
+#
+# 用法：./run_bench.sh [结果文件]
+# 可以通过环境变量调整参数：
+#   THREADS="1 2 4 8"  PINS="none spread single"  ITERS=2000  MODULES="atomic spinlock"
+#   PARAMS="seq_mode=1" 加载驱动时附加的模块参数，用于和默认方式做A/B对比
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+CH3_DIR=$(dirname "$BENCH_DIR")
+BENCH=${BENCH:-$BENCH_DIR/lock_bench}
+DEV=${DEV:-/dev/device_test}
+OUT=${1:-results.csv}
+THREADS=${THREADS:-"1 2 4 8"}
+PINS=${PINS:-"none spread single"}
+ITERS=${ITERS:-2000}
+MODULES=${MODULES:-"atomic spinlock semaphore mutex"}
+PARAMS=${PARAMS:-}
+
+# 驱动名和模块文件的对应关系
+module_path()
+{
+	case $1 in
+		atomic)    echo "$CH3_DIR/15/module/atomic.ko" ;;
+		spinlock)  echo "$CH3_DIR/16/module/spinlock.ko" ;;
+		semaphore) echo "$CH3_DIR/18/module/semaphore.ko" ;;
+		mutex)     echo "$CH3_DIR/19/module/mutex.ko" ;;
+	esac
+}
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, build it first (see build_cmd)"
+	exit 1
+fi
+
+echo "label,threads,pin,cycles,ops_per_sec,busy,errors,open_p50,open_p90,open_p99,open_max,write_p50,write_p90,write_p99,write_max,release_p50,release_p90,release_p99,release_max" > "$OUT"
+
+for mod in $MODULES; do
+	ko=$(module_path $mod)
+	if [ -z "$ko" ] || [ ! -f "$ko" ]; then
+		echo "skip $mod: module not found"
+		continue
+	fi
+
+	insmod "$ko" $PARAMS || continue
+	# 等待 udev/mdev 创建设备节点
+	for i in 1 2 3 4 5; do
+		[ -e "$DEV" ] && break
+		sleep 1
+	done
+
+	for t in $THREADS; do
+		for pin in $PINS; do
+			echo "running $mod threads=$t pin=$pin"
+			"$BENCH" -d "$DEV" -t $t -n $ITERS -p $pin -l $mod${PARAMS:+-$(echo $PARAMS | tr ' =' '_')} -c >> "$OUT"
+		done
+	done
+
+	rmmod "$(basename "$ko" .ko)"
+done
+
+# 打印汇总表：吞吐量和 open 的 p99 延时（包含等锁时间）
+echo
+awk -F, 'NR==1{printf "%-10s %7s %-7s %12s %10s %12s %12s\n","driver","threads","pin","ops/s","busy","open_p99","write_p99";next}
+	{printf "%-10s %7s %-7s %12s %10s %12s %12s\n",$1,$2,$3,$5,$6,$10,$14}' "$OUT"
@@ -0,0 +1,64 @@
+#!/bin/bash
+# 多路打开模式(multi_open)的扩展性测试
+# 对每个驱动分别以 multi_open=0（独占设备）和 multi_open=1（每个文件私有缓冲区）加载，
+# 用 lock_bench 在 1~4 个核上各跑一个线程，比较吞吐量随核数的变化
+#
+# 用法：./scale_bench.sh [结果文件]
+# 环境变量：CPUS="1 2 3 4"  ITERS=2000  PAYLOAD=bench  MODULES="atomic spinlock semaphore mutex"
+# PAYLOAD=itop 时驱动每次写入延时2秒，可以直观地看到多个写者是否真正并行
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+CH3_DIR=$(dirname "$BENCH_DIR")
+BENCH=${BENCH:-$BENCH_DIR/lock_bench}
+DEV=${DEV:-/dev/device_test}
+OUT=${1:-scale.csv}
+CPUS=${CPUS:-"1 2 3 4"}
+ITERS=${ITERS:-2000}
+PAYLOAD=${PAYLOAD:-bench}
+MODULES=${MODULES:-"atomic spinlock semaphore mutex"}
+
+module_path()
+{
+	case $1 in
+		atomic)    echo "$CH3_DIR/15/module/atomic.ko" ;;
+		spinlock)  echo "$CH3_DIR/16/module/spinlock.ko" ;;
+		semaphore) echo "$CH3_DIR/18/module/semaphore.ko" ;;
+		mutex)     echo "$CH3_DIR/19/module/mutex.ko" ;;
+	esac
+}
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, build it first (see build_cmd)"
+	exit 1
+fi
+
+echo "label,threads,pin,cycles,ops_per_sec,busy,errors,open_p50,open_p90,open_p99,open_max,write_p50,write_p90,write_p99,write_max,release_p50,release_p90,release_p99,release_max" > "$OUT"
+
+for mod in $MODULES; do
+	ko=$(module_path $mod)
+	if [ -z "$ko" ] || [ ! -f "$ko" ]; then
+		echo "skip $mod: module not found"
+		continue
+	fi
+
+	for multi in 0 1; do
+		insmod "$ko" multi_open=$multi || continue
+		for i in 1 2 3 4 5; do
+			[ -e "$DEV" ] && break
+			sleep 1
+		done
+
+		for n in $CPUS; do
+			echo "running $mod multi_open=$multi cpus=$n"
+			"$BENCH" -d "$DEV" -t $n -n $ITERS -p spread -w "$PAYLOAD" -l $mod-multi$multi -c >> "$OUT"
+		done
+
+		rmmod "$(basename "$ko" .ko)"
+	done
+done
+
+# 打印吞吐量随核数变化的汇总表，speedup 相对于同一配置下单核的吞吐量
+echo
+awk -F, 'NR==1{printf "%-18s %5s %12s %8s\n","driver","cpus","ops/s","speedup";next}
+	{if($2==1)base[$1]=$5; s=(base[$1]>0)?$5/base[$1]:0;
+	 printf "%-18s %5s %12s %8.2f\n",$1,$2,$5,s}' "$OUT"
@@ -0,0 +1,50 @@
+#!/bin/bash
+# 统计计数器测试脚本：对比全局原子变量和每CPU计数器
+# 1.运行 atomic 驱动中的计数器微基准测试（每个在线CPU一个内核线程同时加1）
+# 2.以 multi_open=1 加载 atomic 驱动，依次设置 stat_mode=0/1/2，
+#   用 read_bench 在所有CPU上并发 read()，比较统计开销对读吞吐量的影响
+#
+# 用法：./stat_bench.sh [结果文件]
+# 环境变量：ITERS=1000000（微基准每个CPU的加1次数）  READERS=4  SECONDS_PER_RUN=5
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+CH3_DIR=$(dirname "$BENCH_DIR")
+BENCH=${BENCH:-$BENCH_DIR/read_bench}
+DEV=${DEV:-/dev/device_test}
+OUT=${1:-stat.csv}
+ITERS=${ITERS:-1000000}
+READERS=${READERS:-4}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-5}
+KO=$CH3_DIR/15/module/atomic.ko
+SYSFS=/sys/class/class_test/device_test
+PARAM=/sys/module/atomic/parameters/stat_mode
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, build it first (see build_cmd)"
+	exit 1
+fi
+
+insmod "$KO" multi_open=1 || exit 1
+for i in 1 2 3 4 5; do
+	[ -e "$DEV" ] && break
+	sleep 1
+done
+
+echo "counter microbenchmark, $ITERS increments per cpu:"
+echo $ITERS > $SYSFS/stat_bench
+cat $SYSFS/stat_bench
+echo
+
+echo "label,readers,write_us,reads_per_sec,writes,errors,read_p50,read_p99,read_max,write_p50,write_p99,write_max" > "$OUT"
+for mode in 0 1 2; do
+	echo $mode > $PARAM
+	echo "running stat_mode=$mode readers=$READERS"
+	"$BENCH" -d "$DEV" -r $READERS -s $SECONDS_PER_RUN -w 0 -p -l stat_mode_$mode -c >> "$OUT"
+done
+echo "reads counted: $(cat $SYSFS/reads)"
+
+rmmod atomic
+
+echo
+awk -F, 'NR==1{printf "%-14s %8s %14s %10s %10s\n","mode","readers","reads/s","read_p50","read_p99";next}
+	{printf "%-14s %8s %14s %10s %10s\n",$1,$2,$4,$7,$8}' "$OUT"
@@ -0,0 +1,206 @@
+/*
+ * lock_stat.h - 第三章驱动共用的锁统计层
+ *
+ * 在加锁/解锁的位置调用下面的函数，用 ktime_get_ns() 采样，
+ * 按CPU分别记录等锁时间(wait)和持锁时间(hold)的 log2 直方图，
+ * 通过 debugfs 导出，不需要打开内核的 lockstat：
+ *   /sys/kernel/debug/<name>/stats   查看统计结果
+ *   /sys/kernel/debug/<name>/reset   写入任意值清空统计
+ *   /sys/kernel/debug/<name>/enable  写0/1关闭/打开采样
+ *
+ * 用法：
+ *   t0=lock_stat_wait_begin(&ls);
+ *   spin_lock(&lock);
+ *   t1=lock_stat_acquired(&ls,t0);   // 记录等锁时间，返回拿到锁的时间
+ *   ...
+ *   lock_stat_released(&ls,t1);      // 记录持锁时间，在解锁之前调用
+ *   spin_unlock(&lock);
+ */
+
+#ifndef _LOCK_STAT_H_
+#define _LOCK_STAT_H_
+
+#include<linux/module.h>
+#include<linux/fs.h>
+#include<linux/types.h>
+#include<linux/stddef.h>
+#include<linux/math64.h>
+#include<linux/ktime.h>
+#include<linux/percpu.h>
+#include<linux/log2.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/uaccess.h>
+
+#define LOCK_STAT_BUCKETS 32  // 第k个桶统计 [2^k,2^(k+1)) ns，最后一个桶包含更长的时间
+
+/* 每个CPU上的统计数据 */
+struct lock_stat_cpu{
+	u64 wait_hist[LOCK_STAT_BUCKETS];  // 等锁时间直方图
+	u64 hold_hist[LOCK_STAT_BUCKETS];  // 持锁时间直方图
+	u64 wait_count;
+	u64 wait_total;
+	u64 wait_max;
+	u64 hold_count;
+	u64 hold_total;
+	u64 hold_max;
+};
+
+/* 一把锁的统计信息 */
+struct lock_stat{
+	const char *name;                   // 锁的名字，同时也是 debugfs 目录名
+	bool enable;                        // 是否采样
+	struct lock_stat_cpu __percpu *cpu; // 每个CPU的统计数据
+	struct dentry *dir;                 // debugfs 目录
+};
+
+static inline int lock_stat_bucket(u64 ns)
+{
+	int k;
+	if(ns==0)
+		return 0;
+	k=ilog2(ns);
+	return k<LOCK_STAT_BUCKETS ? k : LOCK_STAT_BUCKETS-1;
+}
+
+/* 开始等锁，返回采样时间，采样关闭时返回0 */
+static inline u64 lock_stat_wait_begin(struct lock_stat *ls)
+{
+	return READ_ONCE(ls->enable) ? ktime_get_ns() : 0;
+}
+
+/* 拿到锁之后调用，记录等锁时间，返回拿到锁的时间，用于之后计算持锁时间 */
+static inline u64 lock_stat_acquired(struct lock_stat *ls,u64 t0)
+{
+	struct lock_stat_cpu *st;
+	u64 now,delta;
+
+	if(t0==0)
+		return 0;
+
+	now=ktime_get_ns();
+	delta=now-t0;
+	st=get_cpu_ptr(ls->cpu);
+	st->wait_hist[lock_stat_bucket(delta)]++;
+	st->wait_count++;
+	st->wait_total+=delta;
+	if(delta>st->wait_max)
+		st->wait_max=delta;
+	put_cpu_ptr(ls->cpu);
+	return now;
+}
+
+/* 解锁之前调用，记录持锁时间 */
+static inline void lock_stat_released(struct lock_stat *ls,u64 acquired)
+{
+	struct lock_stat_cpu *st;
+	u64 delta;
+
+	if(acquired==0)
+		return;
+
+	delta=ktime_get_ns()-acquired;
+	st=get_cpu_ptr(ls->cpu);
+	st->hold_hist[lock_stat_bucket(delta)]++;
+	st->hold_count++;
+	st->hold_total+=delta;
+	if(delta>st->hold_max)
+		st->hold_max=delta;
+	put_cpu_ptr(ls->cpu);
+}
+
+static inline void lock_stat_show_hist(struct seq_file *m,const char *title,struct lock_stat *ls,size_t offset)
+{
+	u64 hist[LOCK_STAT_BUCKETS]={0};
+	int cpu,k;
+
+	for_each_possible_cpu(cpu){
+		u64 *h=(u64 *)((char *)per_cpu_ptr(ls->cpu,cpu)+offset);
+		for(k=0;k<LOCK_STAT_BUCKETS;k++)
+			hist[k]+=h[k];
+	}
+
+	seq_printf(m,"%s histogram (ns):\n",title);
+	for(k=0;k<LOCK_STAT_BUCKETS;k++){
+		if(hist[k]==0)
+			continue;
+		seq_printf(m,"  >= %-12llu %llu\n",1ULL<<k,hist[k]);
+	}
+}
+
+/* stats 文件：每个CPU一行汇总，再打印所有CPU合并后的直方图 */
+static inline int lock_stat_show(struct seq_file *m,void *v)
+{
+	struct lock_stat *ls=m->private;
+	struct lock_stat_cpu *st;
+	int cpu;
+
+	seq_printf(m,"lock: %s  enable: %d\n",ls->name,ls->enable);
+	seq_printf(m,"%-4s %10s %12s %12s %10s %12s %12s\n",
+		"cpu","waits","wait_avg","wait_max","holds","hold_avg","hold_max");
+	for_each_possible_cpu(cpu){
+		st=per_cpu_ptr(ls->cpu,cpu);
+		seq_printf(m,"%-4d %10llu %12llu %12llu %10llu %12llu %12llu\n",cpu,
+			st->wait_count,st->wait_count ? div64_u64(st->wait_total,st->wait_count) : 0,st->wait_max,
+			st->hold_count,st->hold_count ? div64_u64(st->hold_total,st->hold_count) : 0,st->hold_max);
+	}
+	lock_stat_show_hist(m,"wait",ls,offsetof(struct lock_stat_cpu,wait_hist));
+	lock_stat_show_hist(m,"hold",ls,offsetof(struct lock_stat_cpu,hold_hist));
+	return 0;
+}
+
+static inline int lock_stat_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,lock_stat_show,inode->i_private);
+}
+
+static const struct file_operations lock_stat_fops={
+	.owner=THIS_MODULE,
+	.open=lock_stat_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+/* reset 文件：写入任意内容清空所有CPU的统计 */
+static inline ssize_t lock_stat_reset_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
+{
+	struct lock_stat *ls=file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ls->cpu,cpu),0,sizeof(struct lock_stat_cpu));
+	return size;
+}
+
+static const struct file_operations lock_stat_reset_fops={
+	.owner=THIS_MODULE,
+	.open=simple_open,
+	.write=lock_stat_reset_write,
+	.llseek=noop_llseek,
+};
+
+/* 初始化统计数据并创建 debugfs 文件，在模块初始化时调用 */
+static inline int lock_stat_init(struct lock_stat *ls,const char *name)
+{
+	ls->name=name;
+	ls->enable=true;
+	ls->cpu=alloc_percpu(struct lock_stat_cpu);
+	if(ls->cpu==NULL)
+		return -ENOMEM;
+
+	ls->dir=debugfs_create_dir(name,NULL);
+	debugfs_create_file("stats",0444,ls->dir,ls,&lock_stat_fops);
+	debugfs_create_file("reset",0200,ls->dir,ls,&lock_stat_reset_fops);
+	debugfs_create_bool("enable",0644,ls->dir,&ls->enable);
+	return 0;
+}
+
+/* 删除 debugfs 文件并释放统计数据，在模块退出时调用 */
+static inline void lock_stat_exit(struct lock_stat *ls)
+{
+	debugfs_remove_recursive(ls->dir);
+	free_percpu(ls->cpu);
+}
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * lock_track.h - 第三章驱动共用的锁跟踪层（轻量的锁顺序检查和持锁超时检测）
+ *
+ * 不依赖内核的 lockdep，开销只有一次短暂的加锁和几次赋值，可以在正式版本中一直打开：
+ *   记录每把锁的持有者（进程名、pid、CPU）、获取位置和获取时间
+ *   发现同一个进程以相反的顺序获取过两把锁时报告锁顺序反转
+ *   后台每秒检查一次，锁被持有超过 threshold_ms 时报告持有者和获取位置
+ *
+ * debugfs 文件（/sys/kernel/debug/<name>/）：
+ *   locks         当前所有锁的状态：持有者、获取位置、持有时间、等待者数量
+ *   reports       最近的超时和锁顺序反转报告
+ *   threshold_ms  持锁超时阈值，默认5000ms
+ *   enable        写0/1关闭/打开跟踪
+ *   stack         获取锁时保存调用栈（默认打开，超时报告中打印持有者的调用栈，写0只记录获取位置）
+ *
+ * 用法：
+ *   lock_track_init("dielock_test");
+ *   lock_track_register(&lt,"spinlock_test");
+ *   lock_track_wait(&lt);
+ *   spin_lock(&lock);
+ *   lock_track_acquired(&lt);    // 记录持有者和获取位置
+ *   ...
+ *   lock_track_released(&lt);    // 在解锁之前调用
+ *   spin_unlock(&lock);
+ */
+
+#ifndef _LOCK_TRACK_H_
+#define _LOCK_TRACK_H_
+
+#include<linux/module.h>
+#include<linux/fs.h>
+#include<linux/types.h>
+#include<linux/bitops.h>
+#include<linux/kernel.h>
+#include<linux/sched.h>
+#include<linux/smp.h>
+#include<linux/ktime.h>
+#include<linux/spinlock.h>
+#include<linux/workqueue.h>
+#include<linux/stacktrace.h>
+#include<linux/slab.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+
+#define LOCK_TRACK_MAX 32      // 每个模块最多跟踪的锁数量，锁顺序用 32x32 的位矩阵记录
+#define LOCK_TRACK_DEPTH 8     // 保存的调用栈深度
+#define LOCK_TRACK_REPORTS 16  // 保留最近的报告条数
+#define LOCK_TRACK_REPORT_LEN 768
+
+/* 一把被跟踪的锁 */
+struct lock_track{
+	const char *name;      // 锁的名字
+	int id;                // 在锁顺序矩阵中的编号
+	atomic_t waiting;      // 正在等待这把锁的数量
+
+	// 以下成员由 lock_track_state.lock 保护
+	u64 since;             // 拿到锁的时间(ns)，0表示没有被持有
+	unsigned long ip;      // 获取锁的位置
+	unsigned long caller;  // 获取锁的函数的调用者
+	pid_t pid;             // 持有者
+	char comm[TASK_COMM_LEN];
+	int cpu;
+	bool reported;         // 本次持有已经报告过超时
+	unsigned int nr_entries;
+	unsigned long stack[LOCK_TRACK_DEPTH];
+};
+
+/* 一个模块内所有被跟踪的锁 */
+static struct lock_track_state{
+	spinlock_t lock;
+	struct lock_track *locks[LOCK_TRACK_MAX];
+	int nr;
+	u32 order[LOCK_TRACK_MAX];     // order[a]的第b位为1表示出现过持有a时获取b
+	u32 inverted[LOCK_TRACK_MAX];  // 已经报告过的反转，每对锁只报告一次
+	bool enable;
+	bool stack;
+	u32 threshold_ms;
+	struct dentry *dir;
+	struct delayed_work work;      // 持锁超时检测
+	unsigned int nr_reports;       // 累计报告数
+	char reports[LOCK_TRACK_REPORTS][LOCK_TRACK_REPORT_LEN];
+} lock_track_state={
+	.lock=__SPIN_LOCK_UNLOCKED(lock_track_state.lock),
+};
+
+/* 注册一把锁，在模块初始化时调用 */
+static inline int lock_track_register(struct lock_track *lt,const char *name)
+{
+	struct lock_track_state *s=&lock_track_state;
+	unsigned long flags;
+	int ret=0;
+
+	lt->name=name;
+	lt->since=0;
+	atomic_set(&lt->waiting,0);
+	spin_lock_irqsave(&s->lock,flags);
+	if(s->nr<LOCK_TRACK_MAX){
+		lt->id=s->nr;
+		s->locks[s->nr++]=lt;
+	}else{
+		ret=-ENOSPC;
+	}
+	spin_unlock_irqrestore(&s->lock,flags);
+	return ret;
+}
+
+/* 把一把锁的持有者信息格式化到 buf 中，调用者持有 lock_track_state.lock */
+static inline int lock_track_format(char *buf,size_t size,struct lock_track *lt,u64 now)
+{
+	int n;
+	unsigned int i;
+
+	n=scnprintf(buf,size,"%s held %llu ms by %s[%d] on cpu %d at %pS from %pS, %d waiting\n",
+		lt->name,div_u64(now-lt->since,NSEC_PER_MSEC),lt->comm,lt->pid,lt->cpu,
+		(void *)lt->ip,(void *)lt->caller,atomic_read(&lt->waiting));
+	// 有的架构的 save_stack_trace 在末尾放一个 ULONG_MAX 作为结束标记
+	for(i=0;i<lt->nr_entries && lt->stack[i]!=ULONG_MAX;i++)
+		n+=scnprintf(buf+n,size-n,"    %pS\n",(void *)lt->stack[i]);
+	return n;
+}
+
+/* 取一个报告缓冲区，旧的报告被覆盖 */
+static inline char *lock_track_report_buf(void)
+{
+	struct lock_track_state *s=&lock_track_state;
+	return s->reports[s->nr_reports++ % LOCK_TRACK_REPORTS];
+}
+
+/* 开始等锁，在加锁之前调用 */
+static inline void lock_track_wait(struct lock_track *lt)
+{
+	if(READ_ONCE(lock_track_state.enable))
+		atomic_inc(&lt->waiting);
+}
+
+static inline void __lock_track_acquired(struct lock_track *lt,unsigned long ip,unsigned long caller)
+{
+	struct lock_track_state *s=&lock_track_state;
+	struct lock_track *h;
+	struct stack_trace trace={
+		.entries=lt->stack,
+		.max_entries=LOCK_TRACK_DEPTH,
+		.skip=1,
+	};
+	unsigned long flags;
+	char *buf;
+	int n,i;
+
+	if(!READ_ONCE(s->enable))
+		return;
+	atomic_dec_if_positive(&lt->waiting);
+
+	spin_lock_irqsave(&s->lock,flags);
+	lt->since=ktime_get_ns();
+	lt->ip=ip;
+	lt->caller=caller;
+	lt->pid=current->pid;
+	get_task_comm(lt->comm,current);
+	lt->cpu=raw_smp_processor_id();
+	lt->reported=false;
+	// 4.19 还没有 stack_trace_save，用 save_stack_trace
+	if(s->stack)
+		save_stack_trace(&trace);
+	lt->nr_entries=trace.nr_entries;
+
+	// 锁顺序检查：当前进程还持有的其他锁都排在这把锁前面
+	for(i=0;i<s->nr;i++){
+		h=s->locks[i];
+		if(h==lt || h->since==0 || h->pid!=lt->pid)
+			continue;
+		s->order[h->id]|=BIT(lt->id);
+		if((s->order[lt->id] & BIT(h->id)) && !(s->inverted[h->id] & BIT(lt->id))){
+			s->inverted[h->id]|=BIT(lt->id);
+			buf=lock_track_report_buf();
+			n=scnprintf(buf,LOCK_TRACK_REPORT_LEN,
+				"lock order inversion: %s taken at %pS while holding %s, the reverse order was seen before\n",
+				lt->name,(void *)ip,h->name);
+			lock_track_format(buf+n,LOCK_TRACK_REPORT_LEN-n,h,lt->since);
+			pr_warn("lock_track: %s",buf);
+		}
+	}
+	spin_unlock_irqrestore(&s->lock,flags);
+}
+
+/* 拿到锁之后调用，记录持有者、获取位置和调用者 */
+#define lock_track_acquired(lt) __lock_track_acquired(lt,_THIS_IP_,_RET_IP_)
+
+/* 解锁之前调用 */
+static inline void lock_track_released(struct lock_track *lt)
+{
+	struct lock_track_state *s=&lock_track_state;
+	unsigned long flags;
+
+	if(READ_ONCE(lt->since)==0)
+		return;
+	spin_lock_irqsave(&s->lock,flags);
+	lt->since=0;
+	spin_unlock_irqrestore(&s->lock,flags);
+}
+
+/* 持锁超时检测，每秒执行一次，在不绑定CPU的工作队列中执行，持锁的CPU卡死时也能运行 */
+static inline void lock_track_watchdog(struct work_struct *work)
+{
+	struct lock_track_state *s=&lock_track_state;
+	struct lock_track *lt;
+	unsigned long flags;
+	u64 now=ktime_get_ns();
+	char *buf;
+	int i;
+
+	spin_lock_irqsave(&s->lock,flags);
+	for(i=0;i<s->nr;i++){
+		lt=s->locks[i];
+		if(lt->since==0 || lt->reported)
+			continue;
+		if(now-lt->since<(u64)READ_ONCE(s->threshold_ms)*NSEC_PER_MSEC)
+			continue;
+		lt->reported=true;  // 每次持有只报告一次
+		buf=lock_track_report_buf();
+		lock_track_format(buf,LOCK_TRACK_REPORT_LEN,lt,now);
+		pr_warn("lock_track: %s",buf);
+	}
+	spin_unlock_irqrestore(&s->lock,flags);
+	queue_delayed_work(system_unbound_wq,&s->work,HZ);
+}
+
+/* locks 文件：所有锁的当前状态 */
+static inline int lock_track_locks_show(struct seq_file *m,void *v)
+{
+	struct lock_track_state *s=&lock_track_state;
+	char *buf;
+	u64 now=ktime_get_ns();
+	int i;
+
+	buf=kmalloc(LOCK_TRACK_REPORT_LEN,GFP_KERNEL);
+	if(buf==NULL)
+		return -ENOMEM;
+	for(i=0;i<s->nr;i++){
+		spin_lock_irq(&s->lock);
+		if(s->locks[i]->since)
+			lock_track_format(buf,LOCK_TRACK_REPORT_LEN,s->locks[i],now);
+		else
+			scnprintf(buf,LOCK_TRACK_REPORT_LEN,"%s free, %d waiting\n",
+				s->locks[i]->name,atomic_read(&s->locks[i]->waiting));
+		spin_unlock_irq(&s->lock);
+		seq_puts(m,buf);
+	}
+	kfree(buf);
+	return 0;
+}
+
+/* reports 文件：按时间顺序打印保留的报告 */
+static inline int lock_track_reports_show(struct seq_file *m,void *v)
+{
+	struct lock_track_state *s=&lock_track_state;
+	char *buf;
+	unsigned int i,first,total;
+
+	buf=kmalloc(LOCK_TRACK_REPORT_LEN,GFP_KERNEL);
+	if(buf==NULL)
+		return -ENOMEM;
+	spin_lock_irq(&s->lock);
+	total=s->nr_reports;
+	spin_unlock_irq(&s->lock);
+	first=total>LOCK_TRACK_REPORTS ? total-LOCK_TRACK_REPORTS : 0;
+	seq_printf(m,"%u reports\n",total);
+	for(i=first;i<total;i++){
+		spin_lock_irq(&s->lock);
+		memcpy(buf,s->reports[i % LOCK_TRACK_REPORTS],LOCK_TRACK_REPORT_LEN);
+		spin_unlock_irq(&s->lock);
+		seq_printf(m,"[%u] %s",i,buf);
+	}
+	kfree(buf);
+	return 0;
+}
+
+static inline int lock_track_locks_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,lock_track_locks_show,NULL);
+}
+
+static inline int lock_track_reports_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,lock_track_reports_show,NULL);
+}
+
+static const struct file_operations lock_track_locks_fops={
+	.owner=THIS_MODULE,
+	.open=lock_track_locks_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+static const struct file_operations lock_track_reports_fops={
+	.owner=THIS_MODULE,
+	.open=lock_track_reports_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+/* 创建 debugfs 文件并启动超时检测，在模块初始化时调用 */
+static inline void lock_track_init(const char *name)
+{
+	struct lock_track_state *s=&lock_track_state;
+
+	s->enable=true;
+	s->stack=true;
+	s->threshold_ms=5000;
+	s->dir=debugfs_create_dir(name,NULL);
+	debugfs_create_file("locks",0444,s->dir,NULL,&lock_track_locks_fops);
+	debugfs_create_file("reports",0444,s->dir,NULL,&lock_track_reports_fops);
+	debugfs_create_u32("threshold_ms",0644,s->dir,&s->threshold_ms);
+	debugfs_create_bool("enable",0644,s->dir,&s->enable);
+	debugfs_create_bool("stack",0644,s->dir,&s->stack);
+
+	INIT_DELAYED_WORK(&s->work,lock_track_watchdog);
+	queue_delayed_work(system_unbound_wq,&s->work,HZ);
+}
+
+/* 停止超时检测并删除 debugfs 文件，在模块退出时调用 */
+static inline void lock_track_exit(void)
+{
+	cancel_delayed_work_sync(&lock_track_state.work);
+	debugfs_remove_recursive(lock_track_state.dir);
+}
+
+#endif
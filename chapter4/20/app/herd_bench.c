@@ -0,0 +1,170 @@
+/*
+ * 这是一个惊群测试程序，用于比较普通唤醒和互斥唤醒（excl_wake=1）
+ * 多个读线程同时阻塞在 read 上，写线程按固定间隔写入带时间戳的记录，
+ * 每条记录只有一个读线程能取到，统计记录从写入到被读出的延时，
+ * 以及平均每条记录引起的上下文切换次数
+ * 使用方法：./herd_bench [读线程数] [记录条数] [写入间隔us]
+ * 切换模式：echo 1 > /sys/module/wq/parameters/excl_wake
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/time.h>
+#include<sys/resource.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<stdint.h>
+#include<pthread.h>
+#include<time.h>
+
+#define SEQ_STOP 0xffffffffu  // 结束记录，每个读线程收到一条后退出
+
+/* 写入设备的记录 */
+struct herd_msg{
+	uint64_t send_ns;  // 写入时间
+	uint32_t seq;      // 记录编号
+	uint32_t pad;
+};
+
+/* 每个读线程的统计数据 */
+struct reader_ctx{
+	pthread_t tid;
+	int fd;
+	uint64_t *lat_ns;  // 延时采样
+	int nsamples;
+	long csw;          // 线程的上下文切换次数
+};
+
+static int count=10000;  // 记录条数
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+/* 读线程：阻塞读取记录，直到收到结束记录 */
+static void *reader_thread(void *arg)
+{
+	struct reader_ctx *ctx=(struct reader_ctx *)arg;
+	struct herd_msg msg;
+	struct rusage ru;
+
+	while(1){
+		if(read(ctx->fd,&msg,sizeof(msg))!=sizeof(msg)){
+			perror("read error");
+			break;
+		}
+		if(msg.seq==SEQ_STOP)
+			break;
+		if(ctx->nsamples<count)
+			ctx->lat_ns[ctx->nsamples++]=now_ns()-msg.send_ns;
+	}
+	getrusage(RUSAGE_THREAD,&ru);
+	ctx->csw=ru.ru_nvcsw+ru.ru_nivcsw;
+	return NULL;
+}
+
+static int cmp_u64(const void *a,const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	return x<y ? -1 : x>y;
+}
+
+int main(int argc,char *argv[])
+{
+	struct reader_ctx *ctx;
+	struct herd_msg msg={0};
+	uint64_t *all;
+	long csw=0;
+	int readers=64;        // 读线程数
+	int interval_us=100;   // 写入间隔
+	int total=0;
+	int fd;
+	int i;
+
+	if(argc>1)
+		readers=atoi(argv[1]);
+	if(argc>2)
+		count=atoi(argv[2]);
+	if(argc>3)
+		interval_us=atoi(argv[3]);
+	if(readers<=0 || count<=0 || interval_us<0){
+		printf("usage: %s [readers] [records] [interval_us]\n",argv[0]);
+		return -1;
+	}
+
+	// 打开设备节点，读线程共用一个文件描述符
+	fd=open("/dev/test",O_RDWR);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	ctx=calloc(readers,sizeof(*ctx));
+	all=malloc(count*sizeof(uint64_t));
+	if(ctx==NULL || all==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+	for(i=0;i<readers;i++){
+		ctx[i].fd=fd;
+		ctx[i].lat_ns=malloc(count*sizeof(uint64_t));
+		if(ctx[i].lat_ns==NULL){
+			printf("malloc error\n");
+			return -1;
+		}
+		if(pthread_create(&ctx[i].tid,NULL,reader_thread,&ctx[i])!=0){
+			printf("pthread_create error\n");
+			return -1;
+		}
+	}
+	// 等所有读线程都进入阻塞
+	usleep(200000);
+
+	// 写入带时间戳的记录
+	for(i=0;i<count;i++){
+		msg.seq=i;
+		msg.send_ns=now_ns();
+		if(write(fd,&msg,sizeof(msg))<0){
+			perror("write error");
+			break;
+		}
+		if(interval_us)
+			usleep(interval_us);
+	}
+	// 每个读线程一条结束记录
+	msg.seq=SEQ_STOP;
+	for(i=0;i<readers;i++)
+		write(fd,&msg,sizeof(msg));
+
+	for(i=0;i<readers;i++){
+		pthread_join(ctx[i].tid,NULL);
+		memcpy(all+total,ctx[i].lat_ns,ctx[i].nsamples*sizeof(uint64_t));
+		total+=ctx[i].nsamples;
+		csw+=ctx[i].csw;
+	}
+
+	printf("readers=%d records=%d interval=%dus\n",readers,total,interval_us);
+	if(total>0){
+		qsort(all,total,sizeof(uint64_t),cmp_u64);
+		printf("latency(ns): p50=%llu p99=%llu max=%llu\n",
+			(unsigned long long)all[total*50/100],(unsigned long long)all[total*99/100],
+			(unsigned long long)all[total-1]);
+		printf("reader context switches: %ld, %.2f per record\n",csw,(double)csw/total);
+	}
+
+	// 关闭设备
+	for(i=0;i<readers;i++)
+		free(ctx[i].lat_ns);
+	free(ctx);
+	free(all);
+	close(fd);
+	return 0;
+}
@@ -12,6 +12,24 @@
 #include<linux/delay.h>
 #include<linux/io.h>
 #include<linux/wait.h>
+#include<linux/kfifo.h>
+#include<linux/mutex.h>
+#include<linux/moduleparam.h>
+#include "rec_lat.h"
+#include "rec_wait.h"
+
+#define FIFO_SIZE 4096  // 记录队列的大小（字节），必须是2的幂
+#define MSG_MAX 256     // 单条记录的最大长度
+
+// 互斥唤醒模式：读进程以互斥方式等待，一条记录只唤醒一个读进程，避免所有读进程一起被唤醒（惊群）
+static bool excl_wake;
+module_param(excl_wake,bool,0644);
+MODULE_PARM_DESC(excl_wake,"wake a single reader per record instead of all of them");
+
+// 时间戳模式：read 返回的记录前面加上 struct rec_lat_ts，包含记录的写入时间和取出时间
+static bool rec_ts;
+module_param(rec_ts,bool,0644);
+MODULE_PARM_DESC(rec_ts,"prefix each record returned by read with its write/read timestamps");
 
 /* 设备结构体定义 */
 struct device_test{
@@ -21,8 +39,10 @@ struct device_test{
 	struct cdev cdev_test;// 字符设备结构体
 	struct class *class;  // 设备类
 	struct device *device;// 设备结构体
-	char kbuf[32];        // 内核缓冲区
-	int flag;             // 标志位，用于等待队列
+	struct kfifo_rec_ptr_2 fifo;  // 变长记录队列，每条记录前面有2字节的长度
+	struct mutex lock;            // 保护记录队列，复制数据时可能睡眠，所以使用互斥锁
+	struct rec_stamps stamps;     // 每条记录的写入时间，和记录队列同步进出
+	struct rec_lat lat;           // 记录延时统计，在 debugfs 中查看
 };
 
 /* 定义设备实例 */
@@ -30,6 +50,7 @@ struct device_test dev1;
 
 /* 声明等待队列头 */
 DECLARE_WAIT_QUEUE_HEAD(read_wq);
+DECLARE_WAIT_QUEUE_HEAD(write_wq);  // 队列满时写进程在这里等待
 
 /* 打开设备函数 */
 static int cdev_test_open(struct inode *inode,struct file *file)
@@ -39,39 +60,107 @@ static int cdev_test_open(struct inode *inode,struct file *file)
 	return 0;
 }
 
-/* 读设备函数 */
+/* 读设备函数：按写入的顺序取出一条记录，返回记录的长度 */
 static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
 {
 	struct device_test *test_dev=(struct device_test *)file->private_data;
-	// 等待直到flag被设置为1
-	wait_event_interruptible(read_wq,test_dev->flag);
-	// 将内核数据复制到用户空间
-	if(copy_to_user(buf,test_dev->kbuf,strlen(test_dev->kbuf))!=0)
+	size_t hdr=rec_ts ? sizeof(struct rec_lat_ts) : 0;
+	struct rec_lat_ts ts;
+	unsigned int copied;
+	u64 t0;
+	int ret;
+
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		if(!kfifo_is_empty(&test_dev->fifo))
+			break;
+		mutex_unlock(&test_dev->lock);
+
+		// 等待直到队列中有记录，被唤醒后重新加锁检查，记录可能已经被其他读进程取走
+		if(rec_read_wait(&read_wq,&test_dev->fifo,&test_dev->lat,excl_wake))
+			return -ERESTARTSYS;
+	}
+
+	// 用户缓冲区放不下下一条记录时返回错误，记录留在队列中
+	if(size<hdr+kfifo_peek_len(&test_dev->fifo)){
+		mutex_unlock(&test_dev->lock);
+		rec_read_pass_on(&read_wq,&test_dev->fifo,excl_wake);
+		return -EMSGSIZE;
+	}
+
+	// 时间戳模式下先把时间戳复制到记录前面，复制失败时记录还留在队列中
+	if(hdr){
+		ts.write_ns=rec_lat_peek(&test_dev->stamps);
+		ts.read_ns=ktime_get_ns();
+		if(copy_to_user(buf,&ts,hdr)){
+			mutex_unlock(&test_dev->lock);
+			rec_read_pass_on(&read_wq,&test_dev->fifo,excl_wake);
+			return -EFAULT;
+		}
+	}
+
+	// 取出一条记录复制到用户空间
+	t0=ktime_get_ns();
+	ret=kfifo_to_user(&test_dev->fifo,buf+hdr,size-hdr,&copied);
+	if(ret==0){
+		rec_lat_copied(&test_dev->lat,t0);
+		rec_lat_dequeue(&test_dev->lat,&test_dev->stamps,&ts.write_ns);
+	}
+	mutex_unlock(&test_dev->lock);
+	rec_read_pass_on(&read_wq,&test_dev->fifo,excl_wake);
+	if(ret<0)
 	{
 		printk("copy_to_user error\n");
-		return -1;
+		return ret;
 	}
-	return 0;
+	copied+=hdr;
+
+	// 唤醒等待空间的写进程
+	wake_up_interruptible(&write_wq);
+	return copied;
 }
 
-/* 写设备函数 */
+/* 写设备函数：把一次写入的数据作为一条记录追加到队列末尾，返回写入的长度 */
 static ssize_t cdev_test_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
 {
 	struct device_test *test_dev=(struct device_test *)file->private_data;
+	unsigned int copied;
 	int ret;
-	// 将用户空间数据复制到内核空间
-	ret=copy_from_user(test_dev->kbuf,buf,size);
 
-	if(ret!=0)
+	if(size==0)
+		return 0;
+	if(size>MSG_MAX)
+		return -EMSGSIZE;
+
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		// kfifo_avail 已经减去了记录头的2个字节
+		if(kfifo_avail(&test_dev->fifo)>=size)
+			break;
+		mutex_unlock(&test_dev->lock);
+
+		// 等待读进程取走记录，腾出空间
+		if(wait_event_interruptible(write_wq,kfifo_avail(&test_dev->fifo)>=size))
+			return -ERESTARTSYS;
+	}
+
+	// 将用户空间数据作为一条记录复制到队列中
+	ret=kfifo_from_user(&test_dev->fifo,buf,size,&copied);
+	if(ret==0)
+		rec_lat_enqueue(&test_dev->stamps);
+	mutex_unlock(&test_dev->lock);
+	if(ret<0)
 	{
 		printk("copy_from_user is error\n");
-		return -1;
+		return ret;
 	}
 
-	test_dev->flag=1;
 	// 唤醒等待队列中的进程
+	rec_lat_wake(&test_dev->lat);
 	wake_up_interruptible(&read_wq);
-	return 0;
+	return copied;
 }
 
 /* 关闭设备函数 */
@@ -93,9 +182,22 @@ struct file_operations cdev_test_fops={
 static int __init chr_fops_init(void)
 {
 	int ret;
+
+	// 分配记录队列
+	ret=kfifo_alloc(&dev1.fifo,FIFO_SIZE,GFP_KERNEL);
+	if(ret<0)
+		return ret;
+	mutex_init(&dev1.lock);
+	ret=rec_stamps_alloc(&dev1.stamps);
+	if(ret<0)
+		goto err_chrdev;
+	ret=rec_lat_init(&dev1.lat,KBUILD_MODNAME);
+	if(ret<0)
+		goto err_chrdev;
 	
 	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
@@ -145,6 +247,9 @@ static int __init chr_fops_init(void)
 		unregister_chrdev_region(dev1.dev_num,1);
 
 	err_chrdev:
+		kfifo_free(&dev1.fifo);
+		rec_stamps_free(&dev1.stamps);
+		rec_lat_exit(&dev1.lat);
 		return ret;
 }
 
@@ -156,6 +261,9 @@ static void __exit chr_fops_exit(void)
 	class_destroy(dev1.class);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	kfifo_free(&dev1.fifo);
+	rec_stamps_free(&dev1.stamps);
+	rec_lat_exit(&dev1.lat);
 	printk("module exit\n");
 }
 
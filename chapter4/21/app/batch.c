@@ -0,0 +1,99 @@
+/*
+ * 这是一个测试程序，用于测试驱动的批量读写模式
+ * 驱动需要以 batch_mode=1 加载（或者 echo 1 > /sys/module/wq/parameters/batch_mode）
+ * 每次 write 写入 per_call 条 [2字节长度][数据] 格式的记录，再用一次 read 全部取出，
+ * 统计系统调用次数和每秒处理的记录数，per_call=1 时相当于每条记录两次系统调用
+ * 使用方法：./batch [记录总数] [每次系统调用的记录数]
+ *   ./batch 100000 1
+ *   ./batch 100000 64
+ */
+
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<string.h>
+#include<time.h>
+
+#define REC_HDR 2  // 每条记录前面的长度字段
+
+int main(int argc,char *argv[])
+{
+	int fd;                  // 文件描述符
+	char wbuf[4096];         // 写缓冲区
+	char rbuf[4096];         // 读缓冲区
+	char rec[260];           // 取出的一条记录
+	int total=100000;        // 记录总数
+	int per_call=64;         // 每次 write 的记录数
+	int sent=0,received=0;   // 已经写入、读出的记录数
+	long calls=0;            // 系统调用次数
+	struct timespec t0,t1;
+	double secs;
+	uint16_t len;
+	int off,n,ret,i;
+
+	if(argc>1)
+		total=atoi(argv[1]);
+	if(argc>2)
+		per_call=atoi(argv[2]);
+	if(total<=0 || per_call<=0 || per_call*(REC_HDR+16)>(int)sizeof(wbuf)){
+		printf("usage: %s [records] [records_per_call(<=%d)]\n",argv[0],(int)sizeof(wbuf)/(REC_HDR+16));
+		return -1;
+	}
+
+	// 打开设备节点
+	fd=open("/dev/test",O_RDWR);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	while(sent<total){
+		// 组装一批记录
+		off=0;
+		for(i=0;i<per_call && sent+i<total;i++){
+			n=sprintf(wbuf+off+REC_HDR,"rec %d",sent+i);
+			len=n;
+			memcpy(wbuf+off,&len,REC_HDR);
+			off+=REC_HDR+n;
+		}
+		ret=write(fd,wbuf,off);
+		calls++;
+		if(ret!=off){
+			printf("short write %d of %d\n",ret,off);
+			break;
+		}
+		sent+=i;
+
+		// 读出这一批记录，检查顺序
+		while(received<sent){
+			ret=read(fd,rbuf,sizeof(rbuf));
+			calls++;
+			if(ret<=0){
+				perror("read error");
+				goto out;
+			}
+			for(off=0;off+REC_HDR<=ret;off+=REC_HDR+len){
+				memcpy(&len,rbuf+off,REC_HDR);
+				memcpy(rec,rbuf+off+REC_HDR,len);
+				rec[len]='\0';
+				if(atoi(rec+4)!=received)
+					printf("record %d out of order\n",received);
+				received++;
+			}
+		}
+	}
+out:
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	secs=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+	printf("records=%d per_call=%d syscalls=%ld (%.3f per record) time=%.3fs rate=%.0f records/s\n",
+		received,per_call,calls,received ? (double)calls/received : 0.0,secs,secs>0 ? received/secs : 0.0);
+
+	// 关闭设备
+	close(fd);
+	return 0;
+}
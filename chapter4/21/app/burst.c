@@ -0,0 +1,66 @@
+/*
+ * 这是一个测试程序，用于测试驱动的记录队列
+ * 以非阻塞方式连续写入多条长度不同的记录，直到队列满返回EAGAIN，
+ * 然后按顺序读出所有记录，检查有没有丢失或乱序
+ * 使用方法：./burst [记录条数]
+ */
+
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+
+int main(int argc,char *argv[])
+{
+	int fd;              // 文件描述符
+	char buf[256];       // 读写缓冲区
+	int count=1000;      // 要写入的记录条数
+	int written=0;       // 成功写入的记录条数
+	int bad=0;           // 内容不对的记录条数
+	int len;
+	int i;
+
+	if(argc>1)
+		count=atoi(argv[1]);
+
+	// 以非阻塞方式打开设备节点
+	fd=open("/dev/test",O_RDWR|O_NONBLOCK);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	// 连续写入记录，每条记录的长度不同
+	for(i=0;i<count;i++){
+		len=sprintf(buf,"msg %d %.*s",i,i%32,"................................");
+		if(write(fd,buf,len)<0){
+			if(errno==EAGAIN)
+				printf("queue full after %d records\n",i);
+			else
+				perror("write error");
+			break;
+		}
+		written++;
+	}
+
+	// 按顺序读出所有记录
+	for(i=0;i<written;i++){
+		len=read(fd,buf,sizeof(buf)-1);
+		if(len<0){
+			perror("read error");
+			break;
+		}
+		buf[len]='\0';
+		if(atoi(buf+4)!=i)
+			bad++;
+	}
+	printf("wrote %d records, read %d records, %d out of order\n",written,i,bad);
+
+	// 关闭设备
+	close(fd);
+	return 0;
+}
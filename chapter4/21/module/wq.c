@@ -13,6 +13,30 @@
 #include<linux/delay.h>
 #include<linux/io.h>
 #include<linux/wait.h>
+#include<linux/kfifo.h>
+#include<linux/mutex.h>
+#include<linux/moduleparam.h>
+#include "rec_lat.h"
+#include "rec_wait.h"
+
+#define FIFO_SIZE 4096  // 记录队列的大小（字节），必须是2的幂
+#define MSG_MAX 256     // 单条记录的最大长度
+#define REC_HDR 2       // 批量模式下每条记录前面的长度字段，u16
+
+// 批量模式：一次 read 取出多条记录，一次 write 写入多条记录，每条记录前面有2字节的长度
+static bool batch_mode;
+module_param(batch_mode,bool,0644);
+MODULE_PARM_DESC(batch_mode,"length-prefixed multi-record read/write");
+
+// 互斥唤醒模式：读进程以互斥方式等待，一条记录只唤醒一个读进程，避免所有读进程一起被唤醒（惊群）
+static bool excl_wake;
+module_param(excl_wake,bool,0644);
+MODULE_PARM_DESC(excl_wake,"wake a single reader per record instead of all of them");
+
+// 时间戳模式：非批量模式下 read 返回的记录前面加上 struct rec_lat_ts，包含记录的写入时间和取出时间
+static bool rec_ts;
+module_param(rec_ts,bool,0644);
+MODULE_PARM_DESC(rec_ts,"prefix each record returned by read with its write/read timestamps");
 
 /* 设备结构体定义 */
 struct device_test{
@@ -22,8 +46,10 @@ struct device_test{
 	struct cdev cdev_test;// 字符设备结构体
 	struct class *class;  // 设备类
 	struct device *device;// 设备结构体
-	char kbuf[32];        // 内核缓冲区
-	int flag;             // 标志位，用于等待队列
+	struct kfifo_rec_ptr_2 fifo;  // 变长记录队列，每条记录前面有2字节的长度
+	struct mutex lock;            // 保护记录队列，复制数据时可能睡眠，所以使用互斥锁
+	struct rec_stamps stamps;     // 每条记录的写入时间，和记录队列同步进出
+	struct rec_lat lat;           // 记录延时统计，在 debugfs 中查看
 };
 
 /* 定义设备实例 */
@@ -31,6 +57,7 @@ struct device_test dev1;
 
 /* 声明等待队列头 */
 DECLARE_WAIT_QUEUE_HEAD(read_wq);
+DECLARE_WAIT_QUEUE_HEAD(write_wq);  // 队列满时写进程在这里等待
 
 /* 打开设备函数 */
 static int cdev_test_open(struct inode *inode,struct file *file)
@@ -39,46 +66,164 @@ static int cdev_test_open(struct inode *inode,struct file *file)
 	return 0;
 }
 
-/* 读设备函数 */
-static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+/* 等待队列中有记录，成功返回0，返回时持有 test_dev->lock */
+static int wait_for_record(struct file *file,struct device_test *test_dev)
 {
-	struct device_test *test_dev=(struct device_test *)file->private_data;
-	// 检查是否为非阻塞模式
-	if(file->f_flags & O_NONBLOCK){
-		if(test_dev->flag !=1)
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		if(!kfifo_is_empty(&test_dev->fifo))
+			return 0;
+		mutex_unlock(&test_dev->lock);
+
+		// 检查是否为非阻塞模式
+		if(file->f_flags & O_NONBLOCK)
 			return -EAGAIN;  // 非阻塞模式下，如果没有数据则返回EAGAIN
+		// 等待直到队列中有记录，被唤醒后重新加锁检查，记录可能已经被其他读进程取走
+		if(rec_read_wait(&read_wq,&test_dev->fifo,&test_dev->lat,excl_wake))
+			return -ERESTARTSYS;
 	}
+}
 
-	// 等待直到flag被设置为1
-	wait_event_interruptible(read_wq,test_dev->flag);
-	// 将内核数据复制到用户空间
-	if(copy_to_user(buf,test_dev->kbuf,strlen(test_dev->kbuf))!=0)
-	{
-		printk("copy_to_user error\n");
-		return -1;
+/* 等待队列中能放下 size 字节的记录，成功返回0，返回时持有 test_dev->lock */
+static int wait_for_space(struct file *file,struct device_test *test_dev,size_t size)
+{
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		// kfifo_avail 已经减去了记录头的2个字节
+		if(kfifo_avail(&test_dev->fifo)>=size)
+			return 0;
+		mutex_unlock(&test_dev->lock);
+
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;  // 非阻塞模式下，队列满时返回EAGAIN
+		// 等待读进程取走记录，腾出空间
+		if(wait_event_interruptible(write_wq,kfifo_avail(&test_dev->fifo)>=size))
+			return -ERESTARTSYS;
 	}
+}
 
-	return 0;
+/* 读设备函数：取出一条记录，批量模式下取出尽可能多的完整记录，返回复制的字节数 */
+static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+{
+	struct device_test *test_dev=(struct device_test *)file->private_data;
+	size_t hdr=rec_ts ? sizeof(struct rec_lat_ts) : 0;
+	struct rec_lat_ts ts;
+	unsigned int copied;
+	size_t total=0;
+	u16 len;
+	u64 t0;
+	int ret;
+
+	ret=wait_for_record(file,test_dev);
+	if(ret<0)
+		return ret;
+
+	if(!batch_mode){
+		// 用户缓冲区放不下下一条记录时返回错误，记录留在队列中
+		if(size<hdr+kfifo_peek_len(&test_dev->fifo)){
+			ret=-EMSGSIZE;
+		}else{
+			// 取出一条记录复制到用户空间，时间戳模式下前面留出时间戳的位置
+			t0=ktime_get_ns();
+			ret=kfifo_to_user(&test_dev->fifo,buf+hdr,size-hdr,&copied);
+			if(ret==0){
+				rec_lat_copied(&test_dev->lat,t0);
+				ts.read_ns=rec_lat_dequeue(&test_dev->lat,&test_dev->stamps,&ts.write_ns);
+				if(hdr && copy_to_user(buf,&ts,hdr))
+					ret=-EFAULT;
+				else
+					total=hdr+copied;
+			}
+		}
+	}else{
+		// 批量模式：每条记录前面加上2字节的长度，直到缓冲区放不下下一条完整的记录
+		while(!kfifo_is_empty(&test_dev->fifo)){
+			len=kfifo_peek_len(&test_dev->fifo);
+			if(total+REC_HDR+len>size)
+				break;
+			if(copy_to_user(buf+total,&len,REC_HDR)){
+				ret=-EFAULT;
+				break;
+			}
+			t0=ktime_get_ns();
+			ret=kfifo_to_user(&test_dev->fifo,buf+total+REC_HDR,len,&copied);
+			if(ret<0)
+				break;
+			rec_lat_copied(&test_dev->lat,t0);
+			rec_lat_dequeue(&test_dev->lat,&test_dev->stamps,&ts.write_ns);
+			total+=REC_HDR+copied;
+		}
+		if(total==0 && ret==0)
+			ret=-EMSGSIZE;  // 第一条记录就放不下
+	}
+	mutex_unlock(&test_dev->lock);
+	rec_read_pass_on(&read_wq,&test_dev->fifo,excl_wake);
+
+	if(total==0)
+		return ret;
+	// 唤醒等待空间的写进程
+	wake_up_interruptible(&write_wq);
+	return total;
 }
 
-/* 写设备函数 */
+/* 写设备函数：把数据作为一条记录追加到队列末尾，批量模式下一次写入多条记录，返回写入的字节数 */
 static ssize_t cdev_test_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
 {
 	struct device_test *test_dev=(struct device_test *)file->private_data;
+	unsigned int copied;
+	size_t total=0;
+	u16 len;
 	int ret;
-	// 将用户空间数据复制到内核空间
-	ret=copy_from_user(test_dev->kbuf,buf,size);
 
-	if(ret!=0)
-	{
-		printk("copy_from_user is error\n");
-		return -1;
+	if(!batch_mode){
+		if(size==0)
+			return 0;
+		if(size>MSG_MAX)
+			return -EMSGSIZE;
+		ret=wait_for_space(file,test_dev,size);
+		if(ret<0)
+			return ret;
+		// 将用户空间数据作为一条记录复制到队列中
+		ret=kfifo_from_user(&test_dev->fifo,buf,size,&copied);
+		if(ret==0){
+			rec_lat_enqueue(&test_dev->stamps);
+			total=copied;
+		}
+	}else{
+		// 批量模式：buf 中是连续的 [2字节长度][数据] 格式的记录，至少要能放下第一条
+		if(size<REC_HDR)
+			return -EINVAL;
+		if(copy_from_user(&len,buf,REC_HDR))
+			return -EFAULT;
+		if(len==0 || len>MSG_MAX || REC_HDR+len>size)
+			return -EINVAL;
+		ret=wait_for_space(file,test_dev,len);
+		if(ret<0)
+			return ret;
+		while(1){
+			ret=kfifo_from_user(&test_dev->fifo,buf+total+REC_HDR,len,&copied);
+			if(ret<0)
+				break;
+			rec_lat_enqueue(&test_dev->stamps);
+			total+=REC_HDR+len;
+			// 取下一条记录的长度，不完整的记录和队列放不下的记录留给下一次 write
+			if(total+REC_HDR>size || copy_from_user(&len,buf+total,REC_HDR))
+				break;
+			if(len==0 || len>MSG_MAX || total+REC_HDR+len>size || kfifo_avail(&test_dev->fifo)<len)
+				break;
+		}
 	}
+	mutex_unlock(&test_dev->lock);
+
+	if(total==0)
+		return ret;
 
-	test_dev->flag=1;
 	// 唤醒等待队列中的进程
+	rec_lat_wake(&test_dev->lat);
 	wake_up_interruptible(&read_wq);
-	return 0;
+	return total;
 }
 
 /* 关闭设备函数 */
@@ -100,9 +245,22 @@ struct file_operations cdev_test_fops={
 static int __init chr_fops_init(void)
 {
 	int ret;
+
+	// 分配记录队列
+	ret=kfifo_alloc(&dev1.fifo,FIFO_SIZE,GFP_KERNEL);
+	if(ret<0)
+		return ret;
+	mutex_init(&dev1.lock);
+	ret=rec_stamps_alloc(&dev1.stamps);
+	if(ret<0)
+		goto err_chrdev;
+	ret=rec_lat_init(&dev1.lat,KBUILD_MODNAME);
+	if(ret<0)
+		goto err_chrdev;
 	
 	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
@@ -152,6 +310,9 @@ static int __init chr_fops_init(void)
 		unregister_chrdev_region(dev1.dev_num,1);
 
 	err_chrdev:
+		kfifo_free(&dev1.fifo);
+		rec_stamps_free(&dev1.stamps);
+		rec_lat_exit(&dev1.lat);
 		return ret;
 }
 
@@ -163,6 +324,9 @@ static void __exit chr_fops_exit(void)
 	class_destroy(dev1.class);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	kfifo_free(&dev1.fifo);
+	rec_stamps_free(&dev1.stamps);
+	rec_lat_exit(&dev1.lat);
 	printk("module exit\n");
 }
 
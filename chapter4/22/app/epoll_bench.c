@@ -0,0 +1,133 @@
+/*
+ * 这是一个 epoll 扩展性测试程序，驱动需要以 nr_channels=N 加载，创建 /dev/test0 ~ /dev/testN-1
+ * 用 epoll 同时监视 N 个通道，写线程只往其中 active 个通道轮流写入记录，
+ * 主线程在 epoll_wait 返回后读出记录，统计每秒处理的事件数和每次 epoll_wait 的平均耗时
+ * 每个通道有自己的等待队列，写入只唤醒对应通道的 epoll 回调，
+ * 所以在 active 不变时，N 从 16 增加到 4096 吞吐量应该基本不变
+ * 使用方法：
+ *   insmod poll.ko nr_channels=4096
+ *   ./epoll_bench 16 4 200000
+ *   ./epoll_bench 4096 4 200000
+ */
+
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/epoll.h>
+#include<sys/resource.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<pthread.h>
+#include<sched.h>
+#include<time.h>
+
+static int *fds;          // 每个通道的文件描述符
+static int channels=1024; // 监视的通道数
+static int active=4;      // 有数据写入的通道数
+static int count=200000;  // 写入的记录总数
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+/* 写线程：在 active 个通道上轮流写入，active 个通道均匀分布在所有通道中 */
+static void *writer_thread(void *arg)
+{
+	char buf[32]="event";
+	int stride=channels/active;
+	int i,ch;
+
+	for(i=0;i<count;i++){
+		ch=(i%active)*stride;
+		// 通道的队列满了就让出CPU，等主线程读走
+		while(write(fds[ch],buf,sizeof(buf))<0){
+			if(errno!=EAGAIN){
+				perror("write error");
+				return NULL;
+			}
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+	struct epoll_event ev,*events;
+	struct rlimit rl;
+	pthread_t tid;
+	char path[32];
+	char buf[256];
+	uint64_t t0,t1,wait_ns=0;
+	long waits=0,received=0;
+	int epfd,n,i;
+
+	if(argc>1)
+		channels=atoi(argv[1]);
+	if(argc>2)
+		active=atoi(argv[2]);
+	if(argc>3)
+		count=atoi(argv[3]);
+	if(channels<=0 || active<=0 || active>channels || count<=0){
+		printf("usage: %s [channels] [active] [records]\n",argv[0]);
+		return -1;
+	}
+
+	// 打开的文件数超过默认限制时先提高限制
+	rl.rlim_cur=rl.rlim_max=channels+64;
+	setrlimit(RLIMIT_NOFILE,&rl);
+
+	fds=calloc(channels,sizeof(int));
+	events=calloc(channels,sizeof(*events));
+	epfd=epoll_create1(0);
+	if(fds==NULL || events==NULL || epfd<0){
+		printf("init error\n");
+		return -1;
+	}
+
+	// 打开所有通道并加入 epoll
+	for(i=0;i<channels;i++){
+		sprintf(path,"/dev/test%d",i);
+		fds[i]=open(path,O_RDWR|O_NONBLOCK);
+		if(fds[i]<0){
+			printf("open %s error\n",path);
+			return -1;
+		}
+		ev.events=EPOLLIN;
+		ev.data.u32=i;
+		epoll_ctl(epfd,EPOLL_CTL_ADD,fds[i],&ev);
+	}
+
+	t0=now_ns();
+	pthread_create(&tid,NULL,writer_thread,NULL);
+	while(received<count){
+		t1=now_ns();
+		n=epoll_wait(epfd,events,channels,1000);
+		wait_ns+=now_ns()-t1;
+		waits++;
+		for(i=0;i<n;i++){
+			// 读空这个通道
+			while(read(fds[events[i].data.u32],buf,sizeof(buf))>0)
+				received++;
+		}
+	}
+	pthread_join(tid,NULL);
+	t1=now_ns();
+
+	printf("channels=%d active=%d records=%ld time=%.3fs rate=%.0f records/s epoll_wait=%ld avg %.0f ns\n",
+		channels,active,received,(t1-t0)/1e9,received/((t1-t0)/1e9),waits,(double)wait_ns/waits);
+
+	for(i=0;i<channels;i++)
+		close(fds[i]);
+	close(epfd);
+	free(fds);
+	free(events);
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * 这是一个吞吐量测试程序，比较 read() 和 mmap 共享环形缓冲区两种取数据的方式
+ * 写线程通过 write() 连续写入记录，读线程分别用两种方式取出记录：
+ *   read：驱动正常加载，每条记录一次 read 系统调用，数据经过 copy_to_user
+ *   mmap：驱动以 ring_mode=1 加载，直接从映射的环形缓冲区中取数据，
+ *         只有缓冲区为空时才调用 poll 等待
+ * 使用方法：
+ *   insmod poll.ko             && ./ring_bench read 1000000 64
+ *   insmod poll.ko ring_mode=1 && ./ring_bench mmap 1000000 64
+ */
+
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<string.h>
+#include<poll.h>
+#include<pthread.h>
+#include<time.h>
+
+#define RING_PAGES 16           // 数据区的页数
+#define RING_HDR 4              // 每条记录前面的长度字段
+#define RING_PAD 0xffffffffu    // 填充标记，跳到数据区开头
+
+/* 控制页，需要与内核模块中的定义保持一致 */
+struct ring_ctrl{
+	uint32_t size;
+	uint32_t rsv0[15];
+	uint32_t head;
+	uint32_t rsv1[15];
+	uint32_t tail;
+};
+
+static int fd;
+static int count=1000000;   // 记录条数
+static int rec_size=64;     // 每条记录的长度
+
+/* 写线程：连续写入记录，记录的前4个字节是序号 */
+static void *writer_thread(void *arg)
+{
+	char buf[256]={0};
+	int i;
+
+	for(i=0;i<count;i++){
+		memcpy(buf,&i,sizeof(i));
+		if(write(fd,buf,rec_size)!=rec_size){
+			perror("write error");
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* 用 read 取出所有记录 */
+static long consume_read(long *bad)
+{
+	char buf[256];
+	long calls=0;
+	int i,seq;
+
+	for(i=0;i<count;i++){
+		if(read(fd,buf,sizeof(buf))!=rec_size){
+			perror("read error");
+			break;
+		}
+		calls++;
+		memcpy(&seq,buf,sizeof(seq));
+		if(seq!=i)
+			(*bad)++;
+	}
+	return calls;
+}
+
+/* 直接从共享环形缓冲区中取出所有记录 */
+static long consume_mmap(long *bad)
+{
+	struct ring_ctrl *ctrl;
+	struct pollfd pfd;
+	char *map,*data;
+	uint32_t head,tail,mask,len,off;
+	long calls=0;
+	long map_len;
+	int i=0,seq;
+
+	// 映射控制页和整个数据区
+	map_len=(long)(1+RING_PAGES)*getpagesize();
+	map=mmap(NULL,map_len,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	if(map==MAP_FAILED){
+		perror("mmap error");
+		return 0;
+	}
+	ctrl=(struct ring_ctrl *)map;
+	data=map+getpagesize();
+	mask=ctrl->size-1;
+
+	pfd.fd=fd;
+	pfd.events=POLLIN;
+	tail=ctrl->tail;
+	while(i<count){
+		head=__atomic_load_n(&ctrl->head,__ATOMIC_ACQUIRE);
+		if(head==tail){
+			// 缓冲区为空，等待驱动写入
+			poll(&pfd,1,-1);
+			calls++;
+			continue;
+		}
+		while(tail!=head){
+			off=tail & mask;
+			memcpy(&len,data+off,RING_HDR);
+			if(len==RING_PAD){
+				tail+=ctrl->size-off;
+				continue;
+			}
+			memcpy(&seq,data+off+RING_HDR,sizeof(seq));
+			if(seq!=i)
+				(*bad)++;
+			i++;
+			tail+=(RING_HDR+len+3)&~3u;
+		}
+		// 取完一批记录后才更新 tail，驱动看到 tail 后才会覆盖这些记录
+		__atomic_store_n(&ctrl->tail,tail,__ATOMIC_RELEASE);
+	}
+	munmap(map,map_len);
+	return calls;
+}
+
+int main(int argc,char *argv[])
+{
+	struct timespec t0,t1;
+	pthread_t tid;
+	long calls,bad=0;
+	double secs;
+	int use_mmap;
+
+	if(argc<2 || (strcmp(argv[1],"read")!=0 && strcmp(argv[1],"mmap")!=0)){
+		printf("usage: %s read|mmap [records] [record_size(4~256)]\n",argv[0]);
+		return -1;
+	}
+	use_mmap=strcmp(argv[1],"mmap")==0;
+	if(argc>2)
+		count=atoi(argv[2]);
+	if(argc>3)
+		rec_size=atoi(argv[3]);
+	if(count<=0 || rec_size<4 || rec_size>256){
+		printf("bad arguments\n");
+		return -1;
+	}
+
+	// 打开设备节点
+	fd=open("/dev/test",O_RDWR);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	pthread_create(&tid,NULL,writer_thread,NULL);
+	calls=use_mmap ? consume_mmap(&bad) : consume_read(&bad);
+	pthread_join(tid,NULL);
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+
+	secs=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+	printf("%s: records=%d size=%d time=%.3fs rate=%.0f records/s %.1f MB/s consumer syscalls=%ld bad=%ld\n",
+		argv[1],count,rec_size,secs,count/secs,(double)count*rec_size/secs/1e6,calls,bad);
+
+	// 关闭设备
+	close(fd);
+	return 0;
+}
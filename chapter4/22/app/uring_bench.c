@@ -0,0 +1,245 @@
+/*
+ * 这是一个吞吐量测试程序，比较阻塞 read()、preadv2(RWF_NOWAIT) 和 io_uring 三种取数据的方式
+ * 写线程通过 write() 连续写入记录，读线程分别用三种方式取出记录：
+ *   read：每条记录一次 read 系统调用，队列为空时在驱动的等待队列中睡眠
+ *   nowait：用 preadv2(RWF_NOWAIT) 读，驱动的 read_iter 在 IOCB_NOWAIT 下返回 EAGAIN 后再用 poll 等待数据，
+ *           4.19 内核上也能用
+ *   uring：同时挂着 depth 个读请求，一次 io_uring_enter 提交新请求并收取已完成的请求，
+ *          驱动的 read_iter 在 IOCB_NOWAIT 下返回 EAGAIN 后，io_uring 通过驱动的 poll 等待数据（fast poll），
+ *          io_uring 从 5.1 内核开始才有，开发板的 4.19 内核上 io_uring_queue_init 会返回 ENOSYS
+ * 编译：aarch64-linux-gnu-gcc uring_bench.c -o uring_bench -luring -lpthread
+ * 使用方法：
+ *   ./uring_bench read 1000000 64
+ *   ./uring_bench nowait 1000000 64
+ *   ./uring_bench uring 1000000 64 32
+ */
+
+#define _GNU_SOURCE  // preadv2 和 RWF_NOWAIT
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<string.h>
+#include<pthread.h>
+#include<time.h>
+#include<poll.h>
+#include<errno.h>
+#include<sys/uio.h>
+#include<liburing.h>
+
+#define BUF_SIZE 256  // 每个读请求的缓冲区大小，驱动中一条记录最长256字节
+
+static int fd;
+static int count=1000000;   // 记录条数
+static int rec_size=64;     // 每条记录的长度
+static int depth=32;        // io_uring 同时挂着的读请求数
+
+/* 写线程：连续写入记录，记录的前4个字节是序号 */
+static void *writer_thread(void *arg)
+{
+	char buf[BUF_SIZE]={0};
+	int i;
+
+	for(i=0;i<count;i++){
+		memcpy(buf,&i,sizeof(i));
+		if(write(fd,buf,rec_size)!=rec_size){
+			perror("write error");
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* 检查记录的序号，多个读请求同时挂着时完成的顺序不固定，所以只检查有没有重复或者越界 */
+static void check_record(char *buf,char *seen,long *bad)
+{
+	int seq;
+
+	memcpy(&seq,buf,sizeof(seq));
+	if(seq<0 || seq>=count || seen[seq])
+		(*bad)++;
+	else
+		seen[seq]=1;
+}
+
+/* 用阻塞 read 取出所有记录 */
+static long consume_read(char *seen,long *bad)
+{
+	char buf[BUF_SIZE];
+	long calls=0;
+	int i;
+
+	for(i=0;i<count;i++){
+		if(read(fd,buf,sizeof(buf))!=rec_size){
+			perror("read error");
+			break;
+		}
+		calls++;
+		check_record(buf,seen,bad);
+	}
+	return calls;
+}
+
+/* 用 preadv2(RWF_NOWAIT) 取出所有记录，队列为空时用 poll 等待，poll 也计入系统调用次数 */
+static long consume_nowait(char *seen,long *bad)
+{
+	char buf[BUF_SIZE];
+	struct iovec iov={.iov_base=buf,.iov_len=sizeof(buf)};
+	struct pollfd pfd={.fd=fd,.events=POLLIN};
+	long calls=0;
+	ssize_t ret;
+	int i=0;
+
+	while(i<count){
+		ret=preadv2(fd,&iov,1,-1,RWF_NOWAIT);
+		calls++;
+		if(ret<0 && errno==EAGAIN){
+			if(poll(&pfd,1,-1)<0){
+				perror("poll error");
+				break;
+			}
+			calls++;
+			continue;
+		}
+		if(ret!=rec_size){
+			perror("preadv2 error");
+			break;
+		}
+		check_record(buf,seen,bad);
+		i++;
+	}
+	return calls;
+}
+
+/* 准备一个读请求，user_data 是缓冲区的编号 */
+static void queue_read(struct io_uring *ring,char (*bufs)[BUF_SIZE],int index)
+{
+	struct io_uring_sqe *sqe=io_uring_get_sqe(ring);
+
+	io_uring_prep_read(sqe,fd,bufs[index],BUF_SIZE,0);
+	io_uring_sqe_set_data(sqe,(void *)(long)index);
+}
+
+/* 用 io_uring 取出所有记录 */
+static long consume_uring(char *seen,long *bad)
+{
+	struct io_uring ring;
+	struct io_uring_cqe *cqe;
+	char (*bufs)[BUF_SIZE];
+	unsigned head,n;
+	long calls=0;
+	int done=0,inflight=0,err=0;
+	int i;
+
+	if(io_uring_queue_init(depth,&ring,0)<0){
+		printf("io_uring_queue_init error\n");
+		return 0;
+	}
+	bufs=malloc((size_t)depth*BUF_SIZE);
+	if(bufs==NULL){
+		printf("malloc error\n");
+		io_uring_queue_exit(&ring);
+		return 0;
+	}
+
+	// 先准备 depth 个读请求，每个请求使用自己的缓冲区
+	for(i=0;i<depth && i<count;i++)
+		queue_read(&ring,bufs,i);
+	inflight=i;
+
+	while(done<count && !err){
+		// 一次系统调用提交所有新请求，并等待至少一个请求完成
+		if(io_uring_submit_and_wait(&ring,1)<0){
+			perror("io_uring_submit_and_wait error");
+			break;
+		}
+		calls++;
+
+		// 收取所有已经完成的请求，把缓冲区重新提交，留到下一次 io_uring_submit_and_wait
+		n=0;
+		io_uring_for_each_cqe(&ring,head,cqe){
+			n++;
+			inflight--;
+			i=(int)(long)io_uring_cqe_get_data(cqe);
+			if(cqe->res!=rec_size){
+				printf("read error: %s\n",cqe->res<0 ? strerror(-cqe->res) : "short read");
+				err=1;
+				break;
+			}
+			check_record(bufs[i],seen,bad);
+			done++;
+			// 挂着的请求不超过剩下的记录数，否则最后几个请求永远等不到数据
+			if(done+inflight<count){
+				queue_read(&ring,bufs,i);
+				inflight++;
+			}
+		}
+		io_uring_cq_advance(&ring,n);
+	}
+
+	free(bufs);
+	io_uring_queue_exit(&ring);
+	return calls;
+}
+
+int main(int argc,char *argv[])
+{
+	struct timespec t0,t1;
+	pthread_t tid;
+	long calls,bad=0;
+	char *seen;
+	double secs;
+	int use_uring;
+
+	if(argc<2 || (strcmp(argv[1],"read")!=0 && strcmp(argv[1],"nowait")!=0 && strcmp(argv[1],"uring")!=0)){
+		printf("usage: %s read|nowait|uring [records] [record_size(4~256)] [depth]\n",argv[0]);
+		return -1;
+	}
+	use_uring=strcmp(argv[1],"uring")==0;
+	if(argc>2)
+		count=atoi(argv[2]);
+	if(argc>3)
+		rec_size=atoi(argv[3]);
+	if(argc>4)
+		depth=atoi(argv[4]);
+	if(count<=0 || rec_size<4 || rec_size>BUF_SIZE || depth<=0){
+		printf("bad arguments\n");
+		return -1;
+	}
+
+	seen=calloc(count,1);
+	if(seen==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+
+	// 打开设备节点
+	fd=open("/dev/test",O_RDWR);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	pthread_create(&tid,NULL,writer_thread,NULL);
+	if(use_uring)
+		calls=consume_uring(seen,&bad);
+	else if(strcmp(argv[1],"nowait")==0)
+		calls=consume_nowait(seen,&bad);
+	else
+		calls=consume_read(seen,&bad);
+	pthread_join(tid,NULL);
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+
+	secs=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+	printf("%s: records=%d size=%d depth=%d time=%.3fs rate=%.0f records/s consumer syscalls=%ld (%.2f per record) bad=%ld\n",
+		argv[1],count,rec_size,use_uring ? depth : 1,secs,count/secs,calls,(double)calls/count,bad);
+
+	// 关闭设备
+	close(fd);
+	free(seen);
+	return 0;
+}
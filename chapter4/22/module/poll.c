@@ -14,6 +14,81 @@
 #include<linux/io.h>
 #include<linux/wait.h>
 #include<linux/poll.h>
+#include<linux/kfifo.h>
+#include<linux/mutex.h>
+#include<linux/moduleparam.h>
+#include<linux/mm.h>
+#include<linux/vmalloc.h>
+#include<linux/uio.h>
+#include "rec_lat.h"
+#include "rec_wait.h"
+
+#define FIFO_SIZE 4096  // 记录队列的大小（字节），必须是2的幂
+#define MSG_MAX 256     // 单条记录的最大长度
+#define REC_HDR 2       // 批量模式下每条记录前面的长度字段，u16
+
+// 批量模式：一次 read 取出多条记录，一次 write 写入多条记录，每条记录前面有2字节的长度
+static bool batch_mode;
+module_param(batch_mode,bool,0644);
+MODULE_PARM_DESC(batch_mode,"length-prefixed multi-record read/write");
+
+// 互斥唤醒模式：读进程以互斥方式等待，一条记录只唤醒一个读进程，避免所有读进程一起被唤醒（惊群）
+static bool excl_wake;
+module_param(excl_wake,bool,0644);
+MODULE_PARM_DESC(excl_wake,"wake a single reader per record instead of all of them");
+
+// 时间戳模式：非批量模式下 read 返回的记录前面加上 struct rec_lat_ts，包含记录的写入时间和取出时间
+static bool rec_ts;
+module_param(rec_ts,bool,0644);
+MODULE_PARM_DESC(rec_ts,"prefix each record returned by read with its write/read timestamps");
+
+// 共享环形缓冲区模式：write 把记录放进可以 mmap 的环形缓冲区，用户空间直接从映射中取数据，
+// 不需要 read 系统调用和 copy_to_user。驱动是唯一的生产者，用户空间是唯一的消费者
+static bool ring_mode;
+module_param(ring_mode,bool,0444);
+MODULE_PARM_DESC(ring_mode,"single-producer/single-consumer ring exposed through mmap");
+
+#define RING_PAGES 16              // 数据区的页数，必须是2的幂
+#define RING_SIZE (RING_PAGES*PAGE_SIZE)
+#define RING_HDR 4                 // 每条记录前面的长度字段，u32
+#define RING_PAD 0xffffffff        // 数据区末尾放不下一条记录时写入的填充标记，消费者跳到数据区开头
+
+/*
+ * 控制页，映射的第一页，后面是 RING_PAGES 页数据区
+ * head 只由驱动修改，tail 只由用户空间修改，两者都是不回绕的字节计数，
+ * 放在不同的缓存行上避免生产者和消费者互相干扰
+ * 每条记录为 [u32 长度][数据]，按4字节对齐，不会跨过数据区末尾
+ */
+struct ring_ctrl{
+	__u32 size;        // 数据区大小
+	__u32 rsv0[15];
+	__u32 head;        // 生产者写到的位置，用 release 语义更新
+	__u32 rsv1[15];
+	__u32 tail;        // 消费者读到的位置，用 release 语义更新
+};
+
+// 通道数：每个通道是一个次设备号，有自己的记录队列、等待队列和 poll 状态，
+// 一个通道上的写入只唤醒这个通道的等待者，epoll 监视大量通道时开销只和活跃的通道数有关
+static int nr_channels=1;
+module_param(nr_channels,int,0444);
+MODULE_PARM_DESC(nr_channels,"number of minors, /dev/test when 1, /dev/test0../dev/testN-1 otherwise");
+
+#define MAX_CHANNELS 4096
+
+/* 通道结构体定义 */
+struct channel_test{
+	int index;                    // 通道编号
+	struct device *device;        // 通道的设备节点
+	struct kfifo_rec_ptr_2 fifo;  // 变长记录队列，每条记录前面有2字节的长度
+	struct mutex lock;            // 保护记录队列，复制数据时可能睡眠，所以使用互斥锁
+	wait_queue_head_t read_wq;    // 队列空时读进程在这里等待
+	wait_queue_head_t write_wq;   // 队列满时写进程在这里等待
+	struct rec_stamps stamps;     // 每条记录的写入时间，和记录队列同步进出，第一次打开时分配
+	void *ring;                   // 共享环形缓冲区：控制页 + 数据区，ring_mode 下第一次打开时分配
+	struct ring_ctrl *ctrl;       // 控制页
+	u32 head;                     // 生产者位置，只在这里维护，控制页中的 head 只是发布给用户空间的副本
+	char *ring_data;              // 数据区
+};
 
 /* 设备结构体定义 */
 struct device_test{
@@ -22,65 +97,329 @@ struct device_test{
 	int minor;            // 次设备号
 	struct cdev cdev_test;// 字符设备结构体
 	struct class *class;  // 设备类
-	struct device *device;// 设备结构体
-	char kbuf[32];        // 内核缓冲区
-	int flag;             // 标志位，用于等待队列
+	struct channel_test *chan;  // 通道数组
+	struct rec_lat lat;         // 所有通道合在一起的记录延时统计，在 debugfs 中查看
 };
 
 /* 定义设备实例 */
 struct device_test dev1;
 
-/* 声明等待队列头 */
-DECLARE_WAIT_QUEUE_HEAD(read_wq);
-
-/* 打开设备函数 */
+/* 打开设备函数：按次设备号找到通道 */
 static int cdev_test_open(struct inode *inode,struct file *file)
 {
-	file->private_data=&dev1;
+	struct channel_test *chan=&dev1.chan[iminor(inode)-dev1.minor];
+	void *ring;
+	int ret=0;
+
+	// 第一次打开通道时分配时间戳队列，通道很多时只有用到的通道占用内存
+	if(!kfifo_initialized(&chan->stamps.fifo)){
+		mutex_lock(&chan->lock);
+		if(!kfifo_initialized(&chan->stamps.fifo))
+			ret=rec_stamps_alloc(&chan->stamps);
+		mutex_unlock(&chan->lock);
+		if(ret<0)
+			return ret;
+	}
+
+	// ring_mode 下第一次打开通道时分配共享环形缓冲区，vmalloc_user 分配的内存已经清零
+	if(ring_mode && READ_ONCE(chan->ring)==NULL){
+		ring=vmalloc_user(PAGE_SIZE+RING_SIZE);
+		if(ring==NULL)
+			return -ENOMEM;
+		mutex_lock(&chan->lock);
+		if(chan->ring==NULL){
+			chan->ctrl=ring;
+			chan->ring_data=(char *)ring+PAGE_SIZE;
+			chan->ctrl->size=RING_SIZE;
+			chan->head=0;
+			smp_store_release(&chan->ring,ring);
+			ring=NULL;
+		}
+		mutex_unlock(&chan->lock);
+		vfree(ring);  // 其他进程已经分配过了
+	}
+	file->private_data=chan;
+	// read_iter/write_iter 能处理 IOCB_NOWAIT，io_uring 可以先以非阻塞方式尝试，返回 EAGAIN 后再用 poll 等待
+	file->f_mode|=FMODE_NOWAIT;
 	return 0;
 }
 
-/* 读设备函数 */
-static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+/*
+ * 这次读写是否不能睡眠：文件以 O_NONBLOCK 打开，或者请求带有 IOCB_NOWAIT，
+ * io_uring 第一次尝试和 preadv2/pwritev2(RWF_NOWAIT) 会设置 IOCB_NOWAIT，这时连互斥锁也不能等
+ */
+static bool io_nowait(struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/* 加通道的互斥锁，不能睡眠时只尝试一次 */
+static int chan_lock(struct channel_test *chan,bool nowait)
 {
-	struct device_test *test_dev=(struct device_test *)file->private_data;
-	// 检查是否为非阻塞模式
-	if(file->f_flags & O_NONBLOCK){
-		if(test_dev->flag !=1)
+	if(nowait)
+		return mutex_trylock(&chan->lock) ? 0 : -EAGAIN;
+	return mutex_lock_interruptible(&chan->lock) ? -ERESTARTSYS : 0;
+}
+
+/* 等待队列中有记录，成功返回0，返回时持有 chan->lock */
+static int wait_for_record(struct channel_test *chan,bool nowait)
+{
+	int ret;
+
+	while(1){
+		ret=chan_lock(chan,nowait);
+		if(ret<0)
+			return ret;
+		if(!kfifo_is_empty(&chan->fifo))
+			return 0;
+		mutex_unlock(&chan->lock);
+
+		// 检查是否为非阻塞模式
+		if(nowait)
 			return -EAGAIN;  // 非阻塞模式下，如果没有数据则返回EAGAIN
+		// 等待直到队列中有记录，被唤醒后重新加锁检查，记录可能已经被其他读进程取走
+		if(rec_read_wait(&chan->read_wq,&chan->fifo,&dev1.lat,excl_wake))
+			return -ERESTARTSYS;
 	}
+}
+
+/* 等待队列中能放下 size 字节的记录，成功返回0，返回时持有 chan->lock */
+static int wait_for_space(struct channel_test *chan,size_t size,bool nowait)
+{
+	int ret;
 
-	// 等待直到flag被设置为1
-	wait_event_interruptible(read_wq,test_dev->flag);
+	while(1){
+		ret=chan_lock(chan,nowait);
+		if(ret<0)
+			return ret;
+		// kfifo_avail 已经减去了记录头的2个字节
+		if(kfifo_avail(&chan->fifo)>=size)
+			return 0;
+		mutex_unlock(&chan->lock);
 
-	// 将内核数据复制到用户空间
-	if(copy_to_user(buf,test_dev->kbuf,strlen(test_dev->kbuf))!=0)
-	{
-		printk("copy_to_user error\n");
-		return -1;
+		if(nowait)
+			return -EAGAIN;  // 非阻塞模式下，队列满时返回EAGAIN
+		// 等待读进程取走记录，腾出空间
+		if(wait_event_interruptible(chan->write_wq,kfifo_avail(&chan->fifo)>=size))
+			return -ERESTARTSYS;
 	}
+}
 
-	return 0;
+/*
+ * 共享环形缓冲区中是否有还没有被消费的记录
+ * 控制页映射为可写，用户空间可以改写其中的 head，驱动只使用自己保存的 chan->head
+ */
+static bool ring_empty(struct channel_test *chan)
+{
+	return READ_ONCE(chan->ctrl->tail)==READ_ONCE(chan->head);
+}
+
+/* 共享环形缓冲区中是否能放下 need 字节，tail 由用户空间修改，不合法时当作满 */
+static bool ring_has_space(struct channel_test *chan,u32 need)
+{
+	u32 head=READ_ONCE(chan->head);
+	u32 tail=smp_load_acquire(&chan->ctrl->tail);
+	u32 off=head & (RING_SIZE-1);
+
+	if(head-tail>RING_SIZE)
+		return false;
+	if(off+need>RING_SIZE)
+		need+=RING_SIZE-off;  // 末尾放不下，需要先填充到数据区开头
+	return RING_SIZE-(head-tail)>=need;
 }
 
-/* 写设备函数 */
-static ssize_t cdev_test_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
+/* ring_mode 的写函数：把一条记录追加到共享环形缓冲区，返回写入的字节数 */
+static ssize_t ring_write(struct channel_test *chan,struct iov_iter *from,bool nowait)
 {
-	struct device_test *test_dev=(struct device_test *)file->private_data;
+	struct ring_ctrl *ctrl=chan->ctrl;
+	size_t size=iov_iter_count(from);
+	u32 need=ALIGN(RING_HDR+size,4);
+	u32 head,off;
 	int ret;
-	// 将用户空间数据复制到内核空间
-	ret=copy_from_user(test_dev->kbuf,buf,size);
 
-	if(ret!=0)
-	{
-		printk("copy_from_user is error\n");
-		return -1;
+	if(size==0)
+		return 0;
+	if(size>MSG_MAX)
+		return -EMSGSIZE;
+
+	while(1){
+		ret=chan_lock(chan,nowait);
+		if(ret<0)
+			return ret;
+		if(ring_has_space(chan,need))
+			break;
+		mutex_unlock(&chan->lock);
+
+		if(nowait)
+			return -EAGAIN;
+		// 消费者在用户空间移动 tail，不会唤醒写进程，所以每个 tick 重新检查一次
+		if(wait_event_interruptible_timeout(chan->write_wq,ring_has_space(chan,need),1)<0)
+			return -ERESTARTSYS;
+	}
+
+	head=chan->head;  // 总是4字节对齐，填充标记不会越过数据区末尾
+	off=head & (RING_SIZE-1);
+	if(off+need>RING_SIZE){
+		// 数据区末尾放不下，写入填充标记后从头开始
+		*(u32 *)(chan->ring_data+off)=RING_PAD;
+		head+=RING_SIZE-off;
+		off=0;
+	}
+	if(copy_from_iter(chan->ring_data+off+RING_HDR,size,from)!=size){
+		mutex_unlock(&chan->lock);
+		return -EFAULT;
+	}
+	*(u32 *)(chan->ring_data+off)=size;
+	// 先写数据再更新 head，消费者用 acquire 读 head 后一定能看到完整的记录
+	WRITE_ONCE(chan->head,head+need);
+	smp_store_release(&ctrl->head,head+need);
+	mutex_unlock(&chan->lock);
+
+	wake_up_interruptible(&chan->read_wq);
+	return size;
+}
+
+/* mmap函数：把控制页和数据区映射到用户空间 */
+static int cdev_test_mmap(struct file *file,struct vm_area_struct *vma)
+{
+	struct channel_test *chan=(struct channel_test *)file->private_data;
+
+	if(!ring_mode)
+		return -ENODEV;
+	if(vma->vm_pgoff!=0 || vma->vm_end-vma->vm_start!=PAGE_SIZE+RING_SIZE)
+		return -EINVAL;
+	return remap_vmalloc_range(vma,chan->ring,0);
+}
+
+/*
+ * 读设备函数：取出一条记录，批量模式下取出尽可能多的完整记录，返回复制的字节数
+ * 记录连同前面的长度字段或时间戳先复制到栈上，再用 copy_to_iter 一次复制出去，复制成功后才从队列中删除，
+ * read/readv/preadv2 和 io_uring 都走这个函数
+ */
+static ssize_t cdev_test_read_iter(struct kiocb *iocb,struct iov_iter *to)
+{
+	struct channel_test *chan=(struct channel_test *)iocb->ki_filp->private_data;
+	size_t size=iov_iter_count(to);
+	size_t pre;    // 每条记录前面的长度字段或者时间戳的长度
+	char rec[sizeof(struct rec_lat_ts)+MSG_MAX];
+	struct rec_lat_ts ts;
+	size_t total=0;
+	u64 t0,enq;
+	u16 len;
+	int ret;
+
+	// 共享环形缓冲区由用户空间直接消费，不能同时用 read 取数据
+	if(ring_mode)
+		return -EINVAL;
+
+	ret=wait_for_record(chan,io_nowait(iocb));
+	if(ret<0)
+		return ret;
+
+	// 非批量模式只取一条记录，时间戳模式下记录前面加上时间戳；
+	// 批量模式下每条记录前面加上2字节的长度，直到缓冲区放不下下一条完整的记录
+	pre=batch_mode ? REC_HDR : (rec_ts ? sizeof(struct rec_lat_ts) : 0);
+	while(!kfifo_is_empty(&chan->fifo)){
+		len=kfifo_peek_len(&chan->fifo);
+		if(total+pre+len>size)
+			break;
+		if(batch_mode){
+			memcpy(rec,&len,REC_HDR);
+		}else if(pre){
+			ts.write_ns=rec_lat_peek(&chan->stamps);
+			ts.read_ns=ktime_get_ns();
+			memcpy(rec,&ts,pre);
+		}
+		kfifo_out_peek(&chan->fifo,rec+pre,MSG_MAX);
+		t0=ktime_get_ns();
+		if(copy_to_iter(rec,pre+len,to)!=pre+len){
+			ret=-EFAULT;
+			break;
+		}
+		rec_lat_copied(&dev1.lat,t0);
+		kfifo_skip(&chan->fifo);
+		rec_lat_dequeue(&dev1.lat,&chan->stamps,&enq);
+		total+=pre+len;
+		if(!batch_mode)
+			break;
+	}
+	if(total==0 && ret==0)
+		ret=-EMSGSIZE;  // 用户缓冲区放不下第一条记录，记录留在队列中
+	mutex_unlock(&chan->lock);
+	rec_read_pass_on(&chan->read_wq,&chan->fifo,excl_wake);
+
+	if(total==0)
+		return ret;
+	// 唤醒等待空间的写进程
+	wake_up_interruptible(&chan->write_wq);
+	return total;
+}
+
+/* 写设备函数：把数据作为一条记录追加到队列末尾，批量模式下一次写入多条记录，返回写入的字节数 */
+static ssize_t cdev_test_write_iter(struct kiocb *iocb,struct iov_iter *from)
+{
+	struct channel_test *chan=(struct channel_test *)iocb->ki_filp->private_data;
+	size_t size=iov_iter_count(from);
+	bool nowait=io_nowait(iocb);
+	char rec[MSG_MAX];
+	size_t total=0;
+	u16 len;
+	int ret;
+
+	if(ring_mode)
+		return ring_write(chan,from,nowait);
+
+	if(!batch_mode){
+		if(size==0)
+			return 0;
+		if(size>MSG_MAX)
+			return -EMSGSIZE;
+		ret=wait_for_space(chan,size,nowait);
+		if(ret<0)
+			return ret;
+		// 将用户空间数据作为一条记录复制到队列中
+		if(copy_from_iter(rec,size,from)!=size){
+			ret=-EFAULT;
+		}else{
+			kfifo_in(&chan->fifo,rec,size);
+			rec_lat_enqueue(&chan->stamps);
+			total=size;
+		}
+	}else{
+		// 批量模式：数据是连续的 [2字节长度][数据] 格式的记录，至少要能放下第一条
+		if(size<REC_HDR)
+			return -EINVAL;
+		if(copy_from_iter(&len,REC_HDR,from)!=REC_HDR)
+			return -EFAULT;
+		if(len==0 || len>MSG_MAX || REC_HDR+len>size)
+			return -EINVAL;
+		ret=wait_for_space(chan,len,nowait);
+		if(ret<0)
+			return ret;
+		while(1){
+			if(copy_from_iter(rec,len,from)!=len){
+				ret=-EFAULT;
+				break;
+			}
+			kfifo_in(&chan->fifo,rec,len);
+			rec_lat_enqueue(&chan->stamps);
+			total+=REC_HDR+len;
+			// 取下一条记录的长度，不完整的记录和队列放不下的记录留给下一次 write
+			if(total+REC_HDR>size || copy_from_iter(&len,REC_HDR,from)!=REC_HDR)
+				break;
+			if(len==0 || len>MSG_MAX || total+REC_HDR+len>size || kfifo_avail(&chan->fifo)<len)
+				break;
+		}
 	}
+	mutex_unlock(&chan->lock);
+
+	if(total==0)
+		return ret;
 
-	test_dev->flag=1;
 	// 唤醒等待队列中的进程
-	wake_up_interruptible(&read_wq);
-	return 0;
+	rec_lat_wake(&dev1.lat);
+	wake_up_interruptible(&chan->read_wq);
+	return total;
 }
 
 /* 关闭设备函数 */
@@ -92,15 +431,29 @@ static int cdev_test_release(struct inode *inode,struct file *file)
 
 /* poll函数，用于实现select/poll/epoll机制 */
 static __poll_t cdev_test_poll(struct file *file,struct poll_table_struct *p){
-	struct device_test *test_dev=(struct device_test *)file->private_data;
+	struct channel_test *chan=(struct channel_test *)file->private_data;
 	__poll_t mask=0;
 	// 将等待队列添加到poll_table中
-	poll_wait(file,&read_wq,p);
+	poll_wait(file,&chan->read_wq,p);
+	poll_wait(file,&chan->write_wq,p);
+	if(ring_mode){
+		// 环形缓冲区非空时可读，能放下一条最长的记录时可写
+		if(!ring_empty(chan))
+			mask |= POLLIN;
+		if(ring_has_space(chan,ALIGN(RING_HDR+MSG_MAX,4)))
+			mask |= POLLOUT;
+		return mask;
+	}
 	// 检查是否有数据可读
-	if(test_dev->flag ==1)
+	if(!kfifo_is_empty(&chan->fifo))
 	{
 		mask |= POLLIN;  // 设置可读标志
 	}
+	// 能放下一条最长的记录时可写
+	if(kfifo_avail(&chan->fifo)>=MSG_MAX)
+	{
+		mask |= POLLOUT;
+	}
 	return mask;
 }
 
@@ -108,19 +461,59 @@ static __poll_t cdev_test_poll(struct file *file,struct poll_table_struct *p){
 struct file_operations cdev_test_fops={
 	.owner=THIS_MODULE,
 	.open=cdev_test_open,
-	.read=cdev_test_read,
-	.write=cdev_test_write,
+	.read_iter=cdev_test_read_iter,
+	.write_iter=cdev_test_write_iter,
 	.release=cdev_test_release,
 	.poll=cdev_test_poll,  // 添加poll操作
+	.mmap=cdev_test_mmap,
 };
 
+/* 释放所有通道的记录队列、时间戳队列和共享环形缓冲区以及延时统计，kfifo_free 和 vfree 都可以处理没有分配的情况 */
+static void free_channels(void)
+{
+	int i;
+
+	for(i=0;i<nr_channels;i++){
+		kfifo_free(&dev1.chan[i].fifo);
+		rec_stamps_free(&dev1.chan[i].stamps);
+		vfree(dev1.chan[i].ring);
+	}
+	kvfree(dev1.chan);
+	rec_lat_exit(&dev1.lat);
+}
+
 /* 模块初始化函数 */
 static int __init chr_fops_init(void)
 {
 	int ret;
+	int i;
+
+	if(nr_channels<1 || nr_channels>MAX_CHANNELS)
+		return -EINVAL;
+
+	ret=rec_lat_init(&dev1.lat,KBUILD_MODNAME);
+	if(ret<0)
+		return ret;
+
+	// 分配通道和每个通道的记录队列
+	dev1.chan=kvcalloc(nr_channels,sizeof(*dev1.chan),GFP_KERNEL);
+	if(dev1.chan==NULL){
+		rec_lat_exit(&dev1.lat);
+		return -ENOMEM;
+	}
+	for(i=0;i<nr_channels;i++){
+		dev1.chan[i].index=i;
+		mutex_init(&dev1.chan[i].lock);
+		init_waitqueue_head(&dev1.chan[i].read_wq);
+		init_waitqueue_head(&dev1.chan[i].write_wq);
+		ret=kfifo_alloc(&dev1.chan[i].fifo,FIFO_SIZE,GFP_KERNEL);
+		if(ret<0)
+			goto err_chrdev;
+	}
 	
-	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	// 分配设备号，每个通道一个次设备号
+	ret=alloc_chrdev_region(&dev1.dev_num,0,nr_channels,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
@@ -134,7 +527,7 @@ static int __init chr_fops_init(void)
 	cdev_init(&dev1.cdev_test,&cdev_test_fops);
 
 	// 添加字符设备
-	ret=cdev_add(&dev1.cdev_test,dev1.dev_num,1);
+	ret=cdev_add(&dev1.cdev_test,dev1.dev_num,nr_channels);
 	if(ret<0)
 	{
 		goto err_chr_add;
@@ -149,38 +542,50 @@ static int __init chr_fops_init(void)
 		goto err_class_create;
 	}
 
-	// 创建设备节点
-	dev1.device=device_create(dev1.class,NULL,dev1.dev_num,NULL,"test");
-	if(IS_ERR(dev1.device))
-	{
-		ret=PTR_ERR(dev1.device);
-		goto err_device_create;
+	// 创建设备节点，只有一个通道时保持原来的 /dev/test
+	for(i=0;i<nr_channels;i++){
+		if(nr_channels==1)
+			dev1.chan[i].device=device_create(dev1.class,NULL,dev1.dev_num,NULL,"test");
+		else
+			dev1.chan[i].device=device_create(dev1.class,NULL,dev1.dev_num+i,NULL,"test%d",i);
+		if(IS_ERR(dev1.chan[i].device))
+		{
+			ret=PTR_ERR(dev1.chan[i].device);
+			goto err_device_create;
+		}
 	}
 
 	return 0;
 
 	// 错误处理
 	err_device_create:
+		while(--i>=0)
+			device_destroy(dev1.class,dev1.dev_num+i);
 		class_destroy(dev1.class);
 
 	err_class_create:
 		cdev_del(&dev1.cdev_test);
 
 	err_chr_add:
-		unregister_chrdev_region(dev1.dev_num,1);
+		unregister_chrdev_region(dev1.dev_num,nr_channels);
 
 	err_chrdev:
+		free_channels();
 		return ret;
 }
 
 /* 模块退出函数 */
 static void __exit chr_fops_exit(void)
 {
+	int i;
+
 	// 清理设备相关资源
-	device_destroy(dev1.class,dev1.dev_num);
+	for(i=0;i<nr_channels;i++)
+		device_destroy(dev1.class,dev1.dev_num+i);
 	class_destroy(dev1.class);
 	cdev_del(&dev1.cdev_test);
-	unregister_chrdev_region(dev1.dev_num,1);
+	unregister_chrdev_region(dev1.dev_num,nr_channels);
+	free_channels();
 	printk("module exit\n");
 }
 
@@ -0,0 +1,78 @@
+/*
+ * 这是一个测试程序，用 eventfd 代替 SIGIO 接收数据就绪的通知
+ * 程序创建一个 eventfd，通过 ioctl(EVENTFD_SET) 注册到驱动，驱动每次写入记录后给 eventfd 的计数加上记录数，
+ * 主循环用 epoll 等待 eventfd 可读，再以非阻塞方式读出设备中所有的记录，
+ * 不需要信号处理函数，也不需要 while(1) 空转，设备可以和其他文件描述符放在同一个 epoll 里
+ */
+
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<errno.h>
+
+#define EVENTFD_SET _IOW('F',0,int)  // 与驱动中的定义保持一致
+
+int main(int argc,char *argv[])
+{
+	struct epoll_event ev;
+	char buf[257];          // 读取缓冲区，一条记录最长256字节
+	uint64_t cnt;           // eventfd 的计数，即上次读取之后写入的记录数
+	int fd,efd,epfd;
+	int len;
+
+	// 以非阻塞方式打开设备节点，收到通知后一直读到 EAGAIN
+	fd=open("/dev/test",O_RDWR|O_NONBLOCK);
+	if(fd<0){
+		perror("open error");
+		return fd;
+	}
+
+	// 创建 eventfd 并注册到驱动
+	efd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	if(efd<0){
+		perror("eventfd error");
+		return -1;
+	}
+	if(ioctl(fd,EVENTFD_SET,&efd)<0){
+		perror("ioctl error");
+		return -1;
+	}
+
+	// 把 eventfd 加入 epoll
+	epfd=epoll_create1(EPOLL_CLOEXEC);
+	ev.events=EPOLLIN;
+	ev.data.fd=efd;
+	if(epfd<0 || epoll_ctl(epfd,EPOLL_CTL_ADD,efd,&ev)<0){
+		perror("epoll error");
+		return -1;
+	}
+
+	while(1){
+		if(epoll_wait(epfd,&ev,1,-1)<=0)
+			continue;
+		// 读取并清零 eventfd 的计数
+		if(read(efd,&cnt,sizeof(cnt))!=sizeof(cnt))
+			continue;
+		printf("%llu new records\n",(unsigned long long)cnt);
+		// 读出所有记录，计数只是提示，其他读进程可能已经取走了一部分
+		while((len=read(fd,buf,sizeof(buf)-1))>0){
+			buf[len]='\0';
+			printf("buf is %s\n",buf);
+		}
+		if(len<0 && errno!=EAGAIN)
+			perror("read error");
+	}
+
+	// 关闭设备
+	close(epfd);
+	close(efd);
+	close(fd);
+	return 0;
+}
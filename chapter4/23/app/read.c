@@ -1,56 +1,108 @@
 /*
  * 这是一个测试程序，用于测试字符设备驱动的异步通知功能
- * 该程序通过信号机制实现异步通知，当设备有数据时触发SIGIO信号
+ * 用 F_SETSIG 把异步通知换成实时信号，信号中带有写入的记录数和最后一条记录的序号，
+ * 主线程屏蔽这个信号，用 sigwaitinfo 或者 signalfd 同步地等待信号，收到后以非阻塞方式读出所有记录，
+ * 不需要在信号处理函数中调用 read/printf，也不需要 while(1) 空转
+ * 使用方法：./read          用 sigwaitinfo 等待
+ *           ./read signalfd 用 signalfd 等待
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/signalfd.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <signal.h>
 
 int fd;                  // 文件描述符
-char buf1[32] = {0};     // 读取缓冲区
+char buf1[257] = {0};    // 读取缓冲区，一条记录最长256字节
 
-/* SIGIO信号的信号处理函数 */
-static void func(int signum)
+/* 读出设备中所有的记录，驱动合并信号时一个信号可能对应多次写入 */
+static void drain(void)
 {
-    read(fd,buf1,32);    // 读取设备数据
-    printf ("buf is %s\n",buf1);  // 打印读取的数据
+    int len;
+
+    while ((len = read(fd, buf1, sizeof(buf1) - 1)) > 0)
+    {
+        buf1[len] = '\0';
+        printf("buf is %s\n", buf1);
+    }
+    if (len < 0 && errno != EAGAIN)
+        perror("read error");
 }
 
-int main(int argc, char *argv[])  
+int main(int argc, char *argv[])
 {
-    int ret;
+    struct signalfd_siginfo ssi;
+    siginfo_t info;
+    sigset_t set;
+    uint64_t payload;
+    int use_signalfd = argc > 1 && strcmp(argv[1], "signalfd") == 0;
+    int sig = SIGRTMIN + 1;   // 使用的实时信号
+    int sfd = -1;
     int flags;
 
-    // 打开设备节点
-    fd = open("/dev/test", O_RDWR);
+    // 打开设备节点，以非阻塞方式读到 EAGAIN 为止
+    fd = open("/dev/test", O_RDWR | O_NONBLOCK);
     if (fd < 0)
     {
         perror("open error \n");
         return fd;
     }
 
-    // 步骤一：注册SIGIO信号的信号处理函数
-    signal(SIGIO,func);
+    // 步骤一：屏蔽实时信号，改为同步等待，信号不会打断主线程
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    if (use_signalfd)
+    {
+        sfd = signalfd(-1, &set, SFD_CLOEXEC);
+        if (sfd < 0)
+        {
+            perror("signalfd error");
+            return -1;
+        }
+    }
 
-    // 步骤二：设置进程接收SIGIO信号
-    fcntl(fd,F_SETOWN,getpid());
+    // 步骤二：设置进程接收信号，并用 F_SETSIG 指定实时信号
+    fcntl(fd, F_SETOWN, getpid());
+    fcntl(fd, F_SETSIG, sig);
 
-    // 步骤三：获取文件描述符标志
-    flags = fcntl(fd,F_GETFD);
+    // 步骤三：获取文件状态标志
+    flags = fcntl(fd, F_GETFL);
 
     // 步骤四：设置文件描述符支持异步通知
-    fcntl(fd,F_SETFL,flags| FASYNC);
+    fcntl(fd, F_SETFL, flags | FASYNC);
 
-    // 主循环，等待信号
-    while(1);
+    // 主循环，同步等待信号
+    while (1)
+    {
+        if (use_signalfd)
+        {
+            if (read(sfd, &ssi, sizeof(ssi)) != sizeof(ssi))
+                continue;
+            payload = ssi.ssi_ptr;
+        }
+        else
+        {
+            if (sigwaitinfo(&set, &info) < 0)
+                continue;
+            payload = (uint64_t)(uintptr_t)info.si_ptr;
+        }
+        // 高32位是记录数，低32位是最后一条记录的序号
+        printf("signal: %u records, last seq %u\n", (unsigned)(payload >> 32), (unsigned)payload);
+        drain();
+    }
 
     // 关闭设备
+    if (sfd >= 0)
+        close(sfd);
     close(fd);
     return 0;
 }
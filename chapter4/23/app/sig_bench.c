@@ -0,0 +1,183 @@
+/*
+ * 这是一个通知延时测试程序，测量从 write() 到接收线程被唤醒的时间
+ * 写线程按固定间隔写入记录，记录的前8个字节是写入前的时间戳，
+ * 主线程分别用三种方式等待通知，被唤醒后读出所有记录，用第一条记录的时间戳计算延时：
+ *   sigwait：F_SETSIG 设置实时信号，sigwaitinfo 等待
+ *   signalfd：F_SETSIG 设置实时信号，从 signalfd 读取
+ *   eventfd：ioctl(EVENTFD_SET) 注册 eventfd，阻塞读 eventfd
+ * 使用方法：./sig_bench sigwait|signalfd|eventfd [记录条数] [写入间隔us]
+ */
+
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<sys/signalfd.h>
+#include<sys/eventfd.h>
+#include<fcntl.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<signal.h>
+#include<pthread.h>
+#include<time.h>
+
+#define EVENTFD_SET _IOW('F',0,int)  // 与驱动中的定义保持一致
+
+enum wait_mode{
+	MODE_SIGWAIT,
+	MODE_SIGNALFD,
+	MODE_EVENTFD,
+};
+
+static int fd;
+static int count=10000;      // 记录条数
+static int interval_us=1000; // 写入间隔
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+/* 写线程：按固定间隔写入带时间戳的记录 */
+static void *writer_thread(void *arg)
+{
+	uint64_t stamp;
+	int i;
+
+	for(i=0;i<count;i++){
+		stamp=now_ns();
+		if(write(fd,&stamp,sizeof(stamp))!=sizeof(stamp)){
+			perror("write error");
+			break;
+		}
+		usleep(interval_us);
+	}
+	return NULL;
+}
+
+static int cmp_u64(const void *a,const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	return x<y ? -1 : x>y;
+}
+
+int main(int argc,char *argv[])
+{
+	enum wait_mode mode;
+	struct signalfd_siginfo ssi;
+	uint64_t *lat,stamp,woken,cnt;
+	sigset_t set;
+	pthread_t tid;
+	int sig=SIGRTMIN+1;
+	int nfd=-1;        // signalfd 或 eventfd
+	int got=0,wakeups=0,nsamples=0,first;
+	int flags;
+
+	if(argc<2){
+		printf("usage: %s sigwait|signalfd|eventfd [records] [interval_us]\n",argv[0]);
+		return -1;
+	}
+	if(strcmp(argv[1],"sigwait")==0)
+		mode=MODE_SIGWAIT;
+	else if(strcmp(argv[1],"signalfd")==0)
+		mode=MODE_SIGNALFD;
+	else if(strcmp(argv[1],"eventfd")==0)
+		mode=MODE_EVENTFD;
+	else{
+		printf("unknown mode %s\n",argv[1]);
+		return -1;
+	}
+	if(argc>2)
+		count=atoi(argv[2]);
+	if(argc>3)
+		interval_us=atoi(argv[3]);
+	if(count<=0 || interval_us<0){
+		printf("bad arguments\n");
+		return -1;
+	}
+	lat=malloc(count*sizeof(uint64_t));  // 每次唤醒一个采样，不会超过记录条数
+	if(lat==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+
+	// 打开设备节点
+	fd=open("/dev/test",O_RDWR|O_NONBLOCK);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
+	// 屏蔽实时信号，写线程继承信号屏蔽字，信号只由主线程同步接收
+	sigemptyset(&set);
+	sigaddset(&set,sig);
+	sigprocmask(SIG_BLOCK,&set,NULL);
+	if(mode==MODE_EVENTFD){
+		nfd=eventfd(0,EFD_CLOEXEC);
+		if(nfd<0 || ioctl(fd,EVENTFD_SET,&nfd)<0){
+			perror("eventfd error");
+			return -1;
+		}
+	}else{
+		if(mode==MODE_SIGNALFD){
+			nfd=signalfd(-1,&set,SFD_CLOEXEC);
+			if(nfd<0){
+				perror("signalfd error");
+				return -1;
+			}
+		}
+		fcntl(fd,F_SETOWN,getpid());
+		fcntl(fd,F_SETSIG,sig);
+		flags=fcntl(fd,F_GETFL);
+		fcntl(fd,F_SETFL,flags|FASYNC);
+	}
+
+	pthread_create(&tid,NULL,writer_thread,NULL);
+	while(got<count){
+		// 等待通知
+		if(mode==MODE_SIGWAIT){
+			if(sigwaitinfo(&set,NULL)<0)
+				continue;
+		}else if(mode==MODE_SIGNALFD){
+			if(read(nfd,&ssi,sizeof(ssi))!=sizeof(ssi))
+				continue;
+		}else{
+			if(read(nfd,&cnt,sizeof(cnt))!=sizeof(cnt))
+				continue;
+		}
+		woken=now_ns();
+		wakeups++;
+
+		// 读出所有记录，只用第一条记录计算延时，后面的记录是唤醒之后才写入的或者被合并的
+		first=1;
+		while(got<count && read(fd,&stamp,sizeof(stamp))==sizeof(stamp)){
+			if(first)
+				lat[nsamples++]=woken-stamp;
+			first=0;
+			got++;
+		}
+	}
+	pthread_join(tid,NULL);
+
+	printf("%s: records=%d interval=%dus wakeups=%d\n",argv[1],got,interval_us,wakeups);
+	if(nsamples>0){
+		qsort(lat,nsamples,sizeof(uint64_t),cmp_u64);
+		printf("write -> wakeup latency(ns): min=%llu p50=%llu p99=%llu max=%llu\n",
+			(unsigned long long)lat[0],(unsigned long long)lat[nsamples*50/100],
+			(unsigned long long)lat[nsamples*99/100],(unsigned long long)lat[nsamples-1]);
+	}
+
+	// 关闭设备
+	if(nfd>=0)
+		close(nfd);
+	close(fd);
+	free(lat);
+	return 0;
+}
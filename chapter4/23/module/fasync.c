@@ -16,6 +16,60 @@
 #include<linux/poll.h>
 #include<linux/fcntl.h>
 #include<linux/signal.h>
+#include<linux/cred.h>
+#include<linux/pid.h>
+#include<linux/kfifo.h>
+#include<linux/mutex.h>
+#include<linux/moduleparam.h>
+#include "rec_lat.h"
+#include "rec_wait.h"
+#include<linux/eventfd.h>
+#include<linux/list.h>
+#include<linux/slab.h>
+#include<linux/spinlock.h>
+#include<linux/sched/signal.h>
+#include<linux/rcupdate.h>
+
+#define FIFO_SIZE 4096  // 记录队列的大小（字节），必须是2的幂
+#define MSG_MAX 256     // 单条记录的最大长度
+#define REC_HDR 2       // 批量模式下每条记录前面的长度字段，u16
+
+// 批量模式：一次 read 取出多条记录，一次 write 写入多条记录，每条记录前面有2字节的长度
+static bool batch_mode;
+module_param(batch_mode,bool,0644);
+MODULE_PARM_DESC(batch_mode,"length-prefixed multi-record read/write");
+
+// 互斥唤醒模式：读进程以互斥方式等待，一条记录只唤醒一个读进程，避免所有读进程一起被唤醒（惊群）
+static bool excl_wake;
+module_param(excl_wake,bool,0644);
+MODULE_PARM_DESC(excl_wake,"wake a single reader per record instead of all of them");
+
+// 时间戳模式：非批量模式下 read 返回的记录前面加上 struct rec_lat_ts，包含记录的写入时间和取出时间
+static bool rec_ts;
+module_param(rec_ts,bool,0644);
+MODULE_PARM_DESC(rec_ts,"prefix each record returned by read with its write/read timestamps");
+
+// 信号合并：上一个信号发出之后还没有进程调用 read，新的写入不再发送信号，
+// 负载高时实时信号不会在接收进程的信号队列中堆积，读进程收到信号后要一直读到 EAGAIN
+static bool sig_coalesce=true;
+module_param(sig_coalesce,bool,0644);
+MODULE_PARM_DESC(sig_coalesce,"send no new signal until a reader has called read since the last one");
+
+/*
+ * 用 F_SETSIG 设置了实时信号时，信号的 si_code 为 SI_ASYNCIO，si_ptr（signalfd 中的 ssi_ptr）为：
+ * 高32位是这次 write 写入的记录数，低32位是最后一条记录的序号，序号从1开始，每条记录加1
+ */
+#define SIG_PAYLOAD(nrec,seq) (((u64)(nrec)<<32)|(u32)(seq))
+
+/* 定义ioctl命令 */
+#define EVENTFD_SET _IOW('F',0,int)  // 注册 eventfd，参数为 eventfd 的文件描述符，小于0时取消注册
+
+/* 通过 ioctl 注册的 eventfd，每个打开的文件最多注册一个 */
+struct evt_reg{
+	struct list_head node;
+	struct file *file;            // 注册 eventfd 的文件，关闭时自动取消注册
+	struct eventfd_ctx *ctx;      // eventfd 上下文，写入记录后计数加上写入的记录数
+};
 
 /* 设备结构体定义 */
 struct device_test{
@@ -25,9 +79,15 @@ struct device_test{
 	struct cdev cdev_test;// 字符设备结构体
 	struct class *class;  // 设备类
 	struct device *device;// 设备结构体
-	char kbuf[32];        // 内核缓冲区
-	int flag;             // 标志位，用于等待队列
+	struct kfifo_rec_ptr_2 fifo;  // 变长记录队列，每条记录前面有2字节的长度
+	struct mutex lock;            // 保护记录队列，复制数据时可能睡眠，所以使用互斥锁
+	struct rec_stamps stamps;     // 每条记录的写入时间，和记录队列同步进出
+	struct rec_lat lat;           // 记录延时统计，在 debugfs 中查看
 	struct fasync_struct *fasync;  // 异步通知结构体
+	struct list_head evt_list;     // 注册的 eventfd 链表
+	spinlock_t evt_lock;           // 保护 evt_list
+	u32 seq;                       // 最后写入的记录的序号，在 lock 中修改
+	atomic_t sig_pending;          // 已经发出信号，还没有进程调用 read
 };
 
 /* 定义设备实例 */
@@ -35,6 +95,7 @@ struct device_test dev1;
 
 /* 声明等待队列头 */
 DECLARE_WAIT_QUEUE_HEAD(read_wq);
+DECLARE_WAIT_QUEUE_HEAD(write_wq);  // 队列满时写进程在这里等待
 
 /* 打开设备函数 */
 static int cdev_test_open(struct inode *inode,struct file *file)
@@ -43,55 +104,368 @@ static int cdev_test_open(struct inode *inode,struct file *file)
 	return 0;
 }
 
-/* 写设备函数 */
+/* 等待队列中有记录，成功返回0，返回时持有 test_dev->lock */
+static int wait_for_record(struct file *file,struct device_test *test_dev)
+{
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		if(!kfifo_is_empty(&test_dev->fifo))
+			return 0;
+		mutex_unlock(&test_dev->lock);
+
+		// 检查是否为非阻塞模式
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;  // 非阻塞模式下，如果没有数据则返回EAGAIN
+		// 等待直到队列中有记录，被唤醒后重新加锁检查，记录可能已经被其他读进程取走
+		if(rec_read_wait(&read_wq,&test_dev->fifo,&test_dev->lat,excl_wake))
+			return -ERESTARTSYS;
+	}
+}
+
+/* 等待队列中能放下 size 字节的记录，成功返回0，返回时持有 test_dev->lock */
+static int wait_for_space(struct file *file,struct device_test *test_dev,size_t size)
+{
+	while(1){
+		if(mutex_lock_interruptible(&test_dev->lock))
+			return -ERESTARTSYS;
+		// kfifo_avail 已经减去了记录头的2个字节
+		if(kfifo_avail(&test_dev->fifo)>=size)
+			return 0;
+		mutex_unlock(&test_dev->lock);
+
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;  // 非阻塞模式下，队列满时返回EAGAIN
+		// 等待读进程取走记录，腾出空间
+		if(wait_event_interruptible(write_wq,kfifo_avail(&test_dev->fifo)>=size))
+			return -ERESTARTSYS;
+	}
+}
+
+/*
+ * 和内核 fs/fcntl.c 的 sigio_perm 一样检查 F_SETOWN 的调用者能不能给 p 发信号：
+ * F_SETOWN 不检查目标进程，不做这个检查的话，任何能打开设备的用户都可以把属主设成别人的进程，
+ * 再用 F_SETSIG 设成 SIGKILL。LSM 的 security_file_send_sigiotask 没有导出给模块，这里只检查用户 ID
+ */
+static bool sig_perm(struct task_struct *p,struct fown_struct *fown)
+{
+	const struct cred *cred;
+	bool ret;
+
+	rcu_read_lock();
+	cred=__task_cred(p);
+	ret=uid_eq(fown->euid,GLOBAL_ROOT_UID) ||
+		uid_eq(fown->euid,cred->suid) || uid_eq(fown->euid,cred->uid) ||
+		uid_eq(fown->uid,cred->suid) || uid_eq(fown->uid,cred->uid);
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * 给一个进程发送信号，和内核的 send_sigio 一样按 F_SETSIG 设置的信号区分：
+ * 没有设置时发送不带信息的 SIGIO；设置为普通信号时 si_code 为 POLL_IN，带上 si_band 和 si_fd；
+ * 设置为实时信号时带上记录数和序号
+ */
+static void sig_send_task(struct task_struct *p,struct fasync_struct *fa,int signum,
+	unsigned int nrec,u32 seq)
+{
+	struct siginfo info;  // 4.19 还没有 kernel_siginfo
+
+	if(!sig_perm(p,&fa->fa_file->f_owner))
+		return;
+	if(signum==0){
+		send_sig_info(SIGIO,SEND_SIG_PRIV,p);
+		return;
+	}
+	clear_siginfo(&info);
+	info.si_signo=signum;
+	if(signum>=SIGRTMIN){
+		info.si_code=SI_ASYNCIO;
+		info.si_ptr=(void __user *)(uintptr_t)SIG_PAYLOAD(nrec,seq);
+	}else{
+		info.si_code=POLL_IN;
+		info.si_band=EPOLLIN | EPOLLRDNORM;
+		info.si_fd=fa->fa_fd;
+	}
+	send_sig_info(signum,&info,p);
+}
+
+/*
+ * 给一个 fasync 文件的属主发送信号，和 send_sigio 一样按 F_SETOWN 的属主类型查找进程：
+ * 属主是线程或进程（PIDTYPE_PID/PIDTYPE_TGID）时发给这个线程或进程的主线程，
+ * 属主是进程组或会话时发给其中的每个进程，每个进程都要通过 sig_perm 检查
+ */
+static void sig_send(struct fasync_struct *fa,unsigned int nrec,u32 seq)
+{
+	struct fown_struct *fown=&fa->fa_file->f_owner;
+	struct task_struct *p;
+	enum pid_type type;
+	struct pid *pid;
+	int signum;
+
+	read_lock(&fown->lock);
+	signum=fown->signum;
+	pid=fown->pid;
+	type=fown->pid_type;
+	if(pid==NULL)
+		goto out;
+	rcu_read_lock();
+	if(type<=PIDTYPE_TGID){
+		p=pid_task(pid,PIDTYPE_PID);
+		if(p)
+			sig_send_task(p,fa,signum,nrec,seq);
+	}else{
+		do_each_pid_task(pid,type,p){
+			sig_send_task(p,fa,signum,nrec,seq);
+		}while_each_pid_task(pid,type,p);
+	}
+	rcu_read_unlock();
+out:
+	read_unlock(&fown->lock);
+}
+
+/*
+ * 写入记录后通知所有打开了异步通知的文件，代替 kill_fasync，
+ * kill_fasync 发出的信号只有 si_band/si_fd，带不了记录数和序号
+ */
+static void sig_notify(struct device_test *test_dev,unsigned int nrec,u32 seq)
+{
+	struct fasync_struct *fa;
+	unsigned long flags;
+
+	if(sig_coalesce && atomic_xchg(&test_dev->sig_pending,1))
+		return;
+
+	// 和 kill_fasync 一样在 RCU 中遍历链表，fa_lock 防止文件同时取消异步通知
+	rcu_read_lock();
+	for(fa=rcu_dereference(test_dev->fasync);fa!=NULL;fa=rcu_dereference(fa->fa_next)){
+		if(fa->magic!=FASYNC_MAGIC)
+			break;
+		read_lock_irqsave(&fa->fa_lock,flags);
+		if(fa->fa_file)
+			sig_send(fa,nrec,seq);
+		read_unlock_irqrestore(&fa->fa_lock,flags);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * 为文件注册或取消注册 eventfd，efd 小于0时取消注册，已经注册过时替换原来的 eventfd
+ * 注册时队列中已经有记录的话立即通知一次，避免错过注册之前写入的记录
+ */
+static int evt_set(struct device_test *test_dev,struct file *file,int efd)
+{
+	struct eventfd_ctx *ctx=NULL;
+	struct evt_reg *reg=NULL,*old=NULL,*tmp;
+
+	if(efd>=0){
+		ctx=eventfd_ctx_fdget(efd);
+		if(IS_ERR(ctx))
+			return PTR_ERR(ctx);
+		reg=kmalloc(sizeof(*reg),GFP_KERNEL);
+		if(reg==NULL){
+			eventfd_ctx_put(ctx);
+			return -ENOMEM;
+		}
+		reg->file=file;
+		reg->ctx=ctx;
+	}
+
+	spin_lock(&test_dev->evt_lock);
+	list_for_each_entry(tmp,&test_dev->evt_list,node){
+		if(tmp->file==file){
+			old=tmp;
+			list_del(&old->node);
+			break;
+		}
+	}
+	if(reg!=NULL){
+		list_add_tail(&reg->node,&test_dev->evt_list);
+		if(!kfifo_is_empty(&test_dev->fifo))
+			eventfd_signal(ctx,1);
+	}
+	spin_unlock(&test_dev->evt_lock);
+
+	if(old!=NULL){
+		eventfd_ctx_put(old->ctx);
+		kfree(old);
+	}
+	return 0;
+}
+
+/* 写入记录后通知所有注册的 eventfd，计数加上写入的记录数 */
+static void evt_notify(struct device_test *test_dev,unsigned int nrec)
+{
+	struct evt_reg *reg;
+
+	spin_lock(&test_dev->evt_lock);
+	list_for_each_entry(reg,&test_dev->evt_list,node)
+		eventfd_signal(reg->ctx,nrec);
+	spin_unlock(&test_dev->evt_lock);
+}
+
+/* 读设备函数：取出一条记录，批量模式下取出尽可能多的完整记录，返回复制的字节数 */
+static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+{
+	struct device_test *test_dev=(struct device_test *)file->private_data;
+	size_t hdr=rec_ts ? sizeof(struct rec_lat_ts) : 0;
+	struct rec_lat_ts ts;
+	unsigned int copied;
+	size_t total=0;
+	u16 len;
+	u64 t0;
+	int ret;
+
+	// 读进程已经开始取记录，之后的写入需要重新发送信号
+	atomic_set(&test_dev->sig_pending,0);
+
+	ret=wait_for_record(file,test_dev);
+	if(ret<0)
+		return ret;
+
+	if(!batch_mode){
+		// 用户缓冲区放不下下一条记录时返回错误，记录留在队列中
+		if(size<hdr+kfifo_peek_len(&test_dev->fifo)){
+			ret=-EMSGSIZE;
+		}else{
+			// 时间戳模式下先把时间戳复制到记录前面，复制失败时记录还留在队列中
+			if(hdr){
+				ts.write_ns=rec_lat_peek(&test_dev->stamps);
+				ts.read_ns=ktime_get_ns();
+				if(copy_to_user(buf,&ts,hdr))
+					ret=-EFAULT;
+			}
+			// 取出一条记录复制到用户空间
+			if(ret==0){
+				t0=ktime_get_ns();
+				ret=kfifo_to_user(&test_dev->fifo,buf+hdr,size-hdr,&copied);
+			}
+			if(ret==0){
+				rec_lat_copied(&test_dev->lat,t0);
+				rec_lat_dequeue(&test_dev->lat,&test_dev->stamps,&ts.write_ns);
+				total=hdr+copied;
+			}
+		}
+	}else{
+		// 批量模式：每条记录前面加上2字节的长度，直到缓冲区放不下下一条完整的记录
+		while(!kfifo_is_empty(&test_dev->fifo)){
+			len=kfifo_peek_len(&test_dev->fifo);
+			if(total+REC_HDR+len>size)
+				break;
+			if(copy_to_user(buf+total,&len,REC_HDR)){
+				ret=-EFAULT;
+				break;
+			}
+			t0=ktime_get_ns();
+			ret=kfifo_to_user(&test_dev->fifo,buf+total+REC_HDR,len,&copied);
+			if(ret<0)
+				break;
+			rec_lat_copied(&test_dev->lat,t0);
+			rec_lat_dequeue(&test_dev->lat,&test_dev->stamps,&ts.write_ns);
+			total+=REC_HDR+copied;
+		}
+		if(total==0 && ret==0)
+			ret=-EMSGSIZE;  // 第一条记录就放不下
+	}
+	mutex_unlock(&test_dev->lock);
+	rec_read_pass_on(&read_wq,&test_dev->fifo,excl_wake);
+
+	if(total==0)
+		return ret;
+	// 唤醒等待空间的写进程
+	wake_up_interruptible(&write_wq);
+	return total;
+}
+
+/* 写设备函数：把数据作为一条记录追加到队列末尾，批量模式下一次写入多条记录，返回写入的字节数 */
 static ssize_t cdev_test_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
 {
 	struct device_test *test_dev=(struct device_test *)file->private_data;
+	unsigned int copied;
+	unsigned int nrec=0;  // 写入的记录数
+	size_t total=0;
+	u32 seq;
+	u16 len;
 	int ret;
-	// 将用户空间数据复制到内核空间
-	ret=copy_from_user(test_dev->kbuf,buf,size);
 
-	if(ret!=0)
-	{
-		printk("copy_from_user is error\n");
-		return -1;
+	if(!batch_mode){
+		if(size==0)
+			return 0;
+		if(size>MSG_MAX)
+			return -EMSGSIZE;
+		ret=wait_for_space(file,test_dev,size);
+		if(ret<0)
+			return ret;
+		// 将用户空间数据作为一条记录复制到队列中
+		ret=kfifo_from_user(&test_dev->fifo,buf,size,&copied);
+		if(ret==0){
+			rec_lat_enqueue(&test_dev->stamps);
+			total=copied;
+			nrec=1;
+		}
+	}else{
+		// 批量模式：buf 中是连续的 [2字节长度][数据] 格式的记录，至少要能放下第一条
+		if(size<REC_HDR)
+			return -EINVAL;
+		if(copy_from_user(&len,buf,REC_HDR))
+			return -EFAULT;
+		if(len==0 || len>MSG_MAX || REC_HDR+len>size)
+			return -EINVAL;
+		ret=wait_for_space(file,test_dev,len);
+		if(ret<0)
+			return ret;
+		while(1){
+			ret=kfifo_from_user(&test_dev->fifo,buf+total+REC_HDR,len,&copied);
+			if(ret<0)
+				break;
+			rec_lat_enqueue(&test_dev->stamps);
+			total+=REC_HDR+len;
+			nrec++;
+			// 取下一条记录的长度，不完整的记录和队列放不下的记录留给下一次 write
+			if(total+REC_HDR>size || copy_from_user(&len,buf+total,REC_HDR))
+				break;
+			if(len==0 || len>MSG_MAX || total+REC_HDR+len>size || kfifo_avail(&test_dev->fifo)<len)
+				break;
+		}
 	}
+	test_dev->seq+=nrec;
+	seq=test_dev->seq;
+	mutex_unlock(&test_dev->lock);
+
+	if(total==0)
+		return ret;
 
-	test_dev->flag=1;
 	// 唤醒等待队列中的进程
+	rec_lat_wake(&test_dev->lat);
 	wake_up_interruptible(&read_wq);
 	// 发送异步通知信号
-	kill_fasync(&test_dev->fasync,SIGIO,POLLIN);
+	sig_notify(test_dev,nrec,seq);
+	// 通知注册的 eventfd
+	evt_notify(test_dev,nrec);
 
-	return 0;
+	return total;
 }
 
-/* 读设备函数 */
-static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+/* ioctl命令处理函数 */
+static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
 {
 	struct device_test *test_dev=(struct device_test *)file->private_data;
-	// 检查是否为非阻塞模式
-	if(file->f_flags & O_NONBLOCK){
-		if(test_dev->flag !=1)
-			return -EAGAIN;  // 非阻塞模式下，如果没有数据则返回EAGAIN
-	}
-
-	// 等待直到flag被设置为1
-	wait_event_interruptible(read_wq,test_dev->flag);
+	int efd;
 
-	// 将内核数据复制到用户空间
-	if(copy_to_user(buf,test_dev->kbuf,strlen(test_dev->kbuf))!=0)
-	{
-		printk("copy_to_user error\n");
-		return -1;
+	switch(cmd){
+		case EVENTFD_SET:
+			if(get_user(efd,(int __user *)arg))
+				return -EFAULT;
+			return evt_set(test_dev,file,efd);
+		default:
+			return -ENOTTY;
 	}
-
-	return 0;
 }
 
-/* 关闭设备函数 */
+/* 关闭设备函数：取消这个文件注册的 eventfd */
 static int cdev_test_release(struct inode *inode,struct file *file)
 {
+	evt_set((struct device_test *)file->private_data,file,-1);
 	return 0;
 }
 
@@ -101,11 +475,17 @@ static __poll_t cdev_test_poll(struct file *file,struct poll_table_struct *p){
 	__poll_t mask=0;
 	// 将等待队列添加到poll_table中
 	poll_wait(file,&read_wq,p);
+	poll_wait(file,&write_wq,p);
 	// 检查是否有数据可读
-	if(test_dev->flag ==1)
+	if(!kfifo_is_empty(&test_dev->fifo))
 	{
 		mask |= POLLIN;  // 设置可读标志
 	}
+	// 能放下一条最长的记录时可写
+	if(kfifo_avail(&test_dev->fifo)>=MSG_MAX)
+	{
+		mask |= POLLOUT;
+	}
 	return mask;
 }
 
@@ -126,15 +506,32 @@ struct file_operations cdev_test_fops={
 	.release=cdev_test_release,
 	.poll=cdev_test_poll,
 	.fasync=cdev_test_fasync,  // 添加异步通知操作
+	.unlocked_ioctl=cdev_test_ioctl,
 };
 
 /* 模块初始化函数 */
 static int __init chr_fops_init(void)
 {
 	int ret;
+
+	// 分配记录队列
+	ret=kfifo_alloc(&dev1.fifo,FIFO_SIZE,GFP_KERNEL);
+	if(ret<0)
+		return ret;
+	mutex_init(&dev1.lock);
+	ret=rec_stamps_alloc(&dev1.stamps);
+	if(ret<0)
+		goto err_chrdev;
+	ret=rec_lat_init(&dev1.lat,KBUILD_MODNAME);
+	if(ret<0)
+		goto err_chrdev;
+	INIT_LIST_HEAD(&dev1.evt_list);
+	atomic_set(&dev1.sig_pending,0);
+	spin_lock_init(&dev1.evt_lock);
 	
 	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
@@ -184,6 +581,9 @@ static int __init chr_fops_init(void)
 		unregister_chrdev_region(dev1.dev_num,1);
 
 	err_chrdev:
+		kfifo_free(&dev1.fifo);
+		rec_stamps_free(&dev1.stamps);
+		rec_lat_exit(&dev1.lat);
 		return ret;
 }
 
@@ -195,6 +595,9 @@ static void __exit chr_fops_exit(void)
 	class_destroy(dev1.class);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	kfifo_free(&dev1.fifo);
+	rec_stamps_free(&dev1.stamps);
+	rec_lat_exit(&dev1.lat);
 	printk("module exit\n");
 }
 
@@ -0,0 +1,434 @@
+/*
+ * 这是一个测量定时器到期抖动的内核模块，在 timer_mod.c 的基础上对比四种定时方式：
+ *   list      timer_list（jiffies 精度，软中断中执行）
+ *   hr_soft   hrtimer HRTIMER_MODE_ABS_SOFT（软中断中执行）
+ *   hr_hard   hrtimer HRTIMER_MODE_ABS（4.19 上不带 _SOFT 的模式在硬中断中执行）
+ *   dwork     delayed_work（jiffies 精度，工作队列的内核线程中执行）
+ * 每种方式运行 nr_timers 个周期为 period_us 的定时器，回调中记录实际到期时间比计划的到期时间晚了多少，
+ * 计划的到期时间按周期累加，不受上一次回调延迟的影响，错过的周期计入 overruns
+ * 可以打开后台压力：stress=1 每个CPU一个内核线程反复关抢占忙等，stress=2 反复关本地中断忙等，每次 stress_us
+ *   /sys/kernel/debug/timer_jitter/results  查看 min/avg/p99/max 和 log2 直方图
+ *   /sys/kernel/debug/timer_jitter/reset    写入任意值清空统计
+ * 使用方法：insmod timer_jitter.ko nr_timers=4 period_us=1000 stress=1
+ */
+
+#include<linux/module.h>
+#include<linux/init.h>
+#include<linux/timer.h>
+#include<linux/hrtimer.h>
+#include<linux/workqueue.h>
+#include<linux/kthread.h>
+#include<linux/delay.h>
+#include<linux/slab.h>
+#include<linux/vmalloc.h>
+#include<linux/sort.h>
+#include<linux/log2.h>
+#include<linux/math64.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+
+#define TJ_BUCKETS 32      // 第k个桶统计 [2^k,2^(k+1)) ns，最后一个桶包含更长的时间
+#define TJ_SAMPLES 65536   // 每种方式保留最近的这么多个样本计算 p99，必须是2的幂
+
+/* 每种方式运行的定时器个数 */
+static unsigned int nr_timers=4;
+module_param(nr_timers,uint,0444);
+MODULE_PARM_DESC(nr_timers,"periodic timers of each flavour, default 4");
+
+/* 定时器周期 */
+static unsigned int period_us=1000;
+module_param(period_us,uint,0444);
+MODULE_PARM_DESC(period_us,"timer period in microseconds, default 1000");
+
+/* 后台压力：0 无，1 关抢占忙等，2 关中断忙等 */
+static int stress;
+module_param(stress,int,0444);
+MODULE_PARM_DESC(stress,"background stress: 0 none, 1 preempt-off busy loop, 2 irq-off busy loop");
+
+/* 每次关抢占/关中断的时间 */
+static unsigned int stress_us=100;
+module_param(stress_us,uint,0444);
+MODULE_PARM_DESC(stress_us,"length of each stress busy loop in microseconds, default 100");
+
+/* 定时方式 */
+enum tj_type{
+	TJ_LIST,
+	TJ_HR_SOFT,
+	TJ_HR_HARD,
+	TJ_DWORK,
+	TJ_NR,
+};
+
+static const char * const tj_names[TJ_NR]={"list","hr_soft","hr_hard","dwork"};
+
+/* 一种方式的统计 */
+struct tj_stat{
+	raw_spinlock_t lock;   // hr_hard 的回调在硬中断中执行
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+	u64 overruns;          // 回调太晚，错过的周期数
+	u64 hist[TJ_BUCKETS];
+	atomic_t idx;          // 下一个样本的位置
+	u64 *samples;          // 最近 TJ_SAMPLES 个样本
+};
+
+/* 一个定时器 */
+struct tj_timer{
+	enum tj_type type;
+	u64 due_ns;            // 计划的到期时间
+	union{
+		struct timer_list list;
+		struct hrtimer hr;
+		struct delayed_work dwork;
+	};
+};
+
+static struct tj_stat tj_stats[TJ_NR];
+static struct tj_timer *tj_timers;     // TJ_NR*nr_timers 个定时器
+static u64 period_ns;
+static bool stopping;                  // 模块退出时置位，回调不再重新启动定时器
+static struct task_struct **stress_tasks;
+static struct dentry *tj_dir;
+
+/* 记录一次到期，返回下一次计划的到期时间，错过的周期跳过 */
+static u64 tj_record(struct tj_timer *t)
+{
+	struct tj_stat *st=&tj_stats[t->type];
+	unsigned long flags;
+	u64 now=ktime_get_ns();
+	u64 late=now>t->due_ns ? now-t->due_ns : 0;
+	u64 missed=0;
+	int k=late ? min_t(int,ilog2(late),TJ_BUCKETS-1) : 0;
+
+	st->samples[atomic_fetch_inc(&st->idx) & (TJ_SAMPLES-1)]=late;
+	t->due_ns+=period_ns;
+	if(t->due_ns<=now){
+		missed=div64_u64(now-t->due_ns,period_ns)+1;
+		t->due_ns+=missed*period_ns;
+	}
+
+	raw_spin_lock_irqsave(&st->lock,flags);
+	if(st->count==0 || late<st->min)
+		st->min=late;
+	if(late>st->max)
+		st->max=late;
+	st->count++;
+	st->sum+=late;
+	st->overruns+=missed;
+	st->hist[k]++;
+	raw_spin_unlock_irqrestore(&st->lock,flags);
+	return t->due_ns;
+}
+
+/* 计划的到期时间换算成相对的 jiffies，向上取整，保证不会提前到期 */
+static unsigned long tj_delay_jiffies(u64 due)
+{
+	u64 now=ktime_get_ns();
+
+	if(due<=now)
+		return 0;
+	return nsecs_to_jiffies(due-now+TICK_NSEC-1);
+}
+
+static void tj_list_fn(struct timer_list *l)
+{
+	struct tj_timer *t=from_timer(t,l,list);
+	u64 due=tj_record(t);
+
+	if(!READ_ONCE(stopping))
+		mod_timer(&t->list,jiffies+tj_delay_jiffies(due));
+}
+
+static enum hrtimer_restart tj_hr_fn(struct hrtimer *h)
+{
+	struct tj_timer *t=container_of(h,struct tj_timer,hr);
+	u64 due=tj_record(t);
+
+	if(READ_ONCE(stopping))
+		return HRTIMER_NORESTART;
+	hrtimer_set_expires(h,ns_to_ktime(due));
+	return HRTIMER_RESTART;
+}
+
+static void tj_dwork_fn(struct work_struct *w)
+{
+	struct tj_timer *t=container_of(to_delayed_work(w),struct tj_timer,dwork);
+	u64 due=tj_record(t);
+
+	if(!READ_ONCE(stopping))
+		queue_delayed_work(system_highpri_wq,&t->dwork,tj_delay_jiffies(due));
+}
+
+/* 启动一个定时器，第一次到期在一个周期之后 */
+static void tj_start(struct tj_timer *t)
+{
+	t->due_ns=ktime_get_ns()+period_ns;
+	switch(t->type){
+		case TJ_LIST:
+			timer_setup(&t->list,tj_list_fn,0);
+			mod_timer(&t->list,jiffies+tj_delay_jiffies(t->due_ns));
+			break;
+		case TJ_HR_SOFT:
+		case TJ_HR_HARD:
+			hrtimer_init(&t->hr,CLOCK_MONOTONIC,
+				t->type==TJ_HR_SOFT ? HRTIMER_MODE_ABS_SOFT : HRTIMER_MODE_ABS);
+			t->hr.function=tj_hr_fn;
+			hrtimer_start(&t->hr,ns_to_ktime(t->due_ns),
+				t->type==TJ_HR_SOFT ? HRTIMER_MODE_ABS_SOFT : HRTIMER_MODE_ABS);
+			break;
+		case TJ_DWORK:
+			INIT_DELAYED_WORK(&t->dwork,tj_dwork_fn);
+			queue_delayed_work(system_highpri_wq,&t->dwork,tj_delay_jiffies(t->due_ns));
+			break;
+		default:
+			break;
+	}
+}
+
+/* 停止一个定时器，stopping 已经置位，回调不会再重新启动它 */
+static void tj_stop(struct tj_timer *t)
+{
+	switch(t->type){
+		case TJ_LIST:
+			del_timer_sync(&t->list);
+			break;
+		case TJ_HR_SOFT:
+		case TJ_HR_HARD:
+			hrtimer_cancel(&t->hr);
+			break;
+		case TJ_DWORK:
+			cancel_delayed_work_sync(&t->dwork);
+			break;
+		default:
+			break;
+	}
+}
+
+/* 压力线程：反复关抢占或关中断忙等 stress_us，中间让出CPU */
+static int tj_stress_fn(void *data)
+{
+	unsigned long flags;
+
+	while(!kthread_should_stop()){
+		if(stress==2){
+			local_irq_save(flags);
+			udelay(stress_us);
+			local_irq_restore(flags);
+		}else{
+			preempt_disable();
+			udelay(stress_us);
+			preempt_enable();
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static void tj_stress_stop(void)
+{
+	int cpu;
+
+	if(stress_tasks==NULL)
+		return;
+	for_each_possible_cpu(cpu){
+		if(stress_tasks[cpu])
+			kthread_stop(stress_tasks[cpu]);
+	}
+	kfree(stress_tasks);
+	stress_tasks=NULL;
+}
+
+/* 每个在线CPU启动一个压力线程 */
+static int tj_stress_start(void)
+{
+	struct task_struct *task;
+	int cpu;
+
+	stress_tasks=kcalloc(nr_cpu_ids,sizeof(*stress_tasks),GFP_KERNEL);
+	if(stress_tasks==NULL)
+		return -ENOMEM;
+	for_each_online_cpu(cpu){
+		task=kthread_create(tj_stress_fn,NULL,"tj_stress/%d",cpu);
+		if(IS_ERR(task)){
+			tj_stress_stop();
+			return PTR_ERR(task);
+		}
+		kthread_bind(task,cpu);
+		stress_tasks[cpu]=task;
+		wake_up_process(task);
+	}
+	return 0;
+}
+
+static int tj_cmp_u64(const void *a,const void *b)
+{
+	u64 x=*(const u64 *)a;
+	u64 y=*(const u64 *)b;
+	return x<y ? -1 : x>y;
+}
+
+/* 最近的样本排序后取 p99 */
+static u64 tj_p99(struct tj_stat *st,u64 *buf)
+{
+	u64 n=min_t(u64,READ_ONCE(st->count),TJ_SAMPLES);
+
+	if(n==0)
+		return 0;
+	memcpy(buf,st->samples,n*sizeof(u64));
+	sort(buf,n,sizeof(u64),tj_cmp_u64,NULL);
+	return buf[div64_u64(n*99,100)];
+}
+
+/* results 文件：每种方式的汇总和直方图 */
+static int tj_show(struct seq_file *m,void *v)
+{
+	struct tj_stat *st;
+	unsigned long flags;
+	u64 hist[TJ_BUCKETS];
+	u64 count,sum,min,max,overruns;
+	u64 *buf,p99;
+	int t,k;
+
+	buf=vmalloc(TJ_SAMPLES*sizeof(u64));
+	if(buf==NULL)
+		return -ENOMEM;
+	seq_printf(m,"timers %u x %d, period %u us, stress %d (%u us), HZ %d\n",
+		nr_timers,TJ_NR,period_us,stress,stress_us,HZ);
+	for(t=0;t<TJ_NR;t++){
+		st=&tj_stats[t];
+		p99=tj_p99(st,buf);
+		raw_spin_lock_irqsave(&st->lock,flags);
+		count=st->count;
+		sum=st->sum;
+		min=st->min;
+		max=st->max;
+		overruns=st->overruns;
+		memcpy(hist,st->hist,sizeof(hist));
+		raw_spin_unlock_irqrestore(&st->lock,flags);
+		seq_printf(m,"%s: count %llu overruns %llu min %llu avg %llu p99 %llu max %llu (ns)\n",
+			tj_names[t],count,overruns,min,count ? div64_u64(sum,count) : 0,p99,max);
+		for(k=0;k<TJ_BUCKETS;k++){
+			if(hist[k]==0)
+				continue;
+			seq_printf(m,"  >= %-12llu %llu\n",1ULL<<k,hist[k]);
+		}
+	}
+	vfree(buf);
+	return 0;
+}
+
+static int tj_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,tj_show,NULL);
+}
+
+static const struct file_operations tj_fops={
+	.owner=THIS_MODULE,
+	.open=tj_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+/* reset 文件：写入任意内容清空统计 */
+static ssize_t tj_reset_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
+{
+	struct tj_stat *st;
+	unsigned long flags;
+	int t;
+
+	for(t=0;t<TJ_NR;t++){
+		st=&tj_stats[t];
+		raw_spin_lock_irqsave(&st->lock,flags);
+		st->count=st->sum=st->min=st->max=st->overruns=0;
+		memset(st->hist,0,sizeof(st->hist));
+		atomic_set(&st->idx,0);
+		raw_spin_unlock_irqrestore(&st->lock,flags);
+	}
+	return size;
+}
+
+static const struct file_operations tj_reset_fops={
+	.owner=THIS_MODULE,
+	.open=simple_open,
+	.write=tj_reset_write,
+	.llseek=noop_llseek,
+};
+
+static void tj_free_samples(void)
+{
+	int t;
+
+	for(t=0;t<TJ_NR;t++){
+		vfree(tj_stats[t].samples);
+		tj_stats[t].samples=NULL;
+	}
+}
+
+/* 模块初始化函数 */
+static int __init timer_jitter_init(void)
+{
+	int t,i,ret;
+
+	if(nr_timers==0 || period_us==0)
+		return -EINVAL;
+	period_ns=(u64)period_us*NSEC_PER_USEC;
+	for(t=0;t<TJ_NR;t++){
+		raw_spin_lock_init(&tj_stats[t].lock);
+		tj_stats[t].samples=vzalloc(TJ_SAMPLES*sizeof(u64));
+		if(tj_stats[t].samples==NULL){
+			tj_free_samples();
+			return -ENOMEM;
+		}
+	}
+	tj_timers=kcalloc(TJ_NR*nr_timers,sizeof(*tj_timers),GFP_KERNEL);
+	if(tj_timers==NULL){
+		tj_free_samples();
+		return -ENOMEM;
+	}
+
+	if(stress){
+		ret=tj_stress_start();
+		if(ret<0){
+			kfree(tj_timers);
+			tj_free_samples();
+			return ret;
+		}
+	}
+
+	tj_dir=debugfs_create_dir("timer_jitter",NULL);
+	debugfs_create_file("results",0444,tj_dir,NULL,&tj_fops);
+	debugfs_create_file("reset",0200,tj_dir,NULL,&tj_reset_fops);
+
+	// 各种方式的定时器交错启动
+	for(i=0;i<nr_timers;i++){
+		for(t=0;t<TJ_NR;t++){
+			tj_timers[i*TJ_NR+t].type=t;
+			tj_start(&tj_timers[i*TJ_NR+t]);
+		}
+	}
+	return 0;
+}
+
+/* 模块退出函数 */
+static void __exit timer_jitter_exit(void)
+{
+	int i;
+
+	WRITE_ONCE(stopping,true);
+	for(i=0;i<TJ_NR*nr_timers;i++)
+		tj_stop(&tj_timers[i]);
+	tj_stress_stop();
+	debugfs_remove_recursive(tj_dir);
+	kfree(tj_timers);
+	tj_free_samples();
+	printk("module exit\n");
+}
+
+// 模块入口和出口
+module_init(timer_jitter_init);
+module_exit(timer_jitter_exit);
+MODULE_LICENSE("GPL v2");
+MODULE_AUTHOR("topeet");
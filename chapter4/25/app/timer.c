@@ -1,32 +1,52 @@
 /*
  * 这是一个测试程序，用于测试计时器设备驱动
- * 该程序每秒读取一次设备中的计数值并打印
+ * 该程序每秒读取一次设备中的计数值，打印累计的周期数、这一秒内增加的周期数和错过的周期数
+ * 驱动的周期由模块参数指定，例如 insmod timer_dev.ko period_us=100
  */
 
 #include<stdio.h>
+#include<stdint.h>
 #include<sys/types.h>
 #include<sys/stat.h>
 #include<fcntl.h>
 #include<unistd.h>
 
+/* 与驱动中的定义保持一致 */
+struct timer_info{
+	uint64_t ticks;     // 累计的周期数
+	uint64_t overruns;  // 错过的周期数
+};
+
 int main(int argc,char *argv[])
 {
-	int fd;          // 文件描述符
-	int count;       // 计数值
+	int fd;                       // 文件描述符
+	struct timer_info info;       // 计数值
+	uint64_t last=0;              // 上一次读到的周期数
 
 	// 打开设备节点
 	fd=open("/dev/test",O_RDWR);
-	
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+
 	// 主循环：每秒读取一次计数值
 	while(1)
 	{
-		// 从设备读取计数值
-		read(fd,&count,sizeof(count));
 		// 延时1秒
 		sleep(1);
+		// 从设备读取计数值
+		if(read(fd,&info,sizeof(info))!=sizeof(info)){
+			printf("read error\n");
+			break;
+		}
 		// 打印计数值
-		printf("num is %d \n",count);
+		printf("num is %llu, +%llu in the last second, overruns %llu\n",
+			(unsigned long long)info.ticks,(unsigned long long)(info.ticks-last),
+			(unsigned long long)info.overruns);
+		last=info.ticks;
 	}
 
+	close(fd);
 	return 0;
 }
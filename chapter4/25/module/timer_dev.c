@@ -1,6 +1,7 @@
 /*
  * 这是一个Linux内核模块示例，演示了字符设备驱动与内核定时器的结合使用
- * 该模块实现了一个简单的计时器设备，每秒更新一次计数值
+ * 该模块实现了一个计时器设备，用高精度定时器（hrtimer）按固定周期更新计数值，
+ * 周期由模块参数 period_us 指定，最小10us，默认1秒
  */
 
 #include<linux/module.h>
@@ -10,6 +11,42 @@
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
 #include<linux/atomic.h>
+#include<linux/hrtimer.h>
+#include<linux/ktime.h>
+#include<linux/mutex.h>
+#include<linux/moduleparam.h>
+
+#define PERIOD_MIN_US 10  // 最小周期，再小的话定时器中断会占满CPU
+
+/* read 返回的计数值，用户缓冲区小于这个结构体时只复制前面的部分 */
+struct timer_info{
+	__u64 ticks;     // 累计的周期数，包括错过的周期
+	__u64 overruns;  // 错过的周期数：回调函数执行时已经过了不止一个周期
+};
+
+/* 定时周期（us），修改后从下一个周期开始生效 */
+static unsigned int period_us=1000000;
+
+static int period_set(const char *val,const struct kernel_param *kp)
+{
+	unsigned int us;
+	int ret;
+
+	ret=kstrtouint(val,0,&us);
+	if(ret<0)
+		return ret;
+	if(us<PERIOD_MIN_US)
+		return -EINVAL;
+	WRITE_ONCE(period_us,us);
+	return 0;
+}
+
+static const struct kernel_param_ops period_ops={
+	.set=period_set,
+	.get=param_get_uint,
+};
+module_param_cb(period_us,&period_ops,&period_us,0644);
+MODULE_PARM_DESC(period_us,"tick period in microseconds (>= 10)");
 
 /* 设备结构体定义 */
 struct device_test{
@@ -19,58 +56,78 @@ struct device_test{
 	struct cdev cdev_test; // 字符设备结构体
 	struct class *class;   // 设备类
 	struct device *device;  // 设备结构体
-	int sec;              // 计时器计数值
+	struct hrtimer timer;  // 高精度定时器
+	atomic64_t ticks;      // 累计的周期数
+	atomic64_t overruns;   // 错过的周期数
+	struct mutex lock;     // 保护 users，第一次打开时启动定时器，最后一次关闭时停止
+	int users;             // 打开设备的次数
 };
 
-/* 定义原子变量用于计数 */
-atomic64_t v=ATOMIC_INIT(0);
 /* 定义设备实例 */
 struct device_test dev1;
 
-/* 定时器回调函数声明 */
-static void function_test(struct timer_list *t);
-
-/* 定义定时器结构体，并指定回调函数 */
-DEFINE_TIMER(timer_test,function_test);
-
-/* 定时器回调函数实现 */
-static void function_test(struct timer_list *t)
+/*
+ * 定时器回调函数，在硬中断（PREEMPT_RT 下为软中断）中执行
+ * hrtimer_forward_now 把到期时间向后推到当前时间之后，返回推过的周期数，
+ * 回调被推迟超过一个周期时返回值大于1，多出来的就是错过的周期
+ */
+static enum hrtimer_restart function_test(struct hrtimer *t)
 {
-	// 原子操作增加计数值
-	atomic64_inc(&v);
-	// 更新设备结构体中的计数值
-	dev1.sec=atomic_read(&v);
-	// 重新设置定时器，1秒后再次触发
-	mod_timer(&timer_test,jiffies_64+msecs_to_jiffies(1000));
+	struct device_test *test_dev=container_of(t,struct device_test,timer);
+	u64 n;
+
+	n=hrtimer_forward_now(t,ns_to_ktime((u64)READ_ONCE(period_us)*NSEC_PER_USEC));
+	atomic64_add(n,&test_dev->ticks);
+	if(n>1)
+		atomic64_add(n-1,&test_dev->overruns);
+	return HRTIMER_RESTART;
 }
 
-/* 打开设备函数 */
+/* 打开设备函数：第一次打开时清零计数并启动定时器 */
 static int cdev_test_open(struct inode *inode,struct file *file)
 {
+	struct device_test *test_dev=&dev1;
+
 	// 设置私有数据
-	file->private_data=&dev1;
-	// 启动定时器
-	add_timer(&timer_test);
+	file->private_data=test_dev;
+	mutex_lock(&test_dev->lock);
+	if(test_dev->users++==0){
+		atomic64_set(&test_dev->ticks,0);
+		atomic64_set(&test_dev->overruns,0);
+		// 启动定时器
+		hrtimer_start(&test_dev->timer,ns_to_ktime((u64)READ_ONCE(period_us)*NSEC_PER_USEC),HRTIMER_MODE_REL);
+	}
+	mutex_unlock(&test_dev->lock);
 	return 0;
 }
 
-/* 读设备函数 */
+/* 读设备函数：返回累计的周期数和错过的周期数，返回复制的字节数 */
 static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
 {
+	struct device_test *test_dev=(struct device_test *)file->private_data;
+	struct timer_info info;
+
+	info.ticks=atomic64_read(&test_dev->ticks);
+	info.overruns=atomic64_read(&test_dev->overruns);
+	size=min(size,sizeof(info));
 	// 将计数值复制到用户空间
-	if(copy_to_user(buf,&dev1.sec,sizeof(dev1.sec)))
+	if(copy_to_user(buf,&info,size))
 	{
 		printk("copy_to_user error\n");
-		return -1;
+		return -EFAULT;
 	}
-	return 0;
+	return size;
 }
 
-/* 关闭设备函数 */
+/* 关闭设备函数：最后一次关闭时停止定时器 */
 static int cdev_test_release(struct inode *inode,struct file *file)
 {
-	// 删除定时器
-	del_timer(&timer_test);
+	struct device_test *test_dev=(struct device_test *)file->private_data;
+
+	mutex_lock(&test_dev->lock);
+	if(--test_dev->users==0)
+		hrtimer_cancel(&test_dev->timer);  // 等待正在执行的回调函数返回
+	mutex_unlock(&test_dev->lock);
 	return 0;
 }
 
@@ -86,9 +143,15 @@ struct file_operations cdev_test_fops={
 static int __init timer_dev_init(void)
 {
 	int ret;
+
+	// 初始化定时器，CLOCK_MONOTONIC 不受系统时间修改的影响
+	hrtimer_init(&dev1.timer,CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+	dev1.timer.function=function_test;
+	mutex_init(&dev1.lock);
 	
 	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
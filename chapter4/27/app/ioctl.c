@@ -1,7 +1,8 @@
 /*
  * 这是一个测试程序，用于测试字符设备驱动的ioctl功能
  * 该程序演示了如何使用ioctl命令与设备驱动进行通信
- * 支持两种操作模式：write和read
+ * 支持三种操作模式：write、read和batch
+ * batch 把 CMD_TEST0/CMD_TEST1/CMD_TEST2 放在一个数组里，用一次 CMD_BATCH 提交
  */
 
 #include<stdio.h>
@@ -11,16 +12,37 @@
 #include<unistd.h>
 #include<sys/ioctl.h>
 #include<string.h>
+#include<stdint.h>
 
 /* 定义ioctl命令，需要与驱动中的定义保持一致 */
 #define CMD_TEST0 _IO('L',0)     // 无参数的命令
 #define CMD_TEST1 _IOW('L',1,int)// 写命令，带参数
 #define CMD_TEST2 _IOR('L',2,int)// 读命令，带参数
 
+/* 批量命令，需要与 include/ioctl_batch.h 中的定义保持一致 */
+struct ioctl_cmd{
+	uint32_t cmd;     // ioctl 命令
+	int32_t result;   // 返回值，由驱动写回
+	uint64_t arg;     // ioctl 参数
+};
+
+struct ioctl_batch{
+	uint64_t cmds;    // struct ioctl_cmd 数组的地址
+	uint32_t nr;      // 命令数
+	uint32_t flags;   // 1 表示遇到失败的命令就停下
+	uint32_t done;    // 执行了多少条，由驱动写回
+	uint32_t rsv;
+};
+
+#define CMD_BATCH _IOWR('L',0x10,struct ioctl_batch)
+
 int main(int argc,char *argv[])
 {
 	int fd;          // 文件描述符
 	int val;         // 用于存储读取的值
+	struct ioctl_cmd cmds[3];
+	struct ioctl_batch batch;
+	int i;
 
 	// 打开设备节点
 	fd=open("/dev/test",O_RDWR);
@@ -39,6 +61,25 @@ int main(int argc,char *argv[])
 		ioctl(fd,CMD_TEST2,&val);
 		printf("val is %d\n",val);
 	}
+	else if(!strcmp(argv[1],"batch")){
+		// 三条命令一次提交，指针参数和单独调用时一样放在 arg 中
+		memset(cmds,0,sizeof(cmds));
+		cmds[0].cmd=CMD_TEST0;
+		cmds[1].cmd=CMD_TEST1;
+		cmds[1].arg=1;
+		cmds[2].cmd=CMD_TEST2;
+		cmds[2].arg=(uintptr_t)&val;
+		memset(&batch,0,sizeof(batch));
+		batch.cmds=(uintptr_t)cmds;
+		batch.nr=3;
+		if(ioctl(fd,CMD_BATCH,&batch)<0){
+			perror("batch error");
+		}else{
+			for(i=0;i<(int)batch.done;i++)
+				printf("cmd %d result %d\n",i,cmds[i].result);
+			printf("val is %d\n",val);
+		}
+	}
 
 	// 关闭设备
 	close(fd);
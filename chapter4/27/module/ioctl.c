@@ -2,6 +2,7 @@
  * 这是一个Linux内核模块示例，演示了字符设备驱动的基本操作
  * 包括：设备注册、ioctl命令的实现等
  * 该模块实现了一个简单的字符设备，支持三种ioctl命令
+ * 还支持 CMD_BATCH（见 ../include/ioctl_batch.h），一次系统调用执行多条命令
  */
 
 #include<linux/module.h>
@@ -10,6 +11,7 @@
 #include<linux/kdev_t.h>
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
+#include"ioctl_batch.h"
 
 /* 定义ioctl命令 */
 #define CMD_TEST0 _IO('L',0)     // 无参数的命令
@@ -30,8 +32,8 @@ struct device_test{
 /* 定义设备实例 */
 struct device_test dev1;
 
-/* ioctl命令处理函数 */
-static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+/* 处理一条ioctl命令，单独调用和批量调用共用 */
+static long do_cmd(struct file *file,unsigned int cmd,unsigned long arg)
 {
 	int val;
 	switch(cmd){
@@ -49,14 +51,23 @@ static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg
 			if(copy_to_user((int *)arg,&val,sizeof(val))!=0)
 			{
 				printk("copy_to_user error\n");
+				return -EFAULT;
 			}
 			break;
 		default:
-			break;
+			return -ENOTTY;
 	}
 	return 0;
 }
 
+/* ioctl命令处理函数 */
+static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	if(cmd==CMD_BATCH)
+		return ioctl_batch_run(file,arg,do_cmd);
+	return do_cmd(file,cmd,arg);
+}
+
 /* 文件操作结构体 */
 struct file_operations cdev_test_fops={
 	.owner=THIS_MODULE,
@@ -1,6 +1,8 @@
 /*
  * 这是一个用户空间测试程序，用于测试字符设备驱动的ioctl功能
  * 该程序通过ioctl命令向内核空间发送结构体参数
+ * 使用方法：./ioctl        发送一个结构体
+ *           ./ioctl batch  用一次 CMD_BATCH 发送多个结构体
  */
 
 #include<stdio.h>
@@ -10,10 +12,28 @@
 #include<unistd.h>
 #include<sys/ioctl.h>
 #include<string.h>
+#include<stdint.h>
 
 /* 定义ioctl命令，需要与内核模块中的定义保持一致 */
 #define CMD_TEST0 _IOW('L',0,int)
 
+/* 批量命令，需要与 include/ioctl_batch.h 中的定义保持一致 */
+struct ioctl_cmd{
+	uint32_t cmd;     // ioctl 命令
+	int32_t result;   // 返回值，由驱动写回
+	uint64_t arg;     // ioctl 参数
+};
+
+struct ioctl_batch{
+	uint64_t cmds;    // struct ioctl_cmd 数组的地址
+	uint32_t nr;      // 命令数
+	uint32_t flags;   // 1 表示遇到失败的命令就停下
+	uint32_t done;    // 执行了多少条，由驱动写回
+	uint32_t rsv;
+};
+
+#define CMD_BATCH _IOWR('L',0x10,struct ioctl_batch)
+
 /* 定义参数结构体，需要与内核模块中的定义保持一致 */
 struct args{
 	int a;    // 参数a
@@ -25,6 +45,10 @@ int main(int argc,char *argv[])
 {
 	int fd;           // 文件描述符
 	struct args test; // 测试参数结构体
+	struct args tests[16];
+	struct ioctl_cmd cmds[16];
+	struct ioctl_batch batch;
+	int i;
 
 	// 初始化测试参数
 	test.a=1;
@@ -39,8 +63,27 @@ int main(int argc,char *argv[])
 		printf("file open error\n");	
 	}
 	
-	// 通过ioctl发送结构体参数到内核空间
-	ioctl(fd,CMD_TEST0,&test);
+	if(argc>1 && !strcmp(argv[1],"batch")){
+		// 16个结构体一次提交，每条命令的 arg 指向一个结构体
+		for(i=0;i<16;i++){
+			tests[i].a=i;
+			tests[i].b=i*2;
+			tests[i].c=i*3;
+			cmds[i].cmd=CMD_TEST0;
+			cmds[i].result=0;
+			cmds[i].arg=(uintptr_t)&tests[i];
+		}
+		memset(&batch,0,sizeof(batch));
+		batch.cmds=(uintptr_t)cmds;
+		batch.nr=16;
+		if(ioctl(fd,CMD_BATCH,&batch)<0)
+			perror("batch error");
+		else
+			printf("batch done %u\n",batch.done);
+	}else{
+		// 通过ioctl发送结构体参数到内核空间
+		ioctl(fd,CMD_TEST0,&test);
+	}
 
 	// 关闭设备文件
 	close(fd);
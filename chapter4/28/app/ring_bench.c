@@ -0,0 +1,261 @@
+/*
+ * 这是一个命令提交开销的测试程序，对比四种方式执行N条 CMD_TEST0 的平均开销：
+ *   ioctl   每条命令一次 ioctl，驱动 copy_from_user 一个 struct args
+ *   batch   CMD_BATCH 每次提交64条
+ *   ring    mmap 共享内存队列，命令写进 SQ，每批调用一次 RING_ENTER
+ *   sqpoll  共享内存队列加内核线程轮询，只有线程睡眠后才需要 RING_ENTER 唤醒
+ * 测试前加载模块时关闭打印：insmod ioctl.ko verbose=0
+ * 使用方法：./ring_bench [命令条数]
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<time.h>
+
+/* 与驱动中的定义保持一致 */
+#define CMD_TEST0 _IOW('L',0,int)
+
+struct args{
+	int a;
+	int b;
+	int c;
+};
+
+struct ioctl_cmd{
+	uint32_t cmd;
+	int32_t result;
+	uint64_t arg;
+};
+
+struct ioctl_batch{
+	uint64_t cmds;
+	uint32_t nr;
+	uint32_t flags;
+	uint32_t done;
+	uint32_t rsv;
+};
+
+#define CMD_BATCH _IOWR('L',0x10,struct ioctl_batch)
+
+struct ring_ctl{
+	uint32_t head;
+	uint32_t tail;
+	uint32_t mask;
+	uint32_t flags;
+	uint32_t dropped;
+	uint32_t rsv[11];
+};
+
+struct ring_sqe{
+	uint32_t cmd;
+	uint32_t rsv;
+	uint64_t user_data;
+	struct args args;
+	uint32_t pad;
+};
+
+struct ring_cqe{
+	uint64_t user_data;
+	int32_t res;
+	uint32_t rsv;
+};
+
+struct ring_params{
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+	uint32_t sq_idle_ms;
+	uint32_t sqes_off;
+	uint32_t cqes_off;
+	uint32_t mmap_size;
+	uint32_t rsv;
+};
+
+#define RING_SQPOLL 1
+#define RING_NEED_WAKEUP 1
+#define RING_SETUP _IOWR('L',1,struct ring_params)
+#define RING_ENTER _IO('L',2)
+
+#define BATCH 64
+#define SQ_ENTRIES 256
+
+static int count=1000000;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+static int dev_open(void)
+{
+	int fd=open("/dev/test",O_RDWR);
+	if(fd<0)
+		perror("file open error");
+	return fd;
+}
+
+static void report(const char *name,uint64_t ns,uint64_t syscalls)
+{
+	printf("%-7s %d cmds: %6.1f ns/cmd, %llu syscalls\n",name,count,(double)ns/count,
+		(unsigned long long)syscalls);
+}
+
+/* 每条命令一次 ioctl */
+static void bench_ioctl(void)
+{
+	struct args test={1,2,3};
+	uint64_t t0;
+	int fd,i;
+
+	fd=dev_open();
+	if(fd<0)
+		return;
+	t0=now_ns();
+	for(i=0;i<count;i++)
+		ioctl(fd,CMD_TEST0,&test);
+	report("ioctl",now_ns()-t0,count);
+	close(fd);
+}
+
+/* CMD_BATCH 每次提交 BATCH 条 */
+static void bench_batch(void)
+{
+	struct args tests[BATCH];
+	struct ioctl_cmd cmds[BATCH];
+	struct ioctl_batch batch;
+	uint64_t t0,calls=0;
+	int fd,i,n,done=0;
+
+	fd=dev_open();
+	if(fd<0)
+		return;
+	for(i=0;i<BATCH;i++){
+		tests[i].a=1;
+		tests[i].b=2;
+		tests[i].c=3;
+		cmds[i].cmd=CMD_TEST0;
+		cmds[i].result=0;
+		cmds[i].arg=(uintptr_t)&tests[i];
+	}
+	memset(&batch,0,sizeof(batch));
+	batch.cmds=(uintptr_t)cmds;
+	t0=now_ns();
+	while(done<count){
+		n=count-done<BATCH ? count-done : BATCH;
+		batch.nr=n;
+		if(ioctl(fd,CMD_BATCH,&batch)<0){
+			perror("batch error");
+			break;
+		}
+		calls++;
+		done+=n;
+	}
+	report("batch",now_ns()-t0,calls);
+	close(fd);
+}
+
+/* 共享内存队列，sqpoll 为1时由内核线程轮询 */
+static void bench_ring(int sqpoll)
+{
+	struct ring_params p;
+	struct ring_ctl *sq,*cq;
+	struct ring_sqe *sqes,*sqe;
+	struct ring_cqe *cqes;
+	uint32_t tail,head;
+	uint64_t t0,calls=0;
+	int fd,submitted=0,completed=0,errors=0;
+	char *mem;
+
+	fd=dev_open();
+	if(fd<0)
+		return;
+	memset(&p,0,sizeof(p));
+	p.sq_entries=SQ_ENTRIES;
+	p.flags=sqpoll ? RING_SQPOLL : 0;
+	if(ioctl(fd,RING_SETUP,&p)<0){
+		perror("RING_SETUP error");
+		close(fd);
+		return;
+	}
+	mem=mmap(NULL,p.mmap_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	if(mem==MAP_FAILED){
+		perror("mmap error");
+		close(fd);
+		return;
+	}
+	sq=(struct ring_ctl *)mem;
+	cq=(struct ring_ctl *)(mem+sizeof(struct ring_ctl));
+	sqes=(struct ring_sqe *)(mem+p.sqes_off);
+	cqes=(struct ring_cqe *)(mem+p.cqes_off);
+
+	t0=now_ns();
+	while(completed<count){
+		// 把 SQ 填满，命令写完之后再 release 推进 tail
+		tail=sq->tail;
+		head=__atomic_load_n(&sq->head,__ATOMIC_ACQUIRE);
+		while(submitted<count && tail-head<p.sq_entries){
+			sqe=&sqes[tail & (p.sq_entries-1)];
+			sqe->cmd=CMD_TEST0;
+			sqe->user_data=submitted;
+			sqe->args.a=1;
+			sqe->args.b=2;
+			sqe->args.c=3;
+			tail++;
+			submitted++;
+		}
+		__atomic_store_n(&sq->tail,tail,__ATOMIC_RELEASE);
+
+		// 普通模式每批敲一次门铃；sqpoll 模式只在内核线程睡眠时唤醒它
+		if(!sqpoll){
+			ioctl(fd,RING_ENTER,0);
+			calls++;
+		}else{
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if(__atomic_load_n(&sq->flags,__ATOMIC_RELAXED) & RING_NEED_WAKEUP){
+				ioctl(fd,RING_ENTER,0);
+				calls++;
+			}
+		}
+
+		// 取走所有完成的结果
+		head=cq->head;
+		tail=__atomic_load_n(&cq->tail,__ATOMIC_ACQUIRE);
+		while(head!=tail){
+			if(cqes[head & (p.cq_entries-1)].res<0)
+				errors++;
+			head++;
+			completed++;
+		}
+		__atomic_store_n(&cq->head,head,__ATOMIC_RELEASE);
+	}
+	report(sqpoll ? "sqpoll" : "ring",now_ns()-t0,calls);
+	if(errors)
+		printf("        %d commands failed\n",errors);
+	munmap(mem,p.mmap_size);
+	close(fd);
+}
+
+int main(int argc,char *argv[])
+{
+	if(argc>1)
+		count=atoi(argv[1]);
+	if(count<=0){
+		printf("usage: %s [commands]\n",argv[0]);
+		return -1;
+	}
+	bench_ioctl();
+	bench_batch();
+	bench_ring(0);
+	bench_ring(1);
+	return 0;
+}
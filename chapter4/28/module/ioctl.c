@@ -2,6 +2,8 @@
  * 这是一个Linux内核模块示例，演示了字符设备驱动的基本操作
  * 包括：设备注册、ioctl命令的实现等
  * 该模块实现了一个简单的字符设备，支持通过ioctl传递结构体参数
+ * 还支持 CMD_BATCH（见 ../include/ioctl_batch.h），一次系统调用执行多条命令
+ * 以及 mmap 共享内存的提交/完成队列（RING_SETUP/RING_ENTER/poll，可选内核线程轮询），不需要逐条 copy_from_user
  */
 
 #include<linux/module.h>
@@ -10,6 +12,16 @@
 #include<linux/kdev_t.h>
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
+#include<linux/slab.h>
+#include<linux/vmalloc.h>
+#include<linux/mm.h>
+#include<linux/mutex.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/kthread.h>
+#include<linux/log2.h>
+#include<linux/capability.h>
+#include"ioctl_batch.h"
 
 /* 定义ioctl命令 */
 #define CMD_TEST0 _IOW('L',0,int)  // 写命令，用于传递结构体参数
@@ -21,6 +33,68 @@ struct args{
 	int c;    // 参数c
 };
 
+/*
+ * 共享内存命令队列，和 io_uring 一样分成提交队列(SQ)和完成队列(CQ)：
+ * 用户空间用 RING_SETUP 建立队列，mmap 映射整块共享内存，把命令写进 SQ 后推进 sq.tail，
+ * 驱动取出命令执行，把结果写进 CQ 后推进 cq.tail，用户空间读出结果后推进 cq.head
+ * 内存布局：[sq 控制块][cq 控制块][sqes_off: SQ 数组][cqes_off: CQ 数组]
+ * 提交方式：
+ *   RING_ENTER ioctl 执行 SQ 中的所有命令，arg 带 RING_ENTER_WAIT 时等到 CQ 非空再返回
+ *   poll 同样先执行 SQ 中的命令，CQ 非空时返回可读
+ *   RING_SQPOLL 模式下由内核线程轮询 SQ，不需要系统调用；空闲 sq_idle_ms 后线程睡眠，
+ *   在 sq.flags 中置 RING_NEED_WAKEUP，用户空间看到这个标志时调用一次 RING_ENTER 唤醒它
+ */
+struct ring_ctl{
+	__u32 head;       // 消费者推进
+	__u32 tail;       // 生产者推进
+	__u32 mask;       // 队列长度-1
+	__u32 flags;      // RING_NEED_WAKEUP
+	__u32 dropped;    // 不认识的命令数（只在 sq 中使用）
+	__u32 rsv[11];    // 填满一个 cache line，sq 和 cq 的控制块互不干扰
+};
+
+/* 提交队列的一项 */
+struct ring_sqe{
+	__u32 cmd;        // 命令，目前支持 CMD_TEST0
+	__u32 rsv;
+	__u64 user_data;  // 原样带回完成队列
+	struct args args; // 命令参数直接放在共享内存中，不需要 copy_from_user
+	__u32 pad;
+};
+
+/* 完成队列的一项 */
+struct ring_cqe{
+	__u64 user_data;
+	__s32 res;        // 命令的返回值
+	__u32 rsv;
+};
+
+/* RING_SETUP 的参数 */
+struct ring_params{
+	__u32 sq_entries;  // 提交队列长度，向上取2的幂，cq_entries 为它的2倍
+	__u32 cq_entries;  // 由驱动写回
+	__u32 flags;       // RING_SQPOLL
+	__u32 sq_idle_ms;  // 内核线程空闲多久后睡眠，0表示默认值(最大值)
+	__u32 sqes_off;    // 由驱动写回，SQ 数组在共享内存中的偏移
+	__u32 cqes_off;    // 由驱动写回，CQ 数组在共享内存中的偏移
+	__u32 mmap_size;   // 由驱动写回，mmap 的长度
+	__u32 rsv;
+};
+
+#define RING_SQPOLL 1          // 由内核线程轮询 SQ
+#define RING_NEED_WAKEUP 1     // sq.flags：内核线程在睡眠，需要 RING_ENTER 唤醒
+#define RING_ENTER_WAIT 1      // RING_ENTER 的参数：等到 CQ 非空
+#define RING_MAX_ENTRIES 4096
+#define RING_MAX_IDLE_MS 1000  // 内核线程空闲轮询的最长时间
+
+#define RING_SETUP _IOWR('L',1,struct ring_params) // 建立共享内存队列
+#define RING_ENTER _IO('L',2)                      // 执行 SQ 中的命令，返回执行的条数
+
+/* 打印命令的参数 */
+static bool verbose=true;
+module_param(verbose,bool,0644);
+MODULE_PARM_DESC(verbose,"printk the args of every command, turn off for benchmarks");
+
 /* 设备结构体定义 */
 struct device_test{
 	dev_t dev_num;        // 设备号
@@ -31,11 +105,43 @@ struct device_test{
 	struct device *device;// 设备结构体
 };
 
+/* 每次 open 的共享内存队列 */
+struct cmd_ring{
+	struct mutex lock;         // 保护队列的建立和命令的执行
+	void *mem;                 // 共享内存，vmalloc_user 分配
+	size_t size;
+	struct ring_ctl *sq;
+	struct ring_ctl *cq;
+	struct ring_sqe *sqes;
+	struct ring_cqe *cqes;
+	u32 sq_entries;            // 驱动自己保存的长度，不信任共享内存中的 mask
+	u32 cq_entries;
+	u32 sq_head;               // SQ 的消费者位置和 CQ 的生产者位置只在驱动中维护，
+	u32 cq_tail;               // 共享内存中的 sq.head/cq.tail 只是发布给用户空间的副本
+	wait_queue_head_t cq_wait; // 等待 CQ 非空的进程
+	struct task_struct *thread;// RING_SQPOLL 的内核线程
+	wait_queue_head_t sq_wait; // 内核线程睡眠的等待队列
+	bool sq_wake;              // RING_ENTER 唤醒内核线程
+	unsigned long idle;        // 内核线程空闲多久后睡眠(jiffies)
+};
+
 /* 定义设备实例 */
 struct device_test dev1;
 
-/* ioctl命令处理函数 */
-static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+/* 执行一条 CMD_TEST0，ioctl 和共享内存队列共用 */
+static long do_args(struct args *test)
+{
+	// 打印接收到的参数值
+	if(verbose){
+		printk("a= %d\n",test->a);
+		printk("b= %d\n",test->b);
+		printk("c= %d\n",test->c);
+	}
+	return 0;
+}
+
+/* 处理一条ioctl命令，单独调用和批量调用共用 */
+static long do_cmd(struct file *file,unsigned int cmd,unsigned long arg)
 {
 	struct args test;
 	switch(cmd){
@@ -43,21 +149,273 @@ static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg
 			// 从用户空间复制结构体数据到内核空间
 			if(copy_from_user(&test,(int *)arg,sizeof(test))!=0){
 				printk("copy_from_user error\n");
+				return -EFAULT;
 			}
-			// 打印接收到的参数值
-			printk("a= %d\n",test.a);
-			printk("b= %d\n",test.b);
-			printk("c= %d\n",test.c);
-			break;
+			return do_args(&test);
 		default:
-			break;
+			return -ENOTTY;
 	}
 	return 0;
 }
 
+static bool ring_cq_empty(struct cmd_ring *r)
+{
+	return READ_ONCE(r->cq->head)==READ_ONCE(r->cq_tail);
+}
+
+static bool ring_sq_empty(struct cmd_ring *r)
+{
+	return READ_ONCE(r->sq_head)==smp_load_acquire(&r->sq->tail);
+}
+
+/* 执行 SQ 中的所有命令，CQ 满时停下，返回执行的条数，调用者持有 r->lock */
+static int ring_process(struct cmd_ring *r)
+{
+	u32 sq_head=r->sq_head;
+	u32 sq_tail=smp_load_acquire(&r->sq->tail);  // 和用户空间推进 tail 的 release 配对，先看到命令再看到 tail
+	u32 cq_tail=r->cq_tail;
+	u32 cq_head=READ_ONCE(r->cq->head);
+	struct ring_sqe sqe;
+	struct ring_cqe *cqe;
+	int n=0;
+
+	// sq.tail 和 cq.head 由用户空间修改，超出队列长度的 tail 不合法，不执行；
+	// cq.head 不合法时下面的检查把 CQ 当作满，不会覆盖还没有取走的结果
+	if(sq_tail-sq_head>r->sq_entries)
+		return 0;
+
+	while(sq_head!=sq_tail){
+		if(cq_tail-cq_head>=r->cq_entries)
+			break;  // CQ 满了，剩下的命令等用户空间取走结果后再执行
+		// 命令在共享内存中，用户空间随时可能修改，先复制一份再使用
+		memcpy(&sqe,&r->sqes[sq_head & (r->sq_entries-1)],sizeof(sqe));
+		cqe=&r->cqes[cq_tail & (r->cq_entries-1)];
+		cqe->user_data=sqe.user_data;
+		if(sqe.cmd==CMD_TEST0){
+			cqe->res=do_args(&sqe.args);
+		}else{
+			cqe->res=-EINVAL;
+			WRITE_ONCE(r->sq->dropped,r->sq->dropped+1);
+		}
+		sq_head++;
+		cq_tail++;
+		n++;
+	}
+	if(n){
+		WRITE_ONCE(r->sq_head,sq_head);
+		WRITE_ONCE(r->cq_tail,cq_tail);
+		smp_store_release(&r->sq->head,sq_head);
+		smp_store_release(&r->cq->tail,cq_tail);  // 先写完 cqe 再推进 tail
+		wake_up_interruptible_poll(&r->cq_wait,EPOLLIN|EPOLLRDNORM);
+	}
+	return n;
+}
+
+/* RING_SQPOLL 的内核线程：一直轮询 SQ，空闲一段时间后睡眠 */
+static int ring_thread(void *data)
+{
+	struct cmd_ring *r=data;
+	unsigned long last=jiffies;
+	int n;
+
+	while(!kthread_should_stop()){
+		mutex_lock(&r->lock);
+		n=ring_process(r);
+		mutex_unlock(&r->lock);
+		if(n){
+			last=jiffies;
+			cond_resched();
+			continue;
+		}
+		if(time_before(jiffies,last+r->idle)){
+			cond_resched();
+			continue;
+		}
+		// 先置 NEED_WAKEUP 再检查一次 SQ，和用户空间先推进 tail 再检查标志配对，不会漏掉命令
+		WRITE_ONCE(r->sq_wake,false);
+		smp_store_mb(r->sq->flags,r->sq->flags|RING_NEED_WAKEUP);
+		if(ring_sq_empty(r))
+			wait_event_interruptible(r->sq_wait,READ_ONCE(r->sq_wake) || kthread_should_stop());
+		WRITE_ONCE(r->sq->flags,r->sq->flags & ~RING_NEED_WAKEUP);
+		last=jiffies;
+	}
+	return 0;
+}
+
+/* 建立共享内存队列，每个文件只能建立一次 */
+static long ring_setup(struct cmd_ring *r,struct ring_params __user *up)
+{
+	struct ring_params p;
+	size_t sqes_off,cqes_off,size;
+	void *mem;
+	int ret=0;
+
+	if(copy_from_user(&p,up,sizeof(p)))
+		return -EFAULT;
+	if(p.sq_entries==0 || p.sq_entries>RING_MAX_ENTRIES || p.flags & ~RING_SQPOLL)
+		return -EINVAL;
+	// 轮询线程空闲时一直占着CPU，只允许有权限调整调度的进程建立，空闲时间也有上限
+	if(p.flags & RING_SQPOLL){
+		if(!capable(CAP_SYS_NICE) && !capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if(p.sq_idle_ms>RING_MAX_IDLE_MS)
+			return -EINVAL;
+	}
+	p.sq_entries=roundup_pow_of_two(p.sq_entries);
+	p.cq_entries=p.sq_entries*2;
+	sqes_off=2*sizeof(struct ring_ctl);
+	cqes_off=sqes_off+p.sq_entries*sizeof(struct ring_sqe);
+	size=PAGE_ALIGN(cqes_off+p.cq_entries*sizeof(struct ring_cqe));
+	p.sqes_off=sqes_off;
+	p.cqes_off=cqes_off;
+	p.mmap_size=size;
+
+	mutex_lock(&r->lock);
+	if(r->mem){
+		ret=-EBUSY;
+		goto out;
+	}
+	mem=vmalloc_user(size);
+	if(mem==NULL){
+		ret=-ENOMEM;
+		goto out;
+	}
+	r->size=size;
+	r->sq=mem;
+	r->cq=mem+sizeof(struct ring_ctl);
+	r->sqes=mem+sqes_off;
+	r->cqes=mem+cqes_off;
+	r->sq_entries=p.sq_entries;
+	r->cq_entries=p.cq_entries;
+	r->sq->mask=p.sq_entries-1;
+	r->cq->mask=p.cq_entries-1;
+	if(p.flags & RING_SQPOLL){
+		r->idle=msecs_to_jiffies(p.sq_idle_ms ? p.sq_idle_ms : RING_MAX_IDLE_MS);
+		r->thread=kthread_run(ring_thread,r,"cmd_ring_sq");
+		if(IS_ERR(r->thread)){
+			ret=PTR_ERR(r->thread);
+			r->thread=NULL;
+			vfree(mem);
+			goto out;
+		}
+	}
+	// 不持锁的 ring_enter/poll 看到 mem 时，队列的指针和 thread 都已经设置好
+	smp_store_release(&r->mem,mem);
+	if(copy_to_user(up,&p,sizeof(p)))
+		ret=-EFAULT;  // 队列已经建立，在 release 时释放
+out:
+	mutex_unlock(&r->lock);
+	return ret;
+}
+
+/* RING_ENTER：执行 SQ 中的命令，SQPOLL 模式下只唤醒内核线程 */
+static long ring_enter(struct cmd_ring *r,unsigned long flags)
+{
+	int n=0,ret;
+
+	if(smp_load_acquire(&r->mem)==NULL)
+		return -ENXIO;
+	if(r->thread){
+		if(READ_ONCE(r->sq->flags) & RING_NEED_WAKEUP){
+			WRITE_ONCE(r->sq_wake,true);
+			wake_up(&r->sq_wait);
+		}
+	}else{
+		mutex_lock(&r->lock);
+		n=ring_process(r);
+		mutex_unlock(&r->lock);
+	}
+	if(flags & RING_ENTER_WAIT){
+		ret=wait_event_interruptible(r->cq_wait,!ring_cq_empty(r));
+		if(ret)
+			return ret;
+	}
+	return n;
+}
+
+/* 打开设备函数 */
+static int cdev_test_open(struct inode *inode,struct file *file)
+{
+	struct cmd_ring *r;
+
+	r=kzalloc(sizeof(*r),GFP_KERNEL);
+	if(r==NULL)
+		return -ENOMEM;
+	mutex_init(&r->lock);
+	init_waitqueue_head(&r->cq_wait);
+	init_waitqueue_head(&r->sq_wait);
+	file->private_data=r;
+	return 0;
+}
+
+/* 关闭设备函数，mmap 的映射持有文件引用，走到这里时共享内存已经没有映射 */
+static int cdev_test_release(struct inode *inode,struct file *file)
+{
+	struct cmd_ring *r=file->private_data;
+
+	if(r->thread)
+		kthread_stop(r->thread);
+	vfree(r->mem);
+	kfree(r);
+	return 0;
+}
+
+/* mmap函数：把共享内存映射到用户空间 */
+static int cdev_test_mmap(struct file *file,struct vm_area_struct *vma)
+{
+	struct cmd_ring *r=file->private_data;
+	int ret;
+
+	mutex_lock(&r->lock);
+	if(r->mem==NULL)
+		ret=-ENXIO;
+	else if(vma->vm_pgoff || vma->vm_end-vma->vm_start>r->size)
+		ret=-EINVAL;
+	else
+		ret=remap_vmalloc_range(vma,r->mem,0);
+	mutex_unlock(&r->lock);
+	return ret;
+}
+
+/* poll函数：先执行 SQ 中的命令，CQ 非空时可读 */
+static __poll_t cdev_test_poll(struct file *file,struct poll_table_struct *p)
+{
+	struct cmd_ring *r=file->private_data;
+
+	if(smp_load_acquire(&r->mem)==NULL)
+		return EPOLLERR;
+	poll_wait(file,&r->cq_wait,p);
+	if(r->thread==NULL && mutex_trylock(&r->lock)){
+		ring_process(r);
+		mutex_unlock(&r->lock);
+	}
+	return ring_cq_empty(r) ? 0 : EPOLLIN|EPOLLRDNORM;
+}
+
+/* ioctl命令处理函数 */
+static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	struct cmd_ring *r=file->private_data;
+
+	switch(cmd){
+		case CMD_BATCH:
+			return ioctl_batch_run(file,arg,do_cmd);
+		case RING_SETUP:
+			return ring_setup(r,(struct ring_params __user *)arg);
+		case RING_ENTER:
+			return ring_enter(r,arg);
+		default:
+			return do_cmd(file,cmd,arg);
+	}
+}
+
 /* 文件操作结构体 */
 struct file_operations cdev_test_fops={
 	.owner=THIS_MODULE,
+	.open=cdev_test_open,
+	.release=cdev_test_release,
+	.mmap=cdev_test_mmap,
+	.poll=cdev_test_poll,
 	.unlocked_ioctl=cdev_test_ioctl,  // 注册ioctl操作
 };
 
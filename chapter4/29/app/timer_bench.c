@@ -0,0 +1,164 @@
+/*
+ * 这是一个定时器服务的测试程序，测量添加/删除定时器的开销和定时器到期的延迟
+ * 步骤一：用 TIMER_ADD 添加N个定时器，到期时间在 [1,最大延时] ms 之间随机，
+ *         分别统计前1000个和最后1000个的平均开销，两者接近说明添加是 O(1) 的
+ * 步骤二：等待所有定时器至少到期一次，用 TIMER_STAT 读出到期次数和延迟的 min/avg/p99/max
+ * 步骤三：按随机顺序用 TIMER_DEL 删除所有定时器，统计平均开销
+ * 使用方法：./timer_bench [定时器个数] [最大延时ms] [periodic]
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<string.h>
+#include<time.h>
+
+/* 与驱动中的定义保持一致 */
+struct timer_req{
+	uint32_t delay_us;
+	uint32_t period_us;
+	int32_t id;
+	uint32_t rsv;
+};
+
+#define TIMER_LAT_BUCKETS 32
+
+struct timer_stat{
+	uint64_t armed;
+	uint64_t expired;
+	int64_t late_min_ns;
+	int64_t late_avg_ns;
+	int64_t late_max_ns;
+	uint64_t hist[TIMER_LAT_BUCKETS];
+};
+
+#define TIMER_ADD _IOWR('L',3,struct timer_req)
+#define TIMER_DEL _IOW('L',4,int)
+#define TIMER_STAT _IOR('L',5,struct timer_stat)
+
+#define EDGE 1000  // 统计开头和结尾各多少次操作
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+
+/* 从直方图估计 p99，返回所在桶的上界 */
+static uint64_t hist_p99(const struct timer_stat *st)
+{
+	uint64_t total=0,sum=0;
+	int k;
+
+	for(k=0;k<TIMER_LAT_BUCKETS;k++)
+		total+=st->hist[k];
+	for(k=0;k<TIMER_LAT_BUCKETS;k++){
+		sum+=st->hist[k];
+		if(sum*100>=total*99)
+			return 2ull<<k;
+	}
+	return 0;
+}
+
+int main(int argc,char *argv[])
+{
+	struct timer_req req;
+	struct timer_stat st;
+	int n=100000,max_ms=1000,periodic=0;
+	int *ids,i,j,tmp,fd;
+	uint64_t t0,t,head=0,tail=0,total;
+	int k;
+
+	if(argc>1)
+		n=atoi(argv[1]);
+	if(argc>2)
+		max_ms=atoi(argv[2]);
+	if(argc>3)
+		periodic=strcmp(argv[3],"periodic")==0;
+	if(n<=0 || max_ms<=0){
+		printf("usage: %s [timers] [max_delay_ms] [periodic]\n",argv[0]);
+		return -1;
+	}
+	ids=malloc(n*sizeof(int));
+	if(ids==NULL){
+		printf("malloc error\n");
+		return -1;
+	}
+
+	// 打开设备节点
+	fd=open("/dev/test",O_RDWR);
+	if(fd<0){
+		printf("file open error\n");
+		return fd;
+	}
+	srand(time(NULL));
+
+	// 步骤一：添加定时器
+	total=now_ns();
+	for(i=0;i<n;i++){
+		memset(&req,0,sizeof(req));
+		req.delay_us=(1+rand()%max_ms)*1000u;
+		req.period_us=periodic ? req.delay_us : 0;
+		t0=now_ns();
+		if(ioctl(fd,TIMER_ADD,&req)<0){
+			perror("TIMER_ADD error");
+			n=i;
+			break;
+		}
+		t=now_ns()-t0;
+		if(i<EDGE)
+			head+=t;
+		if(i>=n-EDGE)
+			tail+=t;
+		ids[i]=req.id;
+	}
+	total=now_ns()-total;
+	if(n==0)
+		return -1;
+	k=n<EDGE ? n : EDGE;
+	printf("arm %d timers: avg %llu ns, first %d avg %llu ns, last %d avg %llu ns\n",n,
+		(unsigned long long)(total/n),k,(unsigned long long)(head/k),k,(unsigned long long)(tail/k));
+
+	// 步骤二：等待定时器到期
+	sleep(max_ms/1000+2);
+	if(ioctl(fd,TIMER_STAT,&st)<0){
+		perror("TIMER_STAT error");
+		return -1;
+	}
+	printf("expired %llu, still armed %llu\n",(unsigned long long)st.expired,(unsigned long long)st.armed);
+	// min 为负数说明有定时器提前到期
+	printf("expiry lateness(ns): min=%lld avg=%lld p99<%llu max=%lld\n",
+		(long long)st.late_min_ns,(long long)st.late_avg_ns,
+		(unsigned long long)hist_p99(&st),(long long)st.late_max_ns);
+	for(k=0;k<TIMER_LAT_BUCKETS;k++){
+		if(st.hist[k])
+			printf("  >= %-12llu %llu\n",1ull<<k,(unsigned long long)st.hist[k]);
+	}
+
+	// 步骤三：随机顺序删除
+	for(i=n-1;i>0;i--){
+		j=rand()%(i+1);
+		tmp=ids[i];
+		ids[i]=ids[j];
+		ids[j]=tmp;
+	}
+	total=now_ns();
+	for(i=0;i<n;i++){
+		if(ioctl(fd,TIMER_DEL,ids[i])<0){
+			perror("TIMER_DEL error");
+			break;
+		}
+	}
+	total=now_ns()-total;
+	printf("cancel %d timers: avg %llu ns\n",i,(unsigned long long)(i ? total/i : 0));
+
+	close(fd);
+	free(ids);
+	return 0;
+}
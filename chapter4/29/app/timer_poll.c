@@ -0,0 +1,84 @@
+/*
+ * 这是一个测试程序，用 poll 事件循环驱动周期性的工作，代替 sleep
+ * 打开设备两次，每个文件有自己的定时器，分别设置不同的周期，poll 等待任意一个定时器到期，
+ * 读出到期次数（包括错过的周期），到期次数大于1说明这个周期的工作被推迟了
+ * 使用方法：./timer_poll [周期1 ms] [周期2 ms] [运行秒数]
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<time.h>
+
+/* 定义ioctl命令，需要与内核模块中的定义保持一致 */
+#define TIMER_OPEN _IO('L',0)     // 打开定时器
+#define TIMER_CLOSE _IO('L',1)    // 关闭定时器
+#define TIMER_SET _IOW('L',2,int) // 设置定时器时间
+
+static inline uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+int main(int argc,char *argv[])
+{
+	struct pollfd fds[2];
+	int period[2]={200,500};
+	uint64_t ticks,total[2]={0,0},start;
+	int seconds=5;
+	int i;
+
+	if(argc>1)
+		period[0]=atoi(argv[1]);
+	if(argc>2)
+		period[1]=atoi(argv[2]);
+	if(argc>3)
+		seconds=atoi(argv[3]);
+
+	// 打开两个文件，分别启动定时器
+	for(i=0;i<2;i++){
+		fds[i].fd=open("/dev/test",O_RDWR|O_NONBLOCK);
+		if(fds[i].fd<0){
+			printf("file open error\n");
+			return -1;
+		}
+		fds[i].events=POLLIN;
+		if(ioctl(fds[i].fd,TIMER_SET,period[i])<0 || ioctl(fds[i].fd,TIMER_OPEN)<0){
+			perror("ioctl error");
+			return -1;
+		}
+	}
+
+	// 事件循环
+	start=now_ms();
+	while(now_ms()-start<(uint64_t)seconds*1000){
+		if(poll(fds,2,-1)<0){
+			perror("poll error");
+			break;
+		}
+		for(i=0;i<2;i++){
+			if(!(fds[i].revents & POLLIN))
+				continue;
+			if(read(fds[i].fd,&ticks,sizeof(ticks))!=sizeof(ticks))
+				continue;
+			total[i]+=ticks;
+			printf("[%6llu ms] timer%d (%d ms) expired %llu%s\n",(unsigned long long)(now_ms()-start),
+				i,period[i],(unsigned long long)ticks,ticks>1 ? " (missed)" : "");
+		}
+	}
+
+	for(i=0;i<2;i++){
+		printf("timer%d: %llu expirations in %d s\n",i,(unsigned long long)total[i],seconds);
+		ioctl(fds[i].fd,TIMER_CLOSE);
+		close(fds[i].fd);
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * 定时器批量命令测试程序
+ * 用 timer_batch_* 把多条设置攒成一批，一次系统调用提交：
+ * 第一批设置时间并启动定时器，第二批添加32个独立的周期定时器，最后一批关闭定时器并读取统计
+ */
+
+#include<stdio.h>
+#include "timerlib.h"
+
+/* 与驱动中的定义保持一致 */
+struct timer_req{
+	uint32_t delay_us;
+	uint32_t period_us;
+	int32_t id;
+	uint32_t rsv;
+};
+
+struct timer_stat{
+	uint64_t armed;
+	uint64_t expired;
+	int64_t late_min_ns;
+	int64_t late_avg_ns;
+	int64_t late_max_ns;
+	uint64_t hist[32];
+};
+
+#define TIMER_ADD _IOWR('L',3,struct timer_req)
+#define TIMER_STAT _IOR('L',5,struct timer_stat)
+
+#define NR_ADD 32
+
+int main(int argc,char *argv[])
+{
+	struct timer_batch b;
+	struct timer_req reqs[NR_ADD];
+	struct timer_stat st;
+	int fd,i,done;
+
+	// 打开设备文件
+	fd=dev_open();
+	if(fd<0)
+		return -1;
+
+	// 第一批：设置定时器时间为1000毫秒并启动
+	timer_batch_init(&b);
+	timer_batch_add(&b,TIMER_SET,1000);
+	timer_batch_add(&b,TIMER_OPEN,0);
+	done=timer_batch_submit(fd,&b,TIMER_BATCH_STOP);
+	printf("batch 1: %d commands done\n",done);
+
+	// 第二批：添加32个周期定时器，每条命令的 arg 指向一个 timer_req
+	timer_batch_init(&b);
+	for(i=0;i<NR_ADD;i++){
+		reqs[i].delay_us=(i+1)*10000;
+		reqs[i].period_us=(i+1)*10000;
+		reqs[i].rsv=0;
+		timer_batch_add(&b,TIMER_ADD,(uintptr_t)&reqs[i]);
+	}
+	done=timer_batch_submit(fd,&b,0);
+	printf("batch 2: %d commands done, first id %d, last id %d\n",done,reqs[0].id,reqs[NR_ADD-1].id);
+
+	// 等待定时器到期3次
+	for(i=0;i<3;){
+		long long ticks=timer_wait(fd);
+		if(ticks<0)
+			break;
+		i+=ticks;
+	}
+
+	// 最后一批：关闭定时器，读取统计
+	timer_batch_init(&b);
+	timer_batch_add(&b,TIMER_CLOSE,0);
+	timer_batch_add(&b,TIMER_STAT,(uintptr_t)&st);
+	done=timer_batch_submit(fd,&b,TIMER_BATCH_STOP);
+	if(done==2)
+		printf("expired %llu, armed %llu, late avg %lld ns max %lld ns\n",
+			(unsigned long long)st.expired,(unsigned long long)st.armed,
+			(long long)st.late_avg_ns,(long long)st.late_max_ns);
+
+	// 关闭设备文件，添加的定时器随之释放
+	close(fd);
+	return 0;
+}
@@ -2,11 +2,26 @@
  * 定时器测试程序
  * 使用定时器库函数演示定时器的基本操作
  * 包括：打开设备、设置时间、启动定时器、修改时间、关闭定时器等
+ * 用 timer_wait 等待定时器到期代替 sleep，周期性的工作跟着定时器的节拍执行
  */
 
 #include<stdio.h>
 #include "timerlib.h"
 
+/* 等待定时器到期n次 */
+static void wait_ticks(int fd,int n)
+{
+	long long ticks;
+
+	while(n>0){
+		ticks=timer_wait(fd);
+		if(ticks<0)
+			break;
+		printf("timer expired %lld times\n",ticks);
+		n-=ticks;
+	}
+}
+
 int main(int argc,char *argv[])
 {
 	int fd;  // 文件描述符
@@ -18,13 +33,13 @@ int main(int argc,char *argv[])
 	timer_set(fd,1000);
 	// 启动定时器
 	timer_open(fd);
-	// 等待3秒
-	sleep(3);
+	// 等待定时器到期3次（3秒）
+	wait_ticks(fd,3);
 	
 	// 修改定时器时间为3000毫秒
 	timer_set(fd,3000);
-	// 等待7秒
-	sleep(7);
+	// 等待定时器到期2次（6秒）
+	wait_ticks(fd,2);
 	
 	// 关闭定时器
 	timer_close(fd);
@@ -0,0 +1,49 @@
+/*
+ * 定时器批量命令函数实现
+ * 把多条命令攒在一起，用一次 CMD_BATCH 提交给驱动，每条命令的返回值写回 cmds[i].result
+ */
+
+#include<stdio.h>
+#include<string.h>
+#include "timerlib.h"
+
+/* 清空一批命令 */
+void timer_batch_init(struct timer_batch *b)
+{
+	memset(b,0,sizeof(*b));
+}
+
+/* 添加一条命令，arg 和单独调用 ioctl 时一样，返回这条命令的序号，满了返回-1 */
+int timer_batch_add(struct timer_batch *b,unsigned int cmd,unsigned long arg)
+{
+	if(b->nr>=TIMER_BATCH_MAX){
+		printf("timer batch full \n");
+		return -1;
+	}
+	b->cmds[b->nr].cmd=cmd;
+	b->cmds[b->nr].result=0;
+	b->cmds[b->nr].arg=arg;
+	return b->nr++;
+}
+
+/* 提交一批命令，返回执行了多少条，提交后清空 */
+int timer_batch_submit(int fd,struct timer_batch *b,int flags)
+{
+	struct ioctl_batch batch;
+	int ret;
+
+	if(b->nr==0)
+		return 0;
+	memset(&batch,0,sizeof(batch));
+	batch.cmds=(uintptr_t)b->cmds;
+	batch.nr=b->nr;
+	batch.flags=flags;
+	// 发送CMD_BATCH命令，一次系统调用执行所有命令
+	ret=ioctl(fd,CMD_BATCH,&batch);
+	if(ret<0){
+		printf("ioctl batch error \n");
+		return -1;
+	}
+	b->nr=0;
+	return batch.done;
+}
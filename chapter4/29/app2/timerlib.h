@@ -10,16 +10,47 @@
 #include<fcntl.h>
 #include<unistd.h>
 #include<sys/ioctl.h>
+#include<stdint.h>
 
 /* 定义ioctl命令，需要与内核模块中的定义保持一致 */
 #define TIMER_OPEN _IO('L',0)     // 打开定时器
 #define TIMER_CLOSE _IO('L',1)    // 关闭定时器
 #define TIMER_SET _IOW('L',2,int) // 设置定时器时间
 
+/* 批量命令，需要与 include/ioctl_batch.h 中的定义保持一致 */
+struct ioctl_cmd{
+	uint32_t cmd;     // ioctl 命令
+	int32_t result;   // 返回值，由驱动写回
+	uint64_t arg;     // ioctl 参数
+};
+
+struct ioctl_batch{
+	uint64_t cmds;    // struct ioctl_cmd 数组的地址
+	uint32_t nr;      // 命令数
+	uint32_t flags;   // TIMER_BATCH_STOP
+	uint32_t done;    // 执行了多少条，由驱动写回
+	uint32_t rsv;
+};
+
+#define CMD_BATCH _IOWR('L',0x10,struct ioctl_batch)
+
+#define TIMER_BATCH_MAX 64   // 一批最多的命令数
+#define TIMER_BATCH_STOP 1   // 遇到失败的命令就停下
+
+/* 攒一批命令，用 timer_batch_submit 一次提交 */
+struct timer_batch{
+	struct ioctl_cmd cmds[TIMER_BATCH_MAX];
+	int nr;
+};
+
 /* 函数声明 */
 int dev_open();           // 打开设备文件
 int timer_open(int fd);   // 启动定时器
 int timer_close(int fd);  // 关闭定时器
 int timer_set(int fd,int arg); // 设置定时器时间
+long long timer_wait(int fd);  // 等待定时器到期，返回到期次数
+void timer_batch_init(struct timer_batch *b);                            // 清空一批命令
+int timer_batch_add(struct timer_batch *b,unsigned int cmd,unsigned long arg); // 添加一条命令，返回序号
+int timer_batch_submit(int fd,struct timer_batch *b,int flags);          // 提交，返回执行了多少条
 
 #endif
@@ -0,0 +1,19 @@
+/*
+ * 定时器等待函数实现
+ * 阻塞读设备，等待定时器到期
+ */
+
+#include<stdio.h>
+#include "timerlib.h"
+
+/* 等待定时器到期函数，返回上次等待之后的到期次数（包括错过的周期） */
+long long timer_wait(int fd)
+{
+	unsigned long long ticks;
+	// 读设备会阻塞到定时器到期
+	if(read(fd,&ticks,sizeof(ticks))!=sizeof(ticks)){
+		printf("read error \n");
+		return -1;
+	}
+	return ticks;
+}
@@ -2,6 +2,9 @@
  * 这是一个Linux内核模块示例，演示了字符设备驱动的基本操作
  * 包括：设备注册、ioctl命令的实现、定时器的使用等
  * 该模块实现了一个支持定时器控制的字符设备驱动
+ * 每个打开的文件有自己的定时器，除了 TIMER_OPEN 控制的定时器，还可以用 TIMER_ADD 添加大量独立的定时器，
+ * 这些定时器都挂在 stimer.h 的每CPU时间轮上，由每个CPU一个 hrtimer 驱动，添加和删除都是 O(1) 的
+ * 所有命令都可以用 CMD_BATCH（见 ../include/ioctl_batch.h）在一次系统调用中批量执行
  */
 
 #include<linux/module.h>
@@ -10,13 +13,55 @@
 #include<linux/kdev_t.h>
 #include<linux/cdev.h>
 #include<linux/uaccess.h>
-#include<linux/timer.h>
+#include<linux/slab.h>
+#include<linux/idr.h>
+#include<linux/mutex.h>
+#include<linux/log2.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/irq_work.h>
+#include"stimer.h"
+#include"ioctl_batch.h"
 
 /* 定义ioctl命令 */
 #define TIMER_OPEN _IO('L',0)    // 打开定时器
 #define TIMER_CLOSE _IO('L',1)   // 关闭定时器
 #define TIMER_SET _IOW('L',2,int)// 设置定时器时间
 
+/* 一个文件可以添加很多个独立的定时器，用 id 区分 */
+struct timer_req{
+	__u32 delay_us;   // 第一次到期的时间
+	__u32 period_us;  // 周期，0表示只触发一次
+	__s32 id;         // TIMER_ADD 返回的定时器 id
+	__u32 rsv;
+};
+
+#define TIMER_LAT_BUCKETS 32  // 第k个桶统计 [2^k,2^(k+1)) ns 的延迟，提前到期（负数）也算在第0个桶
+
+/* 这个文件上的定时器的统计 */
+struct timer_stat{
+	__u64 armed;         // 处于启动状态的定时器数
+	__u64 expired;       // 累计到期次数
+	__s64 late_min_ns;   // 到期时间比设定的时间晚了多少，负数表示提前到期
+	__s64 late_avg_ns;
+	__s64 late_max_ns;
+	__u64 hist[TIMER_LAT_BUCKETS];
+};
+
+#define TIMER_ADD _IOWR('L',3,struct timer_req)  // 添加并启动一个定时器
+#define TIMER_DEL _IOW('L',4,int)                // 删除一个定时器，参数为 id
+#define TIMER_STAT _IOR('L',5,struct timer_stat) // 读取统计，同时清空延迟统计
+
+/* 时间轮的精度 */
+static unsigned int tick_us=1000;
+module_param(tick_us,uint,0444);
+MODULE_PARM_DESC(tick_us,"timer wheel tick in microseconds, default 1000");
+
+/* 每个文件最多的定时器数 */
+static unsigned int max_timers=131072;
+module_param(max_timers,uint,0644);
+MODULE_PARM_DESC(max_timers,"max timers added by TIMER_ADD per open file");
+
 /* 设备结构体定义 */
 struct device_test{
 	dev_t dev_num;        // 设备号
@@ -25,62 +70,319 @@ struct device_test{
 	struct cdev cdev_test;// 字符设备结构体
 	struct class *class;  // 设备类
 	struct device *device;// 设备结构体
-	int counter;          // 定时器计数值
+};
+
+/* 每次 open 的定时器，以前所有进程共用一个全局定时器，第二次 open 会重复 add_timer */
+struct timer_file{
+	struct stimer main;        // TIMER_OPEN/TIMER_CLOSE/TIMER_SET 控制的定时器
+	int counter;               // main 的周期(ms)
+	atomic64_t ticks;          // main 上次 read 之后的到期次数，包括错过的周期
+	wait_queue_head_t wq;      // 等待 main 到期的进程
+	struct irq_work wake;      // 回调持有时间轮的 raw spinlock，唤醒 wq 推迟到 irq_work 中做
+	struct mutex lock;         // 保护 main 的设置和 timers
+	struct idr timers;         // TIMER_ADD 添加的定时器
+	unsigned int nr_timers;
+	raw_spinlock_t stat_lock;  // 保护下面的统计，定时器回调在硬中断中修改
+	u64 armed;
+	u64 expired;
+	s64 late_min,late_max,late_sum;
+	u64 late_cnt;
+	u64 hist[TIMER_LAT_BUCKETS];
+};
+
+/* TIMER_ADD 添加的定时器 */
+struct user_timer{
+	struct stimer st;
+	struct timer_file *tf;
 };
 
 /* 定义设备实例 */
 struct device_test dev1;
 
-/* 定时器回调函数声明 */
-static void function_test(struct timer_list *t);
-/* 定义定时器 */
-DEFINE_TIMER(timer_test,function_test);
+/* 记录一次到期，在定时器回调中调用 */
+static void timer_account(struct timer_file *tf,s64 late_ns,bool oneshot)
+{
+	// 延迟按原值统计，不把提前到期截成0，否则统计里看不出定时器提前触发
+	int k=late_ns>0 ? min_t(int,ilog2((u64)late_ns),TIMER_LAT_BUCKETS-1) : 0;
+
+	raw_spin_lock(&tf->stat_lock);
+	tf->expired++;
+	if(oneshot)
+		tf->armed--;
+	if(tf->late_cnt==0 || late_ns<tf->late_min)
+		tf->late_min=late_ns;
+	if(tf->late_cnt==0 || late_ns>tf->late_max)
+		tf->late_max=late_ns;
+	tf->late_sum+=late_ns;
+	tf->late_cnt++;
+	tf->hist[k]++;
+	raw_spin_unlock(&tf->stat_lock);
+}
+
+static void timer_armed(struct timer_file *tf,int delta)
+{
+	unsigned long flags;
 
-/* 定时器回调函数实现 */
-void function_test(struct timer_list *t)
+	raw_spin_lock_irqsave(&tf->stat_lock,flags);
+	tf->armed+=delta;
+	raw_spin_unlock_irqrestore(&tf->stat_lock,flags);
+}
+
+/* TIMER_OPEN 的定时器回调函数 */
+static void function_test(struct stimer *t,s64 late_ns)
 {
-	printk("this is function_test\n");
-	// 重新设置定时器
-	mod_timer(&timer_test,jiffies_64+msecs_to_jiffies(dev1.counter));
+	struct timer_file *tf=container_of(t,struct timer_file,main);
+
+	pr_debug("this is function_test\n");
+	timer_account(tf,late_ns,false);
+	// 时间轮按 tick 逐个处理，回调被推迟时错过的周期会在这里逐次累加
+	atomic64_inc(&tf->ticks);
+	// wq 的锁是 spinlock_t，在 PREEMPT_RT 上会睡眠，不能在 raw spinlock 下唤醒，
+	// 普通的 irq_work 在 RT 上由线程执行，已经排队时不会重复排队
+	irq_work_queue(&tf->wake);
+}
+
+/* 唤醒等待 main 到期的进程，在 irq_work 中执行，不再持有时间轮的锁 */
+static void timer_wake(struct irq_work *work)
+{
+	struct timer_file *tf=container_of(work,struct timer_file,wake);
+
+	wake_up_interruptible_poll(&tf->wq,EPOLLIN|EPOLLRDNORM);
+}
+
+/* TIMER_ADD 的定时器回调函数 */
+static void user_timer_fn(struct stimer *t,s64 late_ns)
+{
+	struct user_timer *ut=container_of(t,struct user_timer,st);
+
+	timer_account(ut->tf,late_ns,t->period_ns==0);
+}
+
+/* 添加一个定时器，返回 id */
+static int timer_add(struct timer_file *tf,struct timer_req *req)
+{
+	struct user_timer *ut;
+	int id;
+
+	// 周期比 tick 短的定时器每个 tick 只能触发一次，到期次数会少算，延迟也会越来越大
+	if(req->delay_us==0 || (req->period_us && req->period_us<tick_us))
+		return -EINVAL;
+	ut=kzalloc(sizeof(*ut),GFP_KERNEL);
+	if(ut==NULL)
+		return -ENOMEM;
+	ut->tf=tf;
+	stimer_init(&ut->st,user_timer_fn);
+
+	mutex_lock(&tf->lock);
+	if(tf->nr_timers>=max_timers){
+		mutex_unlock(&tf->lock);
+		kfree(ut);
+		return -ENOSPC;
+	}
+	id=idr_alloc(&tf->timers,ut,0,0,GFP_KERNEL);
+	if(id<0){
+		mutex_unlock(&tf->lock);
+		kfree(ut);
+		return id;
+	}
+	tf->nr_timers++;
+	timer_armed(tf,1);
+	stimer_arm(&ut->st,(u64)req->delay_us*NSEC_PER_USEC,(u64)req->period_us*NSEC_PER_USEC);
+	mutex_unlock(&tf->lock);
+	return id;
+}
+
+/* 删除一个定时器，只触发一次的定时器到期后也要删除才会释放 */
+static int timer_del(struct timer_file *tf,int id)
+{
+	struct user_timer *ut;
+
+	mutex_lock(&tf->lock);
+	ut=idr_remove(&tf->timers,id);
+	if(ut==NULL){
+		mutex_unlock(&tf->lock);
+		return -ENOENT;
+	}
+	tf->nr_timers--;
+	if(stimer_cancel(&ut->st))
+		timer_armed(tf,-1);
+	mutex_unlock(&tf->lock);
+	kfree(ut);
+	return 0;
+}
+
+/* 读取统计，延迟统计读取后清空 */
+static void timer_get_stat(struct timer_file *tf,struct timer_stat *st)
+{
+	unsigned long flags;
+
+	memset(st,0,sizeof(*st));
+	raw_spin_lock_irqsave(&tf->stat_lock,flags);
+	st->armed=tf->armed;
+	st->expired=tf->expired;
+	st->late_min_ns=tf->late_min;
+	st->late_max_ns=tf->late_max;
+	st->late_avg_ns=tf->late_cnt ? div64_s64(tf->late_sum,tf->late_cnt) : 0;
+	memcpy(st->hist,tf->hist,sizeof(st->hist));
+	tf->late_min=tf->late_max=tf->late_sum=0;
+	tf->late_cnt=0;
+	memset(tf->hist,0,sizeof(tf->hist));
+	raw_spin_unlock_irqrestore(&tf->stat_lock,flags);
 }
 
 /* 打开设备函数 */
 static int cdev_test_open(struct inode *inode,struct file *file)
 {
-	file->private_data=&dev1;
+	struct timer_file *tf;
+
+	tf=kzalloc(sizeof(*tf),GFP_KERNEL);
+	if(tf==NULL)
+		return -ENOMEM;
+	stimer_init(&tf->main,function_test);
+	tf->counter=1000;
+	atomic64_set(&tf->ticks,0);
+	init_waitqueue_head(&tf->wq);
+	init_irq_work(&tf->wake,timer_wake);
+	mutex_init(&tf->lock);
+	idr_init(&tf->timers);
+	raw_spin_lock_init(&tf->stat_lock);
+	file->private_data=tf;
 	return 0;
 }
 
-/* 关闭设备函数 */
+/* 关闭设备函数，取消并释放这个文件的所有定时器 */
 static int cdev_test_release(struct inode *inode,struct file *file)
 {
-	file->private_data=&dev1;
+	struct timer_file *tf=file->private_data;
+	struct user_timer *ut;
+	int id;
+
+	stimer_cancel(&tf->main);
+	irq_work_sync(&tf->wake);  // 等已经排队的唤醒执行完再释放 tf
+	idr_for_each_entry(&tf->timers,ut,id){
+		stimer_cancel(&ut->st);
+		kfree(ut);
+	}
+	idr_destroy(&tf->timers);
+	kfree(tf);
 	return 0;
 }
 
-/* ioctl命令处理函数 */
-static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+/*
+ * 读设备函数：和 timerfd 一样，阻塞到 TIMER_OPEN 的定时器到期，
+ * 返回一个 u64，是上次 read 之后的到期次数（包括错过的周期），读完清零
+ */
+static ssize_t cdev_test_read(struct file *file,char __user *buf,size_t size,loff_t *off)
+{
+	struct timer_file *tf=file->private_data;
+	u64 ticks;
+	int ret;
+
+	if(size<sizeof(ticks))
+		return -EINVAL;
+	while(1){
+		ticks=atomic64_xchg(&tf->ticks,0);
+		if(ticks)
+			break;
+		if(file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret=wait_event_interruptible(tf->wq,atomic64_read(&tf->ticks)!=0);
+		if(ret)
+			return ret;
+	}
+	if(copy_to_user(buf,&ticks,sizeof(ticks))){
+		// 没有复制出去的到期次数还给下一次 read
+		atomic64_add(ticks,&tf->ticks);
+		return -EFAULT;
+	}
+	return sizeof(ticks);
+}
+
+/* poll函数：定时器到期过就可读 */
+static __poll_t cdev_test_poll(struct file *file,struct poll_table_struct *p)
+{
+	struct timer_file *tf=file->private_data;
+
+	poll_wait(file,&tf->wq,p);
+	return atomic64_read(&tf->ticks) ? EPOLLIN|EPOLLRDNORM : 0;
+}
+
+/* 处理一条ioctl命令，单独调用和批量调用共用 */
+static long do_cmd(struct file *file,unsigned int cmd,unsigned long arg)
 {
-	struct device_test *test_dev=(struct device_test *)file->private_data;
+	struct timer_file *tf=file->private_data;
+	struct timer_req req;
+	struct timer_stat st;
+	u64 period;
+	int ret=0;
 
 	switch(cmd){
 		case TIMER_OPEN:
 			// 启动定时器
-			add_timer(&timer_test);
+			mutex_lock(&tf->lock);
+			period=(u64)tf->counter*NSEC_PER_MSEC;
+			if(period<(u64)tick_us*NSEC_PER_USEC){
+				mutex_unlock(&tf->lock);
+				return -EINVAL;  // 周期不能比 tick 短
+			}
+			if(!stimer_pending(&tf->main))
+				timer_armed(tf,1);
+			atomic64_set(&tf->ticks,0);
+			stimer_arm(&tf->main,period,period);
+			mutex_unlock(&tf->lock);
 			break;
 		case TIMER_CLOSE:
 			// 停止定时器
-			del_timer(&timer_test);
+			mutex_lock(&tf->lock);
+			if(stimer_cancel(&tf->main))
+				timer_armed(tf,-1);
+			atomic64_set(&tf->ticks,0);
+			mutex_unlock(&tf->lock);
 			break;
 		case TIMER_SET:
-			// 设置定时器时间
-			test_dev->counter=arg;
-			timer_test.expires=jiffies_64+msecs_to_jiffies(test_dev->counter);
+			// 设置定时器时间，定时器已经启动时按新的周期重新启动
+			if((int)arg<=0 || (u64)arg*USEC_PER_MSEC<tick_us)
+				return -EINVAL;  // 周期不能比 tick 短
+			mutex_lock(&tf->lock);
+			tf->counter=arg;
+			if(stimer_pending(&tf->main)){
+				period=(u64)tf->counter*NSEC_PER_MSEC;
+				atomic64_set(&tf->ticks,0);
+				stimer_arm(&tf->main,period,period);
+			}
+			mutex_unlock(&tf->lock);
 			break;
-		default:
+		case TIMER_ADD:
+			if(copy_from_user(&req,(void __user *)arg,sizeof(req)))
+				return -EFAULT;
+			ret=timer_add(tf,&req);
+			if(ret<0)
+				return ret;
+			req.id=ret;
+			if(copy_to_user((void __user *)arg,&req,sizeof(req)))
+				return -EFAULT;
+			ret=0;
+			break;
+		case TIMER_DEL:
+			ret=timer_del(tf,(int)arg);
 			break;
+		case TIMER_STAT:
+			timer_get_stat(tf,&st);
+			if(copy_to_user((void __user *)arg,&st,sizeof(st)))
+				return -EFAULT;
+			break;
+		default:
+			return -ENOTTY;
 	}
-	return 0;
+	return ret;
+}
+
+/* ioctl命令处理函数 */
+static long cdev_test_ioctl(struct file *file,unsigned int cmd,unsigned long arg)
+{
+	if(cmd==CMD_BATCH)
+		return ioctl_batch_run(file,arg,do_cmd);
+	return do_cmd(file,cmd,arg);
 }
 
 /* 文件操作结构体 */
@@ -88,6 +390,8 @@ struct file_operations cdev_test_fops={
 	.owner=THIS_MODULE,
 	.open=cdev_test_open,
 	.release=cdev_test_release,
+	.read=cdev_test_read,
+	.poll=cdev_test_poll,
 	.unlocked_ioctl=cdev_test_ioctl,
 };
 
@@ -95,9 +399,17 @@ struct file_operations cdev_test_fops={
 static int __init timer_dev_init(void)
 {
 	int ret;
+
+	// 启动软件定时器服务
+	if(tick_us<10)
+		tick_us=10;
+	ret=stimer_service_init((u64)tick_us*NSEC_PER_USEC);
+	if(ret<0)
+		return ret;
 	
 	// 分配设备号
-	if(alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name")<0){
+	ret=alloc_chrdev_region(&dev1.dev_num,0,1,"alloc_name");
+	if(ret<0){
 		goto err_chrdev;
 	}
 	printk("alloc_chrdev_region is ok\n");
@@ -147,6 +459,7 @@ static int __init timer_dev_init(void)
 		unregister_chrdev_region(dev1.dev_num,1);
 
 	err_chrdev:
+		stimer_service_exit();
 		return ret;
 }
 
@@ -158,6 +471,8 @@ static void __exit timer_dev_exit(void)
 	class_destroy(dev1.class);
 	cdev_del(&dev1.cdev_test);
 	unregister_chrdev_region(dev1.dev_num,1);
+	// 设备文件都已经关闭，所有定时器都已经取消
+	stimer_service_exit();
 	printk("module exit\n");
 }
 
@@ -0,0 +1,83 @@
+/*
+ * ioctl_batch.h - 第四章 ioctl 驱动共用的批量命令
+ *
+ * 用户空间把多条 {cmd,arg} 放在一个数组里，用一次 CMD_BATCH 提交，驱动在一次系统调用中依次执行，
+ * 每条命令的返回值写回数组的 result，done 返回执行了多少条
+ *   arg 和单独调用 ioctl 时一样：值参数直接放在 arg 中，指针参数放用户空间地址
+ *   flags 带 IOCTL_BATCH_STOP 时遇到第一条失败的命令就停下，否则执行完所有命令
+ *   批量命令里不能再嵌套 CMD_BATCH
+ *
+ * 驱动中的用法：把原来 ioctl 的 switch 拆成 do_cmd(file,cmd,arg)，然后
+ *   case CMD_BATCH: return ioctl_batch_run(file,arg,do_cmd);
+ */
+
+#ifndef _IOCTL_BATCH_H_
+#define _IOCTL_BATCH_H_
+
+#include<linux/types.h>
+#include<linux/fs.h>
+#include<linux/slab.h>
+#include<linux/string.h>
+#include<linux/uaccess.h>
+#include<linux/ioctl.h>
+
+#define IOCTL_BATCH_MAX 1024  // 一次最多的命令数
+#define IOCTL_BATCH_STOP 1    // 遇到失败的命令就停下
+
+/* 一条命令 */
+struct ioctl_cmd{
+	__u32 cmd;     // ioctl 命令
+	__s32 result;  // 返回值，由驱动写回
+	__u64 arg;     // ioctl 参数
+};
+
+/* CMD_BATCH 的参数 */
+struct ioctl_batch{
+	__u64 cmds;    // struct ioctl_cmd 数组的用户空间地址
+	__u32 nr;      // 命令数
+	__u32 flags;   // IOCTL_BATCH_STOP
+	__u32 done;    // 执行了多少条，由驱动写回
+	__u32 rsv;
+};
+
+#define CMD_BATCH _IOWR('L',0x10,struct ioctl_batch)
+
+/* 执行一批命令，fn 为驱动处理单条命令的函数 */
+static inline long ioctl_batch_run(struct file *file,unsigned long arg,
+	long (*fn)(struct file *file,unsigned int cmd,unsigned long arg))
+{
+	struct ioctl_batch __user *ubatch=(struct ioctl_batch __user *)arg;
+	struct ioctl_batch batch;
+	struct ioctl_cmd *cmds;
+	long ret=0;
+	u32 i;
+
+	if(copy_from_user(&batch,ubatch,sizeof(batch)))
+		return -EFAULT;
+	if(batch.nr==0 || batch.nr>IOCTL_BATCH_MAX || batch.flags & ~IOCTL_BATCH_STOP)
+		return -EINVAL;
+	// 整个数组一次复制进来，执行完再一次复制回去
+	cmds=memdup_user(u64_to_user_ptr(batch.cmds),batch.nr*sizeof(*cmds));
+	if(IS_ERR(cmds))
+		return PTR_ERR(cmds);
+
+	for(i=0;i<batch.nr;i++){
+		if(cmds[i].cmd==CMD_BATCH)
+			cmds[i].result=-EINVAL;
+		else
+			cmds[i].result=fn(file,cmds[i].cmd,(unsigned long)cmds[i].arg);
+		if(cmds[i].result<0 && (batch.flags & IOCTL_BATCH_STOP)){
+			i++;
+			break;
+		}
+	}
+	batch.done=i;
+
+	if(copy_to_user(u64_to_user_ptr(batch.cmds),cmds,i*sizeof(*cmds)) ||
+		put_user(batch.done,&ubatch->done))
+		ret=-EFAULT;
+	kfree(cmds);
+	return ret;
+}
+
+#endif
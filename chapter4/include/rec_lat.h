@@ -0,0 +1,254 @@
+/*
+ * rec_lat.h - 第四章等待队列驱动共用的记录延时统计
+ *
+ * 每条记录写入时用 ktime_get_ns() 记下入队时间，放在和记录队列同步进出的时间戳队列中，
+ * 读进程取出记录时再采样一次，按CPU分别记录三段时间的 log2 直方图，通过 debugfs 导出：
+ *   queue  记录从写入到被读进程取出的时间（端到端）
+ *   wake   写进程调用 wake_up 到被唤醒的读进程重新运行的时间（调度延时）
+ *   copy   把记录复制到用户空间的时间
+ *   /sys/kernel/debug/<name>/latency  查看统计结果
+ *   /sys/kernel/debug/<name>/reset    写入任意值清空统计
+ *   /sys/kernel/debug/<name>/enable   写0/1关闭/打开采样
+ *
+ * 用法（时间戳队列的进出都要在保护记录队列的锁中）：
+ *   写：kfifo_in(...); rec_lat_enqueue(&stamps);  ...  rec_lat_wake(&rl); wake_up(...);
+ *   读：wait_event(...); rec_lat_woken(&rl);
+ *       t0=ktime_get_ns(); kfifo_to_user(...); rec_lat_copied(&rl,t0);
+ *       deq=rec_lat_dequeue(&rl,&stamps,&enq);
+ *   时间戳队列的长度按最短的记录（1字节）计算，记录队列满时时间戳队列也不会满
+ */
+
+#ifndef _REC_LAT_H_
+#define _REC_LAT_H_
+
+#include<linux/module.h>
+#include<linux/fs.h>
+#include<linux/types.h>
+#include<linux/kfifo.h>
+#include<linux/ktime.h>
+#include<linux/math64.h>
+#include<linux/percpu.h>
+#include<linux/log2.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+
+#define REC_LAT_BUCKETS 32    // 第k个桶统计 [2^k,2^(k+1)) ns，最后一个桶包含更长的时间
+#define REC_LAT_STAMPS 2048   // 时间戳队列的长度，4096字节的记录队列最多放1365条记录
+
+/* 统计的时间段 */
+enum rec_lat_type{
+	REC_LAT_QUEUE,  // 写入到取出
+	REC_LAT_WAKE,   // 唤醒到运行
+	REC_LAT_COPY,   // 复制到用户空间
+	REC_LAT_NR,
+};
+
+static const char * const rec_lat_names[REC_LAT_NR]={"queue","wake","copy"};
+
+/* 每个CPU上的统计数据 */
+struct rec_lat_cpu{
+	u64 hist[REC_LAT_NR][REC_LAT_BUCKETS];
+	u64 count[REC_LAT_NR];
+	u64 total[REC_LAT_NR];
+	u64 max[REC_LAT_NR];
+};
+
+/* 一个设备的延时统计 */
+struct rec_lat{
+	const char *name;                  // debugfs 目录名
+	bool enable;                       // 是否采样
+	u64 wake_ns;                       // 最近一次唤醒读进程的时间
+	struct rec_lat_cpu __percpu *cpu;  // 每个CPU的统计数据
+	struct dentry *dir;                // debugfs 目录
+};
+
+/* 驱动的 rec_ts 模式下 read 放在记录前面的时间戳，CLOCK_MONOTONIC，单位 ns */
+struct rec_lat_ts{
+	__u64 write_ns;  // 写入时间
+	__u64 read_ns;   // 取出时间
+};
+
+/* 每条记录的入队时间，和记录队列一一对应 */
+struct rec_stamps{
+	DECLARE_KFIFO_PTR(fifo,u64);
+};
+
+static inline int rec_lat_bucket(u64 ns)
+{
+	int k;
+	if(ns==0)
+		return 0;
+	k=ilog2(ns);
+	return k<REC_LAT_BUCKETS ? k : REC_LAT_BUCKETS-1;
+}
+
+static inline void rec_lat_add(struct rec_lat *rl,enum rec_lat_type type,u64 delta)
+{
+	struct rec_lat_cpu *st;
+
+	st=get_cpu_ptr(rl->cpu);
+	st->hist[type][rec_lat_bucket(delta)]++;
+	st->count[type]++;
+	st->total[type]+=delta;
+	if(delta>st->max[type])
+		st->max[type]=delta;
+	put_cpu_ptr(rl->cpu);
+}
+
+static inline int rec_stamps_alloc(struct rec_stamps *s)
+{
+	return kfifo_alloc(&s->fifo,REC_LAT_STAMPS,GFP_KERNEL);
+}
+
+static inline void rec_stamps_free(struct rec_stamps *s)
+{
+	kfifo_free(&s->fifo);
+}
+
+/* 写入一条记录之后调用，记下入队时间 */
+static inline void rec_lat_enqueue(struct rec_stamps *s)
+{
+	kfifo_put(&s->fifo,ktime_get_ns());
+}
+
+/* 下一条记录的入队时间，不从时间戳队列中删除 */
+static inline u64 rec_lat_peek(struct rec_stamps *s)
+{
+	u64 enq;
+
+	if(!kfifo_peek(&s->fifo,&enq))
+		enq=ktime_get_ns();
+	return enq;
+}
+
+/* 取出一条记录之后调用，enq 返回入队时间，记录端到端延时，返回取出的时间 */
+static inline u64 rec_lat_dequeue(struct rec_lat *rl,struct rec_stamps *s,u64 *enq)
+{
+	u64 now=ktime_get_ns();
+
+	if(!kfifo_get(&s->fifo,enq))
+		*enq=now;
+	if(READ_ONCE(rl->enable))
+		rec_lat_add(rl,REC_LAT_QUEUE,now-*enq);
+	return now;
+}
+
+/* 写进程唤醒读进程之前调用 */
+static inline void rec_lat_wake(struct rec_lat *rl)
+{
+	if(READ_ONCE(rl->enable))
+		WRITE_ONCE(rl->wake_ns,ktime_get_ns());
+}
+
+/* 读进程从等待队列中醒来后调用，记录调度延时 */
+static inline void rec_lat_woken(struct rec_lat *rl)
+{
+	u64 wake=READ_ONCE(rl->wake_ns);
+	u64 now;
+
+	if(!READ_ONCE(rl->enable) || wake==0)
+		return;
+	now=ktime_get_ns();
+	if(now>wake)
+		rec_lat_add(rl,REC_LAT_WAKE,now-wake);
+}
+
+/* 复制完成后调用，t0 为开始复制的时间 */
+static inline void rec_lat_copied(struct rec_lat *rl,u64 t0)
+{
+	if(READ_ONCE(rl->enable))
+		rec_lat_add(rl,REC_LAT_COPY,ktime_get_ns()-t0);
+}
+
+/* latency 文件：三段时间的汇总和直方图 */
+static inline int rec_lat_show(struct seq_file *m,void *v)
+{
+	struct rec_lat *rl=m->private;
+	struct rec_lat_cpu *st;
+	u64 hist[REC_LAT_BUCKETS];
+	u64 count,total,max;
+	int cpu,t,k;
+
+	seq_printf(m,"device: %s  enable: %d\n",rl->name,rl->enable);
+	for(t=0;t<REC_LAT_NR;t++){
+		memset(hist,0,sizeof(hist));
+		count=total=max=0;
+		for_each_possible_cpu(cpu){
+			st=per_cpu_ptr(rl->cpu,cpu);
+			for(k=0;k<REC_LAT_BUCKETS;k++)
+				hist[k]+=st->hist[t][k];
+			count+=st->count[t];
+			total+=st->total[t];
+			if(st->max[t]>max)
+				max=st->max[t];
+		}
+		seq_printf(m,"%s: count %llu avg %llu max %llu (ns)\n",rec_lat_names[t],
+			count,count ? div64_u64(total,count) : 0,max);
+		for(k=0;k<REC_LAT_BUCKETS;k++){
+			if(hist[k]==0)
+				continue;
+			seq_printf(m,"  >= %-12llu %llu\n",1ULL<<k,hist[k]);
+		}
+	}
+	return 0;
+}
+
+static inline int rec_lat_open(struct inode *inode,struct file *file)
+{
+	return single_open(file,rec_lat_show,inode->i_private);
+}
+
+static const struct file_operations rec_lat_fops={
+	.owner=THIS_MODULE,
+	.open=rec_lat_open,
+	.read=seq_read,
+	.llseek=seq_lseek,
+	.release=single_release,
+};
+
+/* reset 文件：写入任意内容清空所有CPU的统计 */
+static inline ssize_t rec_lat_reset_write(struct file *file,const char __user *buf,size_t size,loff_t *off)
+{
+	struct rec_lat *rl=file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(rl->cpu,cpu),0,sizeof(struct rec_lat_cpu));
+	return size;
+}
+
+static const struct file_operations rec_lat_reset_fops={
+	.owner=THIS_MODULE,
+	.open=simple_open,
+	.write=rec_lat_reset_write,
+	.llseek=noop_llseek,
+};
+
+/* 初始化统计数据并创建 debugfs 文件，在模块初始化时调用 */
+static inline int rec_lat_init(struct rec_lat *rl,const char *name)
+{
+	rl->name=name;
+	rl->enable=true;
+	rl->wake_ns=0;
+	rl->cpu=alloc_percpu(struct rec_lat_cpu);
+	if(rl->cpu==NULL)
+		return -ENOMEM;
+
+	rl->dir=debugfs_create_dir(name,NULL);
+	debugfs_create_file("latency",0444,rl->dir,rl,&rec_lat_fops);
+	debugfs_create_file("reset",0200,rl->dir,rl,&rec_lat_reset_fops);
+	debugfs_create_bool("enable",0644,rl->dir,&rl->enable);
+	return 0;
+}
+
+/* 删除 debugfs 文件并释放统计数据，在模块退出时调用，rl->cpu 为空时什么也不做 */
+static inline void rec_lat_exit(struct rec_lat *rl)
+{
+	if(rl->cpu==NULL)
+		return;
+	debugfs_remove_recursive(rl->dir);
+	free_percpu(rl->cpu);
+	rl->cpu=NULL;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * rec_wait.h - 第四章等待队列驱动共用的读进程等待
+ *
+ * 读进程在 wq 上等待记录队列 fifo 非空，excl 为 true 时使用互斥唤醒：
+ * 读进程排在等待队列末尾，每次写入只唤醒队首的一个读进程，读进程按先来后到轮流被唤醒
+ *
+ * 用法（调用时不能持有保护 fifo 的锁）：
+ *   while(队列为空){ 解锁; if(rec_read_wait(&wq,&fifo,&lat,excl)) return -ERESTARTSYS; 加锁; }
+ *   取出记录; 解锁; rec_read_pass_on(&wq,&fifo,excl);
+ */
+
+#ifndef _REC_WAIT_H_
+#define _REC_WAIT_H_
+
+#include<linux/wait.h>
+#include<linux/kfifo.h>
+#include"rec_lat.h"
+
+/*
+ * 等待队列中有记录，成功时统计从写进程唤醒到这里的调度延时
+ * 互斥唤醒模式下被信号打断时如果队列中还有记录，把这次唤醒传给下一个读进程
+ */
+static inline int rec_read_wait(wait_queue_head_t *wq,struct kfifo_rec_ptr_2 *fifo,struct rec_lat *lat,bool excl)
+{
+	int ret;
+
+	if(!excl){
+		ret=wait_event_interruptible(*wq,!kfifo_is_empty(fifo));
+	}else{
+		ret=wait_event_interruptible_exclusive(*wq,!kfifo_is_empty(fifo));
+		if(ret && !kfifo_is_empty(fifo))
+			wake_up_interruptible(wq);
+	}
+	if(ret==0)
+		rec_lat_woken(lat);
+	return ret;
+}
+
+/* 读进程取完记录后调用，互斥唤醒模式下队列中还有记录时继续唤醒下一个读进程 */
+static inline void rec_read_pass_on(wait_queue_head_t *wq,struct kfifo_rec_ptr_2 *fifo,bool excl)
+{
+	if(excl && !kfifo_is_empty(fifo))
+		wake_up_interruptible(wq);
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * stimer.h - 第四章驱动共用的软件定时器服务
+ *
+ * 大量定时器复用少量高精度定时器：每个CPU一个时间轮，时间轮由一个绑定在这个CPU上的 hrtimer 驱动，
+ * hrtimer 按 tick 周期触发，每次处理一个槽。定时器按到期的 tick 号放进对应的槽（散列时间轮），
+ * 添加和删除都只是链表操作，是 O(1) 的，时间轮转一圈还没到期的定时器留在槽里等下一圈
+ * 每次放进时间轮时都按应该到期的时间向上取整到 tick，定时器不会提前触发，最多晚一个 tick，
+ * 周期定时器按 due_ns 累加周期重新计算，周期不是 tick 的整数倍时也不会累积误差
+ *
+ * 用法：
+ *   stimer_service_init(tick_ns);          // 模块初始化时调用
+ *   stimer_init(&t,fn);
+ *   stimer_arm(&t,delay_ns,period_ns);     // period_ns 为0时只触发一次，可以在任意进程上下文中调用
+ *                                          // period_ns 不能小于 tick，否则每个 tick 只触发一次，到期次数会少算
+ *   stimer_cancel(&t);                     // 返回后 fn 不会再被调用
+ *   stimer_service_exit();                 // 模块退出时调用，之前要取消所有定时器
+ * fn 在硬中断中、持有时间轮的锁时调用，不能睡眠，也不能对定时器调用 stimer_arm/stimer_cancel，
+ * late_ns 是实际触发的时间比应该到期的时间晚了多少，正常情况下不会是负数
+ */
+
+#ifndef _STIMER_H_
+#define _STIMER_H_
+
+#include<linux/types.h>
+#include<linux/list.h>
+#include<linux/spinlock.h>
+#include<linux/hrtimer.h>
+#include<linux/ktime.h>
+#include<linux/math64.h>
+#include<linux/percpu.h>
+#include<linux/smp.h>
+
+#define STIMER_SLOTS 4096  // 每个时间轮的槽数，必须是2的幂
+
+struct stimer;
+typedef void (*stimer_fn)(struct stimer *t,s64 late_ns);
+
+/* 一个软件定时器 */
+struct stimer{
+	struct hlist_node node;  // 挂在时间轮的槽上，没有挂上时表示没有启动
+	u64 expires;             // 到期的 tick 号
+	u64 due_ns;              // 应该到期的时间
+	u64 period_ns;           // 周期，0表示只触发一次
+	int cpu;                 // 所在的时间轮
+	stimer_fn fn;            // 到期时调用的函数
+};
+
+/* 每个CPU的时间轮 */
+struct stimer_wheel{
+	raw_spinlock_t lock;                   // 保护下面的成员，hrtimer 回调在硬中断中执行
+	struct hrtimer timer;                  // 驱动时间轮的 hrtimer
+	u64 now;                               // 已经处理到的 tick 号
+	u64 next_ns;                           // 下一个 tick（now+1）计划的时间，和 hrtimer 的到期时间一致
+	unsigned long armed;                   // 时间轮上的定时器数，为0时停止 hrtimer
+	struct hlist_head slot[STIMER_SLOTS];
+};
+
+static struct stimer_wheel __percpu *stimer_wheels;
+static u64 stimer_tick_ns;
+
+/* 第一个计划时间不早于 due_ns 的 tick 号，至少是 now+1 */
+static inline u64 stimer_expires(struct stimer_wheel *w,u64 due_ns)
+{
+	u64 ticks=1;
+
+	// 第 now+1 个 tick 在 next_ns 触发，之后每个 tick 加 stimer_tick_ns
+	if(due_ns>w->next_ns)
+		ticks+=div64_u64(due_ns-w->next_ns+stimer_tick_ns-1,stimer_tick_ns);
+	return w->now+ticks;
+}
+
+/* hrtimer 回调：处理到期的 tick，时间轮上没有定时器时停下来 */
+static enum hrtimer_restart stimer_tick(struct hrtimer *h)
+{
+	struct stimer_wheel *w=container_of(h,struct stimer_wheel,timer);
+	struct hlist_node *tmp;
+	struct stimer *t;
+	u64 n,now_ns;
+
+	raw_spin_lock(&w->lock);
+	n=hrtimer_forward_now(h,ns_to_ktime(stimer_tick_ns));
+	now_ns=ktime_get_ns();
+	// 回调被推迟了好几个 tick 时，把错过的槽依次处理掉
+	while(n--){
+		w->now++;
+		w->next_ns+=stimer_tick_ns;
+		hlist_for_each_entry_safe(t,tmp,&w->slot[w->now & (STIMER_SLOTS-1)],node){
+			if(t->expires!=w->now)
+				continue;  // 后面几圈才到期
+			hlist_del_init(&t->node);
+			t->fn(t,(s64)(now_ns-t->due_ns));
+			if(t->period_ns){
+				// 周期定时器按原来的节拍重新计算到期的 tick，不会提前，也不会累积误差
+				t->due_ns+=t->period_ns;
+				t->expires=stimer_expires(w,t->due_ns);
+				hlist_add_head(&t->node,&w->slot[t->expires & (STIMER_SLOTS-1)]);
+			}else{
+				w->armed--;
+			}
+		}
+	}
+	n=w->armed;
+	raw_spin_unlock(&w->lock);
+	return n ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+static inline void stimer_init(struct stimer *t,stimer_fn fn)
+{
+	INIT_HLIST_NODE(&t->node);
+	t->fn=fn;
+	t->cpu=-1;
+}
+
+static inline bool stimer_pending(struct stimer *t)
+{
+	return !hlist_unhashed(&t->node);
+}
+
+/* 取消定时器，返回定时器在取消之前是否处于启动状态 */
+static inline bool stimer_cancel(struct stimer *t)
+{
+	struct stimer_wheel *w;
+	unsigned long flags;
+	bool pending=false;
+	int cpu=READ_ONCE(t->cpu);
+
+	if(cpu<0)
+		return false;
+	w=per_cpu_ptr(stimer_wheels,cpu);
+	raw_spin_lock_irqsave(&w->lock,flags);
+	if(stimer_pending(t)){
+		hlist_del_init(&t->node);
+		w->armed--;
+		pending=true;
+	}
+	raw_spin_unlock_irqrestore(&w->lock,flags);
+	return pending;
+}
+
+/*
+ * 启动定时器，已经启动的定时器先取消，放到当前CPU的时间轮上
+ * 到期的 tick 按 delay_ns 向上取整，定时器不会提前触发，最多晚一个 tick
+ */
+static inline void stimer_arm(struct stimer *t,u64 delay_ns,u64 period_ns)
+{
+	struct stimer_wheel *w;
+	unsigned long flags;
+	u64 now_ns;
+
+	stimer_cancel(t);
+
+	w=get_cpu_ptr(stimer_wheels);
+	raw_spin_lock_irqsave(&w->lock,flags);
+	now_ns=ktime_get_ns();
+	if(w->armed==0){
+		// 时间轮停着，从现在开始重新计 tick，用绝对时间启动 hrtimer，和 next_ns 保持一致
+		w->next_ns=now_ns+stimer_tick_ns;
+		hrtimer_start(&w->timer,ns_to_ktime(w->next_ns),HRTIMER_MODE_ABS_PINNED);
+	}
+	t->due_ns=now_ns+delay_ns;
+	t->expires=stimer_expires(w,t->due_ns);
+	t->period_ns=period_ns;
+	t->cpu=smp_processor_id();
+	hlist_add_head(&t->node,&w->slot[t->expires & (STIMER_SLOTS-1)]);
+	w->armed++;
+	raw_spin_unlock_irqrestore(&w->lock,flags);
+	put_cpu_ptr(stimer_wheels);
+}
+
+/* 分配每个CPU的时间轮，tick_ns 为时间轮的精度 */
+static inline int stimer_service_init(u64 tick_ns)
+{
+	struct stimer_wheel *w;
+	int cpu,i;
+
+	stimer_tick_ns=tick_ns;
+	stimer_wheels=alloc_percpu(struct stimer_wheel);
+	if(stimer_wheels==NULL)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu){
+		w=per_cpu_ptr(stimer_wheels,cpu);
+		raw_spin_lock_init(&w->lock);
+		// 4.19 上不带 _SOFT 的模式都在硬中断中到期
+		hrtimer_init(&w->timer,CLOCK_MONOTONIC,HRTIMER_MODE_ABS_PINNED);
+		w->timer.function=stimer_tick;
+		for(i=0;i<STIMER_SLOTS;i++)
+			INIT_HLIST_HEAD(&w->slot[i]);
+	}
+	return 0;
+}
+
+/* 停止所有时间轮并释放，调用之前所有定时器都已经取消 */
+static inline void stimer_service_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		hrtimer_cancel(&per_cpu_ptr(stimer_wheels,cpu)->timer);
+	free_percpu(stimer_wheels);
+}
+
+#endif